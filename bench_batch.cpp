@@ -0,0 +1,72 @@
+#include <iostream>
+#include <iomanip>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include "event_loop.h"
+
+using namespace std;
+using namespace std::chrono;
+using namespace kaiu;
+
+/*
+ * Events per second through a single four-thread pool, against the maximum
+ * number of events a worker takes from the queue at once.
+ *
+ * The main thread produces the events in chunks, either with one push per
+ * event or with one push_bulk per chunk.
+ */
+
+const int threads = 4;
+const int chunks = 2000;
+const int chunk_size = 256;
+
+double run(const size_t batch, const EventLoopQueue queue, const bool bulk)
+{
+	ParallelEventLoop loop({
+		{ EventLoopPool::calculation, { threads, queue, 1024, batch } }
+	});
+	atomic<long> count{0};
+	auto event = [&count] (EventLoop&) {
+		count.fetch_add(1, memory_order_relaxed);
+	};
+	const auto start = steady_clock::now();
+	vector<EventLoop::Event> events;
+	events.reserve(chunk_size);
+	for (int i = 0; i < chunks; i++) {
+		if (bulk) {
+			for (int j = 0; j < chunk_size; j++) {
+				events.emplace_back(event);
+			}
+			loop.push_bulk(EventLoopPool::calculation, move(events));
+			events.clear();
+		} else {
+			for (int j = 0; j < chunk_size; j++) {
+				loop.push(EventLoopPool::calculation, event);
+			}
+		}
+	}
+	loop.join();
+	const duration<double> elapsed = steady_clock::now() - start;
+	return count / elapsed.count();
+}
+
+int main(int argc, char *argv[])
+{
+	cout << setw(8) << "batch"
+		<< setw(16) << "shared (ev/s)"
+		<< setw(16) << "+bulk push"
+		<< setw(16) << "stealing"
+		<< setw(16) << "+bulk push"
+		<< setw(16) << "ring"
+		<< setw(16) << "+bulk push" << endl;
+	for (size_t batch = 1; batch <= 128; batch *= 2) {
+		cout << setw(8) << batch << fixed << setprecision(0);
+		for (const auto queue : { EventLoopQueue::shared, EventLoopQueue::work_stealing, EventLoopQueue::lock_free_ring }) {
+			cout << setw(16) << run(batch, queue, false)
+				<< setw(16) << run(batch, queue, true);
+		}
+		cout << endl;
+	}
+	return 0;
+}
@@ -0,0 +1,68 @@
+#include <iostream>
+#include <iomanip>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <vector>
+#include "event_loop.h"
+
+using namespace std;
+using namespace std::chrono;
+using namespace kaiu;
+
+/*
+ * Events per second through a single pool, for the shared-queue, work-stealing
+ * and lock-free ring modes.
+ *
+ * Each root event spawns a binary tree of events into the same pool, which is
+ * the typical pattern for fan-out from within a pool.
+ */
+
+const int roots = 64;
+const int depth = 11;
+
+double run(const int threads, const EventLoopQueue queue)
+{
+	ParallelEventLoop loop({
+		{ EventLoopPool::calculation, { threads, queue } }
+	});
+	atomic<long> count{0};
+	function<void(EventLoop&, int)> node = [&] (EventLoop& loop, int level) {
+		count.fetch_add(1, memory_order_relaxed);
+		if (level == 0) {
+			return;
+		}
+		for (int i = 0; i < 2; i++) {
+			loop.push(EventLoopPool::same, [&node, level] (EventLoop& loop) {
+				node(loop, level - 1);
+			});
+		}
+	};
+	const auto start = steady_clock::now();
+	for (int i = 0; i < roots; i++) {
+		loop.push(EventLoopPool::calculation, [&node] (EventLoop& loop) {
+			node(loop, depth);
+		});
+	}
+	loop.join();
+	const duration<double> elapsed = steady_clock::now() - start;
+	return count / elapsed.count();
+}
+
+int main(int argc, char *argv[])
+{
+	cout << setw(8) << "threads"
+		<< setw(16) << "shared (ev/s)"
+		<< setw(16) << "stealing (ev/s)"
+		<< setw(16) << "ring (ev/s)" << endl;
+	for (int threads = 1; threads <= 64; threads *= 2) {
+		const double shared = run(threads, EventLoopQueue::shared);
+		const double stealing = run(threads, EventLoopQueue::work_stealing);
+		const double ring = run(threads, EventLoopQueue::lock_free_ring);
+		cout << setw(8) << threads
+			<< setw(16) << fixed << setprecision(0) << shared
+			<< setw(16) << stealing
+			<< setw(16) << ring << endl;
+	}
+	return 0;
+}
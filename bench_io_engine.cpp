@@ -0,0 +1,139 @@
+#include <iostream>
+#include <iomanip>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <string>
+#include <functional>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "event_loop.h"
+#include "promise.h"
+#include "promise_stream.h"
+#include "buffer_pool.h"
+#include "io_engine.h"
+
+using namespace std;
+using namespace std::chrono;
+using namespace kaiu;
+
+/*
+ * Read throughput of a file on tmpfs (so the device is not the bottleneck),
+ * io_uring against blocking reads in a four-thread io_local pool.
+ *
+ * "random": reads of block_size at random aligned offsets, with depth reads
+ * kept in flight.  "stream": read_stream over the whole file.
+ */
+
+const size_t file_size = 64 << 20;
+const int threads = 4;
+const int depth = 64;
+
+string make_file()
+{
+	struct stat info;
+	const string dir = stat("/dev/shm", &info) == 0 ? "/dev/shm" : "/tmp";
+	const string path = dir + "/kaiu_bench_io_engine";
+	const int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	vector<char> block(1 << 20, 'x');
+	for (size_t done = 0; done < file_size; done += block.size()) {
+		if (::write(fd, block.data(), block.size()) < 0) {
+			throw runtime_error("Failed to write benchmark file");
+		}
+	}
+	close(fd);
+	return path;
+}
+
+void wait_until(const atomic<bool>& done)
+{
+	while (!done) {
+		this_thread::sleep_for(100us);
+	}
+}
+
+/* Reads per second */
+double random_reads(IoEngine& engine, const int fd, const size_t block_size, const int count)
+{
+	vector<vector<char>> buffers(depth, vector<char>(block_size));
+	atomic<int> issued{0};
+	atomic<int> completed{0};
+	atomic<bool> done{false};
+	const size_t blocks = file_size / block_size;
+	/* Each slot reads, then issues its next read from the completion */
+	function<void(int)> next = [&] (const int slot) {
+		const int n = issued++;
+		if (n >= count) {
+			return;
+		}
+		const off_t offset = ((n * 2654435761u) % blocks) * block_size;
+		engine.read(fd, buffers[slot].data(), block_size, offset)
+			->then([&, slot] (size_t) {
+				if (++completed == count) {
+					done = true;
+				}
+				next(slot);
+			});
+	};
+	const auto start = steady_clock::now();
+	for (int slot = 0; slot < depth; slot++) {
+		next(slot);
+	}
+	wait_until(done);
+	const duration<double> elapsed = steady_clock::now() - start;
+	return count / elapsed.count();
+}
+
+/* Bytes per second */
+double stream(IoEngine& engine, const int fd, const size_t chunk_size)
+{
+	BufferPool buffers(chunk_size, 8);
+	atomic<bool> done{false};
+	size_t total = 0;
+	const auto start = steady_clock::now();
+	engine.read_stream(fd, buffers)
+		->stream([] (Buffer) { })
+		->then([&] (size_t count) {
+			total = count;
+			done = true;
+		});
+	wait_until(done);
+	const duration<double> elapsed = steady_clock::now() - start;
+	return total / elapsed.count();
+}
+
+int main(int argc, char *argv[])
+{
+	const string path = make_file();
+	const int fd = open(path.c_str(), O_RDONLY);
+	ParallelEventLoop loop({
+		{ EventLoopPool::io_local, threads }
+	});
+	IoEngine uring(loop, EventLoopPool::io_local, 256, IoEngine::Backend::automatic);
+	IoEngine pool(loop, EventLoopPool::io_local, 256, IoEngine::Backend::threads);
+	if (uring.backend() != IoEngine::Backend::uring) {
+		cout << "io_uring unavailable, both columns use the thread pool" << endl;
+	}
+	cout << setw(12) << "test"
+		<< setw(10) << "block"
+		<< setw(16) << "io_uring"
+		<< setw(16) << "thread pool" << endl;
+	cout << fixed << setprecision(0);
+	for (const size_t block : { 4096, 65536 }) {
+		const int count = block == 4096 ? 200000 : 20000;
+		cout << setw(12) << "random (op/s)" << setw(10) << block
+			<< setw(16) << random_reads(uring, fd, block, count)
+			<< setw(16) << random_reads(pool, fd, block, count) << endl;
+	}
+	for (const size_t chunk : { 65536, 1 << 20 }) {
+		cout << setw(12) << "stream (MB/s)" << setw(10) << chunk
+			<< setw(16) << stream(uring, fd, chunk) / (1 << 20)
+			<< setw(16) << stream(pool, fd, chunk) / (1 << 20) << endl;
+	}
+	loop.join();
+	close(fd);
+	unlink(path.c_str());
+	return 0;
+}
@@ -0,0 +1,208 @@
+#include <iostream>
+#include <iomanip>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <new>
+#include <cstdlib>
+#include "promise.h"
+
+using namespace std;
+using namespace std::chrono;
+using namespace kaiu;
+
+/*
+ * Promise then-chains of one million links, in links per second.
+ *
+ * "resolved": each link is bound to an already-resolved promise, so its
+ * callback runs immediately.
+ *
+ * "pending": chains of 1000 links are bound to a pending promise, which is
+ * then resolved and the whole chain runs.  (One chain of a million pending
+ * links would recurse a million deep.)
+ *
+ * "rejected": as "pending", but the root is rejected, so the rejection crosses
+ * every link (which return promises and have no handlers) to a handler at
+ * the end of the chain.
+ *
+ * "two threads": one thread binds a link to each of a million pending
+ * promises while another resolves them, so binding and resolving race.
+ *
+ * "combine": 100k pending promises are combined into one, then resolved by
+ * 1-8 threads, in promises per second.
+ *
+ * Heap allocations per link are counted by replacing operator new.  Promise
+ * states come from the slab pools rather than operator new, so build with
+ * MALLOC_PROMISES to count them too.
+ */
+
+static atomic<long> allocations{0};
+
+void *operator new(size_t size)
+{
+	allocations.fetch_add(1, memory_order_relaxed);
+	if (void *p = malloc(size ? size : 1)) {
+		return p;
+	}
+	throw bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+	free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+	free(p);
+}
+
+const int links = 1000000;
+const int chain = 1000;
+
+double resolved_chain(double& per_link)
+{
+	long sum = 0;
+	const long allocated = allocations;
+	const auto start = steady_clock::now();
+	auto promise = promise::resolved<int>(0);
+	for (int i = 0; i < links; i++) {
+		promise = promise->then([] (int x) { return x + 1; });
+	}
+	promise->then([&sum] (int x) { sum = x; });
+	const duration<double> elapsed = steady_clock::now() - start;
+	per_link = double(allocations - allocated) / links;
+	if (sum != links) {
+		throw logic_error("Wrong result");
+	}
+	return links / elapsed.count();
+}
+
+double pending_chain(double& per_link)
+{
+	long sum = 0;
+	const long allocated = allocations;
+	const auto start = steady_clock::now();
+	for (int c = 0; c < links / chain; c++) {
+		Promise<int> root;
+		auto promise = root;
+		for (int i = 0; i < chain; i++) {
+			promise = promise->then([] (int x) { return x + 1; });
+		}
+		promise->then([&sum] (int x) { sum += x; });
+		root->resolve(0);
+	}
+	const duration<double> elapsed = steady_clock::now() - start;
+	per_link = double(allocations - allocated) / links;
+	if (sum != links) {
+		throw logic_error("Wrong result");
+	}
+	return links / elapsed.count();
+}
+
+double rejected_chain()
+{
+	long handled = 0;
+	const auto error = make_exception_ptr(runtime_error("Rejected"));
+	const auto start = steady_clock::now();
+	for (int c = 0; c < links / chain; c++) {
+		Promise<int> root;
+		auto promise = root;
+		for (int i = 0; i < chain; i++) {
+			promise = promise->then([] (int x) { return promise::resolved<int>(x + 1); });
+		}
+		promise->then([] (int) { }, [&handled] (exception_ptr) { handled++; });
+		root->reject(error);
+	}
+	const duration<double> elapsed = steady_clock::now() - start;
+	if (handled != links / chain) {
+		throw logic_error("Wrong result");
+	}
+	return links / elapsed.count();
+}
+
+double racing_threads()
+{
+	vector<Promise<int>> promises(links);
+	atomic<long> sum{0};
+	atomic<bool> go{false};
+	thread resolver([&] {
+		while (!go) { }
+		for (auto& promise : promises) {
+			promise->resolve(1);
+		}
+	});
+	const auto start = steady_clock::now();
+	go = true;
+	for (auto& promise : promises) {
+		promise->then([&sum] (int x) { sum.fetch_add(x, memory_order_relaxed); });
+	}
+	resolver.join();
+	const duration<double> elapsed = steady_clock::now() - start;
+	if (sum != links) {
+		throw logic_error("Wrong result");
+	}
+	return links / elapsed.count();
+}
+
+double combine_fan_in(const int threads, double& per_input)
+{
+	const int count = 100000;
+	vector<Promise<int>> promises(count);
+	long sum = 0;
+	const long allocated = allocations;
+	const auto start = steady_clock::now();
+	promise::combine(promises)
+		->then([&sum] (vector<int> results) {
+			for (const auto x : results) {
+				sum += x;
+			}
+		});
+	per_input = double(allocations - allocated) / count;
+	vector<thread> resolvers;
+	for (int t = 0; t < threads; t++) {
+		resolvers.emplace_back([&, t] {
+			for (int i = t; i < count; i += threads) {
+				promises[i]->resolve(1);
+			}
+		});
+	}
+	for (auto& resolver : resolvers) {
+		resolver.join();
+	}
+	const duration<double> elapsed = steady_clock::now() - start;
+	if (sum != count) {
+		throw logic_error("Wrong result");
+	}
+	return count / elapsed.count();
+}
+
+int main(int argc, char *argv[])
+{
+	cout << setw(14) << "resolved" << setw(14) << "pending" << setw(14) << "rejected" << setw(14) << "two threads" << "  (links/s)"
+		<< setw(14) << "resolved" << setw(14) << "pending" << "  (allocations/link)" << endl;
+	for (int i = 0; i < 3; i++) {
+		double resolved_allocs;
+		double pending_allocs;
+		cout << fixed << setprecision(0)
+			<< setw(14) << resolved_chain(resolved_allocs)
+			<< setw(14) << pending_chain(pending_allocs)
+			<< setw(14) << rejected_chain()
+			<< setw(14) << racing_threads() << "           "
+			<< setprecision(2)
+			<< setw(14) << resolved_allocs
+			<< setw(14) << pending_allocs << endl;
+	}
+	cout << endl << setw(14) << "threads" << setw(14) << "combine" << "  (promises/s)"
+		<< setw(14) << "combine" << "  (allocations/input)" << endl;
+	for (const int threads : { 1, 2, 4, 8 }) {
+		double allocs;
+		cout << fixed << setprecision(0)
+			<< setw(14) << threads
+			<< setw(14) << combine_fan_in(threads, allocs) << "              "
+			<< setprecision(2)
+			<< setw(14) << allocs << endl;
+	}
+	return 0;
+}
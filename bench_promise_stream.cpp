@@ -0,0 +1,205 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <vector>
+#include <array>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <mutex>
+#include <condition_variable>
+#include "event_loop.h"
+#include "promise_stream.h"
+#include "task_stream.h"
+
+using namespace std;
+using namespace std::chrono;
+using namespace kaiu;
+
+/*
+ * Ten million ints through a promise stream, in items per second, with one
+ * consumer call per item (stream) against one per batch (stream_batch).
+ *
+ * "local": the producer and consumer share a thread.  Items are written one
+ * at a time to the per-item consumer, and in chunks with write_bulk to the
+ * batched consumer (single writes would never accumulate).
+ *
+ * "async": an AsyncPromiseStream calls the consumer on a one-thread pool,
+ * while the main thread writes items one at a time, so a batch holds
+ * whatever was written while the previous one was consumed.  "async spsc" is
+ * "async item" with set_single_producer, so writes skip the lock unless the
+ * consumer has caught up.
+ *
+ * "payload": a million 256-byte items through the per-item consumer, with
+ * heap allocations per item counted by replacing operator new.  Buffered data
+ * and consumer calls use the slab pools, so only hops which go through the
+ * heap are counted.
+ */
+
+static atomic<long> allocations{0};
+
+void *operator new(size_t size)
+{
+	allocations.fetch_add(1, memory_order_relaxed);
+	if (void *p = malloc(size ? size : 1)) {
+		return p;
+	}
+	throw bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+	free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+	free(p);
+}
+
+const long items = 10000000;
+const size_t chunk = 1024;
+const long payloads = 1000000;
+
+struct Payload {
+	explicit Payload(const char c) { data.fill(c); }
+	array<char, 256> data;
+};
+
+class Done {
+public:
+	void fire()
+	{
+		lock_guard<mutex> lock(mx);
+		fired = true;
+		cv.notify_one();
+	}
+	void wait()
+	{
+		unique_lock<mutex> lock(mx);
+		cv.wait(lock, [this] { return fired; });
+	}
+private:
+	bool fired = false;
+	mutex mx;
+	condition_variable cv;
+};
+
+template <typename Stream>
+double run(Stream stream, const bool batch, const bool bulk)
+{
+	long sum = 0;
+	Done done;
+	const auto start = steady_clock::now();
+	if (batch) {
+		stream
+			->stream_batch([&sum] (vector<int> data) {
+				for (const auto x : data) {
+					sum += x;
+				}
+			}, chunk)
+			->then([&done] (int) { done.fire(); });
+	} else {
+		stream
+			->stream([&sum] (int x) { sum += x; })
+			->then([&done] (int) { done.fire(); });
+	}
+	if (bulk) {
+		vector<int> data;
+		data.reserve(chunk);
+		for (long i = 0; i < items; i += chunk) {
+			data.assign(chunk, 1);
+			stream->write_bulk(move(data));
+			data.clear();
+		}
+	} else {
+		for (long i = 0; i < items; i++) {
+			stream->write(1);
+		}
+	}
+	stream->resolve(0);
+	done.wait();
+	const duration<double> elapsed = steady_clock::now() - start;
+	if (sum < items) {
+		throw logic_error("Items lost");
+	}
+	return sum / elapsed.count();
+}
+
+double async(const bool batch, const bool single_producer = false)
+{
+	ParallelEventLoop loop({
+		{ EventLoopPool::calculation, 1 }
+	});
+	AsyncPromiseStream<int, int> stream(loop, EventLoopPool::calculation);
+	if (single_producer) {
+		stream->set_single_producer();
+	}
+	const double rate = run(stream, batch, false);
+	loop.join();
+	return rate;
+}
+
+template <typename Stream>
+double run_payload(Stream stream, double& per_item)
+{
+	long sum = 0;
+	Done done;
+	const long allocated = allocations;
+	const auto start = steady_clock::now();
+	stream
+		->stream([&sum] (const Payload& x) { sum += x.data[0]; })
+		->then([&done] (int) { done.fire(); });
+	for (long i = 0; i < payloads; i++) {
+		stream->write(Payload(1));
+	}
+	stream->resolve(0);
+	done.wait();
+	const duration<double> elapsed = steady_clock::now() - start;
+	per_item = double(allocations - allocated) / payloads;
+	if (sum < payloads) {
+		throw logic_error("Items lost");
+	}
+	return sum / elapsed.count();
+}
+
+double async_payload(double& per_item)
+{
+	ParallelEventLoop loop({
+		{ EventLoopPool::calculation, 1 }
+	});
+	const double rate = run_payload(
+		AsyncPromiseStream<int, Payload>(loop, EventLoopPool::calculation),
+		per_item);
+	loop.join();
+	return rate;
+}
+
+int main(int argc, char *argv[])
+{
+	cout << setw(14) << "local item"
+		<< setw(14) << "local batch"
+		<< setw(14) << "async item"
+		<< setw(14) << "async batch"
+		<< setw(14) << "async spsc" << "  (items/s)" << endl;
+	cout << fixed << setprecision(0)
+		<< setw(14) << run(PromiseStream<int, int>(), false, false)
+		<< setw(14) << run(PromiseStream<int, int>(), true, true)
+		<< setw(14) << async(false)
+		<< setw(14) << async(true)
+		<< setw(14) << async(false, true) << endl;
+	double local_per_item;
+	double async_per_item;
+	const double local_rate = run_payload(PromiseStream<int, Payload>(), local_per_item);
+	const double async_rate = async_payload(async_per_item);
+	cout << endl
+		<< setw(14) << "payload local"
+		<< setw(14) << "allocs/item"
+		<< setw(14) << "payload async"
+		<< setw(14) << "allocs/item" << "  (items/s)" << endl;
+	cout << setw(14) << setprecision(0) << local_rate
+		<< setw(14) << setprecision(2) << local_per_item
+		<< setw(14) << setprecision(0) << async_rate
+		<< setw(14) << setprecision(2) << async_per_item << endl;
+	return 0;
+}
@@ -0,0 +1,136 @@
+#include <iostream>
+#include <iomanip>
+#include <memory>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include "slab_pool.h"
+#include "promise.h"
+
+using namespace std;
+using namespace std::chrono;
+using namespace kaiu;
+
+/*
+ * Promise creation and completion, in promises per second, with states from
+ * the heap (std::allocator) against the slab pools (SlabAllocator), at 1 to
+ * 32 threads.
+ *
+ * Each operation creates two promises through the allocator argument,
+ * forwards one to the other, resolves the first and releases both.
+ *
+ * "local": each thread runs operations on its own promises.
+ *
+ * "handoff": each thread creates a batch of promises, then resolves and
+ * releases the batch of its neighbour, so states are freed by a different
+ * thread than the one which allocated them.
+ */
+
+const int total = 2000000;
+const int batch = 1000;
+
+class Barrier {
+public:
+	explicit Barrier(const int count) : count(count) { }
+	void wait()
+	{
+		unique_lock<mutex> lock(mx);
+		const int gen = generation;
+		if (++waiting == count) {
+			waiting = 0;
+			generation++;
+			cv.notify_all();
+		} else {
+			cv.wait(lock, [&] { return gen != generation; });
+		}
+	}
+private:
+	const int count;
+	int waiting{0};
+	int generation{0};
+	mutex mx;
+	condition_variable cv;
+};
+
+template <typename Alloc>
+Promise<int> create(const Alloc& alloc)
+{
+	Promise<int> first(allocator_arg, alloc);
+	Promise<int> second(allocator_arg, alloc);
+	first->forward_to(second);
+	return first;
+}
+
+template <typename Alloc>
+double local(const int threads)
+{
+	const int ops = total / threads;
+	vector<thread> workers;
+	const auto start = steady_clock::now();
+	for (int t = 0; t < threads; t++) {
+		workers.emplace_back([ops] {
+			Alloc alloc;
+			for (int i = 0; i < ops; i++) {
+				create(alloc)->resolve(i);
+			}
+		});
+	}
+	for (auto& worker : workers) {
+		worker.join();
+	}
+	const duration<double> elapsed = steady_clock::now() - start;
+	return 2.0 * ops * threads / elapsed.count();
+}
+
+template <typename Alloc>
+double handoff(const int threads)
+{
+	const int rounds = total / threads / batch;
+	vector<vector<Promise<int>>> batches(threads);
+	Barrier barrier(threads);
+	vector<thread> workers;
+	const auto start = steady_clock::now();
+	for (int t = 0; t < threads; t++) {
+		workers.emplace_back([&, t, rounds] {
+			Alloc alloc;
+			auto& mine = batches[t];
+			auto& neighbour = batches[(t + 1) % threads];
+			for (int r = 0; r < rounds; r++) {
+				for (int i = 0; i < batch; i++) {
+					mine.emplace_back(create(alloc));
+				}
+				barrier.wait();
+				for (auto& promise : neighbour) {
+					promise->resolve(r);
+				}
+				neighbour.clear();
+				barrier.wait();
+			}
+		});
+	}
+	for (auto& worker : workers) {
+		worker.join();
+	}
+	const duration<double> elapsed = steady_clock::now() - start;
+	return 2.0 * rounds * batch * threads / elapsed.count();
+}
+
+int main(int argc, char *argv[])
+{
+	cout << setw(8) << "threads"
+		<< setw(14) << "local malloc"
+		<< setw(14) << "local slab"
+		<< setw(16) << "handoff malloc"
+		<< setw(14) << "handoff slab" << "  (promises/s)" << endl;
+	cout << fixed << setprecision(0);
+	for (const int threads : { 1, 2, 4, 8, 16, 32 }) {
+		cout << setw(8) << threads
+			<< setw(14) << local<allocator<int>>(threads)
+			<< setw(14) << local<SlabAllocator<int>>(threads)
+			<< setw(16) << handoff<allocator<int>>(threads)
+			<< setw(14) << handoff<SlabAllocator<int>>(threads) << endl;
+	}
+	return 0;
+}
@@ -0,0 +1,133 @@
+#include <stdexcept>
+#include "buffer_pool.h"
+
+namespace kaiu {
+
+using namespace std;
+
+struct Buffer::Shared {
+	Shared(const size_t buffer_size, const size_t max_buffers) :
+		buffer_size(buffer_size), max_buffers(max_buffers) { }
+	const size_t buffer_size;
+	const size_t max_buffers;
+	mutable mutex lock;
+	vector<unique_ptr<char[]>> free;
+	vector<function<void()>> waiting;
+	size_t allocated{0};
+};
+
+/*** Buffer ***/
+
+Buffer::Buffer(Buffer&& from) noexcept :
+	storage(move(from.storage)), length(from.length),
+	_capacity(from._capacity), home(move(from.home))
+{
+	from.length = 0;
+	from._capacity = 0;
+}
+
+Buffer& Buffer::operator =(Buffer&& from) noexcept
+{
+	if (this != &from) {
+		release();
+		storage = move(from.storage);
+		length = from.length;
+		_capacity = from._capacity;
+		home = move(from.home);
+		from.length = 0;
+		from._capacity = 0;
+	}
+	return *this;
+}
+
+Buffer::~Buffer()
+{
+	release();
+}
+
+void Buffer::resize(const size_t size)
+{
+	if (size > _capacity) {
+		throw length_error("Buffer::resize: size exceeds capacity");
+	}
+	length = size;
+}
+
+void Buffer::release()
+{
+	if (!storage) {
+		return;
+	}
+	function<void()> notify;
+	{
+		lock_guard<mutex> lock(home->lock);
+		home->free.emplace_back(move(storage));
+		if (!home->waiting.empty()) {
+			notify = move(home->waiting.back());
+			home->waiting.pop_back();
+		}
+	}
+	home.reset();
+	length = 0;
+	_capacity = 0;
+	if (notify) {
+		notify();
+	}
+}
+
+/*** BufferPool ***/
+
+BufferPool::BufferPool(const size_t buffer_size, const size_t max_buffers) :
+	shared(make_shared<Buffer::Shared>(buffer_size, max_buffers))
+{
+	if (buffer_size == 0) {
+		throw invalid_argument("BufferPool: buffer size must be non-zero");
+	}
+}
+
+Buffer BufferPool::take()
+{
+	Buffer out;
+	take_or_wait(out, nullptr);
+	return out;
+}
+
+bool BufferPool::take_or_wait(Buffer& out, function<void()> on_available)
+{
+	unique_ptr<char[]> storage;
+	{
+		lock_guard<mutex> lock(shared->lock);
+		if (!shared->free.empty()) {
+			storage = move(shared->free.back());
+			shared->free.pop_back();
+		} else if (on_available && shared->max_buffers &&
+				shared->allocated >= shared->max_buffers) {
+			shared->waiting.emplace_back(move(on_available));
+			return false;
+		} else {
+			shared->allocated++;
+		}
+	}
+	/* Allocate outside of the lock */
+	if (!storage) {
+		storage.reset(new char[shared->buffer_size]);
+	}
+	out = Buffer();
+	out.storage = move(storage);
+	out._capacity = shared->buffer_size;
+	out.home = shared;
+	return true;
+}
+
+size_t BufferPool::buffer_size() const
+{
+	return shared->buffer_size;
+}
+
+size_t BufferPool::allocated() const
+{
+	lock_guard<mutex> lock(shared->lock);
+	return shared->allocated;
+}
+
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <functional>
+
+namespace kaiu {
+
+class BufferPool;
+
+/*
+ * Fixed-capacity byte buffer borrowed from a BufferPool.  Move-only, and the
+ * storage returns to the pool when the buffer is destroyed, so a stream of
+ * chunks reuses a handful of allocations rather than allocating per chunk.
+ *
+ * Unlike vector<char>, resizing never initialises the contents.
+ */
+class Buffer {
+public:
+	Buffer() = default;
+	Buffer(const Buffer&) = delete;
+	Buffer& operator =(const Buffer&) = delete;
+	Buffer(Buffer&& from) noexcept;
+	Buffer& operator =(Buffer&& from) noexcept;
+	~Buffer();
+	char *data() { return storage.get(); }
+	const char *data() const { return storage.get(); }
+	size_t size() const { return length; }
+	size_t capacity() const { return _capacity; }
+	bool empty() const { return length == 0; }
+	/* Size must not exceed capacity */
+	void resize(const size_t size);
+	char *begin() { return data(); }
+	char *end() { return data() + length; }
+	const char *begin() const { return data(); }
+	const char *end() const { return data() + length; }
+	/* Return storage to the pool now */
+	void release();
+private:
+	friend class BufferPool;
+	struct Shared;
+	std::unique_ptr<char[]> storage;
+	size_t length{0};
+	size_t _capacity{0};
+	std::shared_ptr<Shared> home;
+};
+
+/*
+ * Thread-safe pool of equally-sized buffers.
+ *
+ * max_buffers limits how many buffers may be allocated at once (zero for no
+ * limit), which bounds the memory held by producers that take buffers faster
+ * than consumers release them.  Such producers use take_or_wait to be
+ * notified when a buffer comes back, rather than blocking a thread.
+ */
+class BufferPool {
+public:
+	BufferPool(const BufferPool&) = delete;
+	BufferPool& operator =(const BufferPool&) = delete;
+	explicit BufferPool(const size_t buffer_size, const size_t max_buffers = 0);
+	/* Take a buffer, allocating if none are free (ignores max_buffers) */
+	Buffer take();
+	/*
+	 * Take a buffer and return true, or if the limit has been reached then
+	 * return false and call on_available once a buffer is released.  The
+	 * callback is run by the thread releasing the buffer, so keep it short
+	 * (e.g. push an event).
+	 */
+	bool take_or_wait(Buffer& out, std::function<void()> on_available);
+	size_t buffer_size() const;
+	/* Number of buffers currently allocated, free or in use */
+	size_t allocated() const;
+private:
+	std::shared_ptr<Buffer::Shared> shared;
+};
+
+}
@@ -0,0 +1,97 @@
+#include <atomic>
+#include <mutex>
+#include <map>
+#include "cancellation.h"
+
+namespace kaiu {
+
+using namespace std;
+
+struct CancellationToken::State {
+	atomic<bool> cancelled{false};
+	mutex lock;
+	map<size_t, Callback> callbacks;
+	size_t next_id{1};
+};
+
+CancellationToken CancellationToken::create()
+{
+	CancellationToken token;
+	token.state = make_shared<State>();
+	return token;
+}
+
+void CancellationToken::cancel() const
+{
+	if (!state) {
+		throw logic_error("Cannot cancel a token which was not created by CancellationToken::create");
+	}
+	map<size_t, Callback> callbacks;
+	{
+		lock_guard<mutex> lock(state->lock);
+		if (state->cancelled) {
+			return;
+		}
+		state->cancelled = true;
+		swap(callbacks, state->callbacks);
+	}
+	/* Outside the lock, callbacks may register/remove on this token */
+	for (auto& callback : callbacks) {
+		callback.second();
+	}
+}
+
+bool CancellationToken::is_cancelled() const
+{
+	return state && state->cancelled.load(memory_order_acquire);
+}
+
+void CancellationToken::throw_if_cancelled() const
+{
+	if (is_cancelled()) {
+		rethrow_exception(error());
+	}
+}
+
+size_t CancellationToken::on_cancel(Callback callback) const
+{
+	if (!state) {
+		return 0;
+	}
+	{
+		lock_guard<mutex> lock(state->lock);
+		if (!state->cancelled) {
+			const size_t id = state->next_id++;
+			state->callbacks.emplace(id, move(callback));
+			return id;
+		}
+	}
+	callback();
+	return 0;
+}
+
+bool CancellationToken::remove(const size_t id) const
+{
+	if (!state || id == 0) {
+		return false;
+	}
+	/* Destroy the callback outside the lock, in case its captures use it */
+	Callback callback;
+	{
+		lock_guard<mutex> lock(state->lock);
+		auto it = state->callbacks.find(id);
+		if (it == state->callbacks.end()) {
+			return false;
+		}
+		callback = move(it->second);
+		state->callbacks.erase(it);
+	}
+	return true;
+}
+
+exception_ptr CancellationToken::error()
+{
+	return make_exception_ptr(cancelled_error("Operation cancelled"));
+}
+
+}
@@ -0,0 +1,76 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <functional>
+#include <stdexcept>
+#include "promise/fwd.h"
+
+namespace kaiu {
+
+
+/* Rejection reason of promises whose operation was cancelled */
+class cancelled_error : public std::runtime_error {
+public:
+	using std::runtime_error::runtime_error;
+};
+
+/*
+ * Shared cancellation flag.  Copies share the same flag, so a token can be
+ * handed to any number of tasks/streams and cancelled from any thread.
+ *
+ * A default-constructed token is never cancelled (cancel throws), so APIs can
+ * take a token by value with a default argument at no cost.
+ *
+ * Callbacks registered with on_cancel are run once, in the thread which calls
+ * cancel, or immediately if the token has already been cancelled.  Remove a
+ * callback when the operation it cancels completes, or a long-lived token
+ * will hold it (and its captures) until it is cancelled or destroyed.
+ */
+class CancellationToken {
+public:
+	using Callback = std::function<void()>;
+	/* Token which can never be cancelled */
+	CancellationToken() = default;
+	/* Create a token which can be cancelled */
+	static CancellationToken create();
+	/* Cancel, running registered callbacks (idempotent) */
+	void cancel() const;
+	bool is_cancelled() const;
+	/* Throws cancelled_error if cancelled */
+	void throw_if_cancelled() const;
+	/* True if this token can be cancelled */
+	bool can_cancel() const { return bool(state); }
+	/*
+	 * Register a callback, returns an id for remove() (or zero if the token
+	 * can never be cancelled, or if the callback has already run)
+	 */
+	std::size_t on_cancel(Callback callback) const;
+	/* Remove a callback, returns false if it has run or is running */
+	bool remove(const std::size_t id) const;
+	/* Rejection reason for cancelled operations */
+	static std::exception_ptr error();
+private:
+	struct State;
+	std::shared_ptr<State> state;
+};
+
+namespace promise {
+
+/*
+ * Returns a promise which takes the result of the given promise, unless the
+ * token is cancelled first, in which case it rejects with cancelled_error at
+ * once (in the thread calling cancel).
+ *
+ * As with timeout, the original promise is not stopped, its result is just
+ * discarded.  Use cancellable tasks to stop queued work from running.
+ */
+template <typename Result>
+Promise<Result> cancellable(Promise<Result> promise, CancellationToken token);
+
+}
+
+}
+
+#ifndef cancellation_tcc
+#include "cancellation.tcc"
+#endif
@@ -0,0 +1,43 @@
+#define cancellation_tcc
+#include <atomic>
+#include <memory>
+#include "promise.h"
+#include "cancellation.h"
+
+namespace kaiu {
+
+namespace promise {
+
+template <typename Result>
+Promise<Result> cancellable(Promise<Result> promise, CancellationToken token)
+{
+	if (!token.can_cancel()) {
+		return promise;
+	}
+	Promise<Result> result;
+	/* Whichever of the promise and the token completes first wins */
+	auto settled = std::make_shared<std::atomic<bool>>(false);
+	const auto id = token.on_cancel([result, settled] {
+		if (!settled->exchange(true)) {
+			result->reject(CancellationToken::error());
+		}
+	});
+	promise->then(
+		[result, settled, token, id] (Result value) {
+			if (!settled->exchange(true)) {
+				token.remove(id);
+				result->resolve(std::move(value));
+			}
+		},
+		[result, settled, token, id] (std::exception_ptr error) {
+			if (!settled->exchange(true)) {
+				token.remove(id);
+				result->reject(error);
+			}
+		});
+	return result;
+}
+
+}
+
+}
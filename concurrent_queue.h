@@ -1,5 +1,6 @@
 #pragma once
 #include <queue>
+#include <vector>
 #include <atomic>
 #include <mutex>
 #include <condition_variable>
@@ -19,6 +20,9 @@ public:
 	void push(T&& item);
 	template <typename... Args>
 	void emplace(Args&&... args);
+	/* Append items [first, last) to end of queue, with one lock and wakeup */
+	template <typename It>
+	void push_bulk(It first, It last);
 	/*
 	 * Remove event from front of queue
 	 *
@@ -37,6 +41,16 @@ public:
 	bool pop(T& out, GuardParam&&... guard_param);
 	template <typename = void>
 	bool pop(T& out) { return pop<int>(out, 0); }
+	/*
+	 * Move up to max events from front of queue onto the end of out, with one
+	 * lock acquisition.  Waits (as pop does) if the queue is empty.
+	 *
+	 * Returns the number of events taken, zero only if the queue is empty and
+	 * in no-waiting mode.
+	 */
+	size_t pop_batch(std::vector<T>& out, const size_t max);
+	template <typename WaitGuard, typename... GuardParam>
+	size_t pop_batch(std::vector<T>& out, const size_t max, GuardParam&&... guard_param);
 	/* Set/unset no-waiting mode */
 	void set_nowaiting(bool value = true);
 	bool is_nowaiting() const;
@@ -47,8 +61,13 @@ public:
 private:
 	std::queue<T> events;
 	std::condition_variable unblock;
+	/* Number of threads waiting in pop (guarded by queue_mutex) */
+	size_t waiting{0};
 	std::atomic<bool> nowaiting{false};
-	void notify();
+	void notify(const size_t count = 1);
+	/* Waits until queue is not empty or is in no-waiting mode */
+	template <typename WaitGuard, typename... GuardParam>
+	void wait_for_items(std::unique_lock<std::mutex>& lock, GuardParam&&... guard_param);
 };
 
 }
@@ -35,6 +35,18 @@ template <typename... Args> void ConcurrentQueue<T>::emplace(Args&&... args)
 	notify();
 }
 
+template <typename T>
+template <typename It>
+void ConcurrentQueue<T>::push_bulk(It first, It last)
+{
+	std::lock_guard<std::mutex> lock(queue_mutex);
+	size_t count = 0;
+	for (; first != last; ++first, ++count) {
+		events.push(std::move(*first));
+	}
+	notify(count);
+}
+
 template <typename T>
 bool ConcurrentQueue<T>::pop(T& out)
 {
@@ -43,10 +55,8 @@ bool ConcurrentQueue<T>::pop(T& out)
 
 template <typename T>
 template <typename WaitGuard, typename... GuardParam>
-bool ConcurrentQueue<T>::pop(T& out, GuardParam&&... guard_param)
+void ConcurrentQueue<T>::wait_for_items(std::unique_lock<std::mutex>& lock, GuardParam&&... guard_param)
 {
-	/* Lock the queue */
-	std::unique_lock<std::mutex> lock(queue_mutex);
 	/* Queue is always locked when this is called */
 	auto end_wait_condition = [this] {
 		return is_nowaiting() || !events.empty();
@@ -60,9 +70,20 @@ bool ConcurrentQueue<T>::pop(T& out, GuardParam&&... guard_param)
 		 * Unlocks queue, re-locks it when calling end_wait_condition and upon
 		 * return
 		 */
+		++waiting;
 		unblock.wait(lock, end_wait_condition);
+		--waiting;
 	}
 #pragma GCC diagnostic pop
+}
+
+template <typename T>
+template <typename WaitGuard, typename... GuardParam>
+bool ConcurrentQueue<T>::pop(T& out, GuardParam&&... guard_param)
+{
+	/* Lock the queue */
+	std::unique_lock<std::mutex> lock(queue_mutex);
+	wait_for_items<WaitGuard>(lock, std::forward<GuardParam>(guard_param)...);
 	/* Queue is locked at this point whether or not we waited */
 	if (events.empty()) {
 		return false;
@@ -73,9 +94,36 @@ bool ConcurrentQueue<T>::pop(T& out, GuardParam&&... guard_param)
 }
 
 template <typename T>
-void ConcurrentQueue<T>::notify()
+size_t ConcurrentQueue<T>::pop_batch(std::vector<T>& out, const size_t max)
+{
+	return pop_batch<bool>(out, max, false);
+}
+
+template <typename T>
+template <typename WaitGuard, typename... GuardParam>
+size_t ConcurrentQueue<T>::pop_batch(std::vector<T>& out, const size_t max, GuardParam&&... guard_param)
 {
-	unblock.notify_one();
+	std::unique_lock<std::mutex> lock(queue_mutex);
+	wait_for_items<WaitGuard>(lock, std::forward<GuardParam>(guard_param)...);
+	size_t count = 0;
+	for (; count < max && !events.empty(); count++) {
+		out.emplace_back(std::move(events.front()));
+		events.pop();
+	}
+	return count;
+}
+
+template <typename T>
+void ConcurrentQueue<T>::notify(const size_t count)
+{
+	/* Queue is locked, so no thread can start waiting under our feet */
+	if (waiting == 0 || count == 0) {
+		return;
+	} else if (count == 1) {
+		unblock.notify_one();
+	} else {
+		unblock.notify_all();
+	}
 }
 
 template <typename T>
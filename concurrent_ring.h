@@ -0,0 +1,121 @@
+#pragma once
+#include <queue>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <type_traits>
+
+namespace kaiu {
+
+
+/*
+ * Bounded lock-free multi-producer/multi-consumer queue, with the same
+ * interface as ConcurrentQueue<T>.
+ *
+ * Items are stored in a ring of cells, each with its own sequence number
+ * (Vyukov's bounded MPMC queue).  If the ring is full, push does not block:
+ * the item spills into a mutex-protected overflow queue.  Until the overflow
+ * is empty again, later pushes go there too, so the ring drains and spilled
+ * items wait no longer than the ring's contents.  The consumer which reaches
+ * the overflow moves what fits back into the ring.  Ordering is FIFO, except
+ * for pushes racing with the first spill.
+ *
+ * Consumers spin briefly when the ring is empty, then park on a condition
+ * variable.  Producers only touch the condition variable when some consumer is
+ * parked.
+ */
+template <typename T>
+class ConcurrentRing {
+public:
+	ConcurrentRing(const ConcurrentRing&) = delete;
+	ConcurrentRing& operator=(const ConcurrentRing&) = delete;
+	ConcurrentRing() = delete;
+	/* Capacity is rounded up to a power of two */
+	explicit ConcurrentRing(const size_t capacity, bool nowaiting = false);
+	~ConcurrentRing();
+	/* Append event to end of queue */
+	void push(const T& item);
+	void push(T&& item);
+	template <typename... Args>
+	void emplace(Args&&... args);
+	/* Append items [first, last) to end of queue, with one wakeup */
+	template <typename It>
+	void push_bulk(It first, It last);
+	/*
+	 * Remove event from front of queue
+	 *
+	 * If there are no elements in the queue then either:
+	 *   wait until there are if we're not in no-waiting mode
+	 *   return false without waiting if we are in no-waiting mode
+	 */
+	bool pop(T& out);
+	/*
+	 * WaitGuard is instantiated when we start waiting (spinning or parked) for
+	 * events, and destroyed when we stop waiting, before the event which ended
+	 * the wait is taken.  It is not instantiated if events are in the queue, as
+	 * no wait is required.
+	 */
+	template <typename WaitGuard, typename... GuardParam>
+	bool pop(T& out, GuardParam&&... guard_param);
+	/*
+	 * Move up to max events from front of queue onto the end of out.  Waits
+	 * (as pop does) if the queue is empty.
+	 *
+	 * Returns the number of events taken, zero only if the queue is empty and
+	 * in no-waiting mode.
+	 */
+	size_t pop_batch(std::vector<T>& out, const size_t max);
+	template <typename WaitGuard, typename... GuardParam>
+	size_t pop_batch(std::vector<T>& out, const size_t max, GuardParam&&... guard_param);
+	/* Set/unset no-waiting mode */
+	void set_nowaiting(bool value = true);
+	bool is_nowaiting() const;
+	/* Test if queue is empty */
+	bool isEmpty() const;
+	/*
+	 * Grows with every push, and with items moved back from the overflow
+	 * (for ParallelEventLoop::join)
+	 */
+	size_t push_count() const;
+private:
+	struct Cell {
+		std::atomic<size_t> sequence;
+		typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+	};
+	/* Padding to keep producer and consumer positions on separate lines */
+	static constexpr size_t line_size = 64;
+	std::unique_ptr<Cell[]> cells;
+	const size_t mask;
+	char pad0[line_size];
+	std::atomic<size_t> enqueue_pos{0};
+	char pad1[line_size];
+	std::atomic<size_t> dequeue_pos{0};
+	char pad2[line_size];
+	/* Overflow for when the ring is full */
+	std::mutex overflow_mutex;
+	std::queue<T> overflow;
+	std::atomic<size_t> overflow_size{0};
+	std::atomic<size_t> overflow_pushes{0};
+	/* Parked consumers */
+	std::atomic<bool> nowaiting{false};
+	std::mutex park_mutex;
+	std::condition_variable unblock;
+	std::atomic<size_t> waiters{0};
+	template <typename U>
+	bool try_push(U&& item);
+	bool try_pop(T& out);
+	bool try_take(T& out);
+	void push_one(T&& item);
+	/* Returns false iff in no-waiting mode and queue is empty */
+	bool wait_for_items();
+	void notify(const size_t count = 1);
+	static size_t round_capacity(size_t capacity);
+};
+
+}
+
+#ifndef concurrent_ring_tcc
+#include "concurrent_ring.tcc"
+#endif
@@ -0,0 +1,293 @@
+#define concurrent_ring_tcc
+#include <thread>
+#include "concurrent_ring.h"
+
+namespace kaiu {
+
+
+template <typename T>
+size_t ConcurrentRing<T>::round_capacity(size_t capacity)
+{
+	size_t rounded = 2;
+	while (rounded < capacity) {
+		rounded <<= 1;
+	}
+	return rounded;
+}
+
+template <typename T>
+ConcurrentRing<T>::ConcurrentRing(const size_t capacity, bool nowaiting) :
+	cells(new Cell[round_capacity(capacity)]),
+	mask(round_capacity(capacity) - 1),
+	nowaiting(nowaiting)
+{
+	for (size_t i = 0; i <= mask; i++) {
+		cells[i].sequence.store(i, std::memory_order_relaxed);
+	}
+}
+
+template <typename T>
+ConcurrentRing<T>::~ConcurrentRing()
+{
+	T item;
+	while (try_pop(item)) {
+	}
+}
+
+template <typename T>
+template <typename U>
+bool ConcurrentRing<T>::try_push(U&& item)
+{
+	size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+	Cell *cell;
+	while (true) {
+		cell = &cells[pos & mask];
+		const size_t seq = cell->sequence.load(std::memory_order_acquire);
+		const auto diff = static_cast<std::ptrdiff_t>(seq - pos);
+		if (diff == 0) {
+			/* Cell is free, claim it */
+			if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+				break;
+			}
+		} else if (diff < 0) {
+			/* Ring is full */
+			return false;
+		} else {
+			/* Another producer claimed this cell */
+			pos = enqueue_pos.load(std::memory_order_relaxed);
+		}
+	}
+	new (&cell->storage) T(std::forward<U>(item));
+	/* Publish */
+	cell->sequence.store(pos + 1, std::memory_order_release);
+	return true;
+}
+
+template <typename T>
+bool ConcurrentRing<T>::try_pop(T& out)
+{
+	size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+	Cell *cell;
+	while (true) {
+		cell = &cells[pos & mask];
+		const size_t seq = cell->sequence.load(std::memory_order_acquire);
+		const auto diff = static_cast<std::ptrdiff_t>(seq - (pos + 1));
+		if (diff == 0) {
+			/* Cell is published, claim it */
+			if (dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+				break;
+			}
+		} else if (diff < 0) {
+			/* Ring is empty (or the next cell is not published yet) */
+			return false;
+		} else {
+			/* Another consumer claimed this cell */
+			pos = dequeue_pos.load(std::memory_order_relaxed);
+		}
+	}
+	T& item = *reinterpret_cast<T *>(&cell->storage);
+	out = std::move(item);
+	item.~T();
+	/* Release the cell for the producer one lap ahead */
+	cell->sequence.store(pos + mask + 1, std::memory_order_release);
+	return true;
+}
+
+template <typename T>
+bool ConcurrentRing<T>::try_take(T& out)
+{
+	if (try_pop(out)) {
+		return true;
+	}
+	if (overflow_size.load() == 0) {
+		return false;
+	}
+	std::lock_guard<std::mutex> lock(overflow_mutex);
+	if (overflow.empty()) {
+		return false;
+	}
+	out = std::move(overflow.front());
+	overflow.pop();
+	/*
+	 * The ring has drained, so move the rest back into it while there is
+	 * room, and producers can return to the ring once the overflow is empty
+	 */
+	while (!overflow.empty() && try_push(std::move(overflow.front()))) {
+		overflow.pop();
+	}
+	overflow_size = overflow.size();
+	return true;
+}
+
+template <typename T>
+void ConcurrentRing<T>::push(const T& item)
+{
+	T copy(item);
+	push(std::move(copy));
+}
+
+template <typename T>
+void ConcurrentRing<T>::push_one(T&& item)
+{
+	/*
+	 * While anything has spilled, new items follow it into the overflow, so
+	 * that the ring drains and consumers reach the spilled items
+	 */
+	if (overflow_size.load() == 0 && try_push(std::move(item))) {
+		return;
+	}
+	std::lock_guard<std::mutex> lock(overflow_mutex);
+	overflow.push(std::move(item));
+	++overflow_size;
+	++overflow_pushes;
+}
+
+template <typename T>
+void ConcurrentRing<T>::push(T&& item)
+{
+	push_one(std::move(item));
+	notify();
+}
+
+template <typename T>
+template <typename It>
+void ConcurrentRing<T>::push_bulk(It first, It last)
+{
+	size_t count = 0;
+	for (; first != last; ++first, ++count) {
+		push_one(std::move(*first));
+	}
+	notify(count);
+}
+
+template <typename T>
+template <typename... Args>
+void ConcurrentRing<T>::emplace(Args&&... args)
+{
+	push(T(std::forward<Args>(args)...));
+}
+
+template <typename T>
+bool ConcurrentRing<T>::pop(T& out)
+{
+	return pop<bool>(out, false);
+}
+
+template <typename T>
+template <typename WaitGuard, typename... GuardParam>
+bool ConcurrentRing<T>::pop(T& out, GuardParam&&... guard_param)
+{
+	while (!try_take(out)) {
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-variable"
+		/* Externally supplied wait callback guard */
+		WaitGuard guard(std::forward<GuardParam>(guard_param)...);
+#pragma GCC diagnostic pop
+		if (!wait_for_items()) {
+			return false;
+		}
+	}
+	return true;
+}
+
+template <typename T>
+size_t ConcurrentRing<T>::pop_batch(std::vector<T>& out, const size_t max)
+{
+	return pop_batch<bool>(out, max, false);
+}
+
+template <typename T>
+template <typename WaitGuard, typename... GuardParam>
+size_t ConcurrentRing<T>::pop_batch(std::vector<T>& out, const size_t max, GuardParam&&... guard_param)
+{
+	if (max == 0) {
+		return 0;
+	}
+	T item;
+	if (!pop<WaitGuard>(item, std::forward<GuardParam>(guard_param)...)) {
+		return 0;
+	}
+	out.emplace_back(std::move(item));
+	size_t count = 1;
+	for (; count < max && try_take(item); count++) {
+		out.emplace_back(std::move(item));
+	}
+	return count;
+}
+
+template <typename T>
+bool ConcurrentRing<T>::wait_for_items()
+{
+	/* Spin for a short while, in case a producer is just about to push */
+	for (int spin = 0; spin < 64; spin++) {
+		if (!isEmpty()) {
+			return true;
+		}
+		if (is_nowaiting()) {
+			return false;
+		}
+		if (spin % 16 == 15) {
+			std::this_thread::yield();
+		}
+	}
+	/* Park */
+	std::unique_lock<std::mutex> lock(park_mutex);
+	/*
+	 * Registering as a waiter before re-checking the queue pairs with the
+	 * fence in notify(): either we see the item or the producer sees us.
+	 */
+	++waiters;
+	unblock.wait(lock, [this] { return is_nowaiting() || !isEmpty(); });
+	--waiters;
+	return !isEmpty();
+}
+
+template <typename T>
+void ConcurrentRing<T>::notify(const size_t count)
+{
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (count == 0 || waiters.load() == 0) {
+		return;
+	}
+	std::lock_guard<std::mutex> lock(park_mutex);
+	if (count == 1) {
+		unblock.notify_one();
+	} else {
+		unblock.notify_all();
+	}
+}
+
+template <typename T>
+void ConcurrentRing<T>::set_nowaiting(bool value)
+{
+	nowaiting = value;
+	std::lock_guard<std::mutex> lock(park_mutex);
+	unblock.notify_all();
+}
+
+template <typename T>
+bool ConcurrentRing<T>::is_nowaiting() const
+{
+	return nowaiting;
+}
+
+template <typename T>
+bool ConcurrentRing<T>::isEmpty() const
+{
+	/*
+	 * dequeue_pos never overtakes enqueue_pos, so reading dequeue_pos first
+	 * gives a consistent answer.  A claimed but unpublished cell counts as
+	 * non-empty.
+	 */
+	const size_t head = dequeue_pos.load();
+	const size_t tail = enqueue_pos.load();
+	return head == tail && overflow_size.load() == 0;
+}
+
+template <typename T>
+size_t ConcurrentRing<T>::push_count() const
+{
+	return enqueue_pos.load() + overflow_pushes.load();
+}
+
+}
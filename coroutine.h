@@ -0,0 +1,190 @@
+#pragma once
+#if !defined(__cpp_impl_coroutine)
+#error "coroutine.h requires C++20 coroutines (build with std=c++20)"
+#endif
+#include <coroutine>
+#include <atomic>
+#include <optional>
+#include <memory>
+#include <exception>
+#include "event_loop.h"
+#include "promise.h"
+#include "promise_stream.h"
+
+namespace kaiu {
+
+
+/*
+ * C++20 coroutine support, only available when building with std=c++20:
+ *
+ *   Promise<int> total(Promise<int> a, Promise<int> b)
+ *   {
+ *       const int x = co_await a;          (throws if a rejects)
+ *       co_await promise::resume_on(loop, EventLoopPool::calculation);
+ *       co_return x + co_await b;          (or throw, to reject)
+ *   }
+ *
+ * Locals and awaited results live in the coroutine frame, which comes from
+ * the same slab pools as promise states, so a sequence of awaits costs no
+ * closures.  A coroutine continues in whichever thread completed the promise
+ * it awaited (or without suspending, if the promise had already completed),
+ * unless it awaits through resume_on, which continues it in a pool.
+ */
+
+namespace detail {
+
+/*
+ * Resumes a suspended coroutine once the result it awaits has arrived.
+ *
+ * Without a loop, the coroutine continues in the thread which delivers the
+ * result.  If that happens while the coroutine is still suspending, it does
+ * not suspend at all, rather than being resumed recursively: whichever of
+ * suspend and resume comes second continues the coroutine.
+ *
+ * With a loop, the coroutine is always continued in the given pool, and may
+ * be running there before suspend returns.
+ */
+class CoroutineResumer {
+public:
+	CoroutineResumer() = default;
+	CoroutineResumer(EventLoop& loop, const EventLoopPool pool) :
+		loop(&loop), pool(pool) { }
+	CoroutineResumer(const CoroutineResumer&) = delete;
+	CoroutineResumer& operator =(const CoroutineResumer&) = delete;
+	/* Calls arrange() to request the result, returns whether to suspend */
+	template <typename Arrange>
+	bool suspend(std::coroutine_handle<> handle, Arrange&& arrange);
+	/* Called when the result has arrived */
+	void resume();
+private:
+	EventLoop *loop{nullptr};
+	EventLoopPool pool{EventLoopPool::invalid};
+	std::coroutine_handle<> handle{};
+	std::atomic<bool> arrived{false};
+};
+
+/* Awaits a promise, returning its result or throwing its error */
+template <typename Result>
+class PromiseAwaiter {
+public:
+	explicit PromiseAwaiter(Promise<Result> promise);
+	PromiseAwaiter(Promise<Result> promise, EventLoop& loop, const EventLoopPool pool);
+	bool await_ready() const noexcept { return false; }
+	bool await_suspend(std::coroutine_handle<> handle);
+	Result await_resume();
+private:
+	Promise<Result> promise;
+	std::optional<Result> result{};
+	std::exception_ptr error{};
+	CoroutineResumer resumer;
+};
+
+/* Continues the coroutine in a pool */
+class PoolAwaiter {
+public:
+	PoolAwaiter(EventLoop& loop, const EventLoopPool pool) :
+		loop(loop), pool(pool) { }
+	bool await_ready() const noexcept { return false; }
+	void await_suspend(std::coroutine_handle<> handle);
+	void await_resume() const noexcept { }
+private:
+	EventLoop& loop;
+	EventLoopPool pool;
+};
+
+/* Coroutine promise type for coroutines returning Promise<Result> */
+template <typename Result>
+class PromiseCoroutine {
+public:
+	Promise<Result> get_return_object() { return promise; }
+	std::suspend_never initial_suspend() const noexcept { return {}; }
+	std::suspend_never final_suspend() const noexcept { return {}; }
+	void return_value(Result value) { promise->resolve(std::move(value)); }
+	void unhandled_exception() { promise->reject(std::current_exception()); }
+	/* Frames are allocated like promise states */
+	static void *operator new(const std::size_t size);
+	static void operator delete(void *p, const std::size_t size) noexcept;
+private:
+	Promise<Result> promise{};
+};
+
+}
+
+/* co_await on a promise */
+template <typename Result>
+detail::PromiseAwaiter<Result> operator co_await(Promise<Result> promise);
+
+/*
+ * Reads a promise stream from a coroutine, one datum per co_await:
+ *
+ *   StreamReader<Result, Datum> reader(stream);
+ *   while (auto datum = co_await reader.next()) {
+ *       ... *datum ...
+ *   }
+ *   const Result result = reader.result();   (throws if the stream rejected)
+ *
+ * The reader is the stream's consumer (bound on the first next), and each
+ * datum is taken once the coroutine asks for it, so data which arrive faster
+ * than they are read wait in the stream's buffer (or its producer, given a
+ * capacity).  Given a loop and pool, the coroutine continues in that pool
+ * after each datum.
+ *
+ * Destroying the reader before the stream has ended stops the stream.
+ */
+template <typename Result, typename Datum>
+class StreamReader {
+	struct State;
+public:
+	class NextAwaiter {
+	public:
+		bool await_ready() const noexcept { return false; }
+		bool await_suspend(std::coroutine_handle<> handle);
+		std::optional<Datum> await_resume();
+	private:
+		friend class StreamReader;
+		explicit NextAwaiter(StreamReader& reader) : reader(reader) { }
+		StreamReader& reader;
+	};
+	explicit StreamReader(PromiseStream<Result, Datum> stream);
+	StreamReader(PromiseStream<Result, Datum> stream, EventLoop& loop, const EventLoopPool pool);
+	StreamReader(const StreamReader&) = delete;
+	StreamReader& operator =(const StreamReader&) = delete;
+	~StreamReader();
+	/* Awaitable: next datum, or nullopt once the stream has completed */
+	NextAwaiter next();
+	/* Result of the stream, once next has returned nullopt */
+	Result result();
+	/* Ask the producer to stop, dropping remaining data */
+	void stop();
+private:
+	PromiseStream<Result, Datum> stream;
+	/* Shared with the stream's callbacks, which may outlive the reader */
+	std::shared_ptr<State> state;
+	bool bound{false};
+	/* Bind the consumer, or let it take the next datum */
+	void request();
+};
+
+namespace promise {
+
+/* Awaitable which continues the coroutine in a thread of the given pool */
+detail::PoolAwaiter resume_on(EventLoop& loop, const EventLoopPool pool);
+
+/* Awaits a promise, then continues the coroutine in the given pool */
+template <typename Result>
+detail::PromiseAwaiter<Result> resume_on(EventLoop& loop,
+	const EventLoopPool pool, Promise<Result> promise);
+
+}
+
+}
+
+/* Coroutines may return Promise<Result> */
+template <typename Result, typename... Args>
+struct std::coroutine_traits<kaiu::Promise<Result>, Args...> {
+	using promise_type = kaiu::detail::PromiseCoroutine<Result>;
+};
+
+#ifndef coroutine_tcc
+#include "coroutine.tcc"
+#endif
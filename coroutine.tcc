@@ -0,0 +1,248 @@
+#define coroutine_tcc
+#include <stdexcept>
+#include "coroutine.h"
+
+namespace kaiu {
+
+
+namespace detail {
+
+/*** CoroutineResumer ***/
+
+template <typename Arrange>
+bool CoroutineResumer::suspend(std::coroutine_handle<> handle, Arrange&& arrange)
+{
+	this->handle = handle;
+	if (loop) {
+		/* The coroutine may be resumed (and gone) once arrange returns */
+		arrange();
+		return true;
+	}
+	arrived.store(false, std::memory_order_relaxed);
+	arrange();
+	return !arrived.exchange(true, std::memory_order_acq_rel);
+}
+
+inline void CoroutineResumer::resume()
+{
+	if (loop) {
+		loop->push(pool, [handle = handle] (EventLoop&) { handle.resume(); });
+	} else if (arrived.exchange(true, std::memory_order_acq_rel)) {
+		handle.resume();
+	}
+}
+
+/*** PromiseAwaiter ***/
+
+template <typename Result>
+PromiseAwaiter<Result>::PromiseAwaiter(Promise<Result> promise) :
+	promise(std::move(promise))
+{
+}
+
+template <typename Result>
+PromiseAwaiter<Result>::PromiseAwaiter(Promise<Result> promise, EventLoop& loop, const EventLoopPool pool) :
+	promise(std::move(promise)), resumer(loop, pool)
+{
+}
+
+template <typename Result>
+bool PromiseAwaiter<Result>::await_suspend(std::coroutine_handle<> handle)
+{
+	return resumer.suspend(handle, [this] {
+		promise->then(
+			[this] (Result value) {
+				result.emplace(std::move(value));
+				resumer.resume();
+			},
+			[this] (std::exception_ptr e) {
+				error = e;
+				resumer.resume();
+			});
+	});
+}
+
+template <typename Result>
+Result PromiseAwaiter<Result>::await_resume()
+{
+	if (error) {
+		std::rethrow_exception(error);
+	}
+	return std::move(*result);
+}
+
+/*** PoolAwaiter ***/
+
+inline void PoolAwaiter::await_suspend(std::coroutine_handle<> handle)
+{
+	loop.push(pool, [handle] (EventLoop&) { handle.resume(); });
+}
+
+/*** PromiseCoroutine ***/
+
+template <typename Result>
+void *PromiseCoroutine<Result>::operator new(const std::size_t size)
+{
+	return state_allocator<char>().allocate(size);
+}
+
+template <typename Result>
+void PromiseCoroutine<Result>::operator delete(void *p, const std::size_t size) noexcept
+{
+	state_allocator<char>().deallocate(static_cast<char *>(p), size);
+}
+
+}
+
+template <typename Result>
+detail::PromiseAwaiter<Result> operator co_await(Promise<Result> promise)
+{
+	return detail::PromiseAwaiter<Result>(std::move(promise));
+}
+
+/*** StreamReader ***/
+
+template <typename Result, typename Datum>
+struct StreamReader<Result, Datum>::State {
+	State() = default;
+	State(EventLoop& loop, const EventLoopPool pool) : resumer(loop, pool) { }
+	/* Set by the consumer before resuming the coroutine */
+	std::optional<Datum> datum{};
+	std::optional<Promise<StreamAction>> taken{};
+	/* Set by the stream's result handlers before resuming the coroutine */
+	std::atomic<bool> ended{false};
+	std::optional<Result> result{};
+	std::exception_ptr error{};
+	/* Set by stop, the coroutine isn't waiting for the stream's result */
+	std::atomic<bool> stopped{false};
+	detail::CoroutineResumer resumer;
+};
+
+template <typename Result, typename Datum>
+StreamReader<Result, Datum>::StreamReader(PromiseStream<Result, Datum> stream) :
+	stream(std::move(stream)), state(std::make_shared<State>())
+{
+}
+
+template <typename Result, typename Datum>
+StreamReader<Result, Datum>::StreamReader(PromiseStream<Result, Datum> stream, EventLoop& loop, const EventLoopPool pool) :
+	stream(std::move(stream)), state(std::make_shared<State>(loop, pool))
+{
+}
+
+template <typename Result, typename Datum>
+StreamReader<Result, Datum>::~StreamReader()
+{
+	if (!state->ended) {
+		stop();
+	}
+}
+
+template <typename Result, typename Datum>
+typename StreamReader<Result, Datum>::NextAwaiter StreamReader<Result, Datum>::next()
+{
+	return NextAwaiter(*this);
+}
+
+template <typename Result, typename Datum>
+Result StreamReader<Result, Datum>::result()
+{
+	if (!state->ended) {
+		throw std::logic_error("Stream result requested before the stream has ended");
+	}
+	if (state->error) {
+		std::rethrow_exception(state->error);
+	}
+	return *state->result;
+}
+
+template <typename Result, typename Datum>
+void StreamReader<Result, Datum>::stop()
+{
+	if (state->stopped.exchange(true)) {
+		return;
+	}
+	if (!bound) {
+		bound = true;
+		stream->stop();
+	} else if (state->taken) {
+		auto taken = std::move(*state->taken);
+		state->taken.reset();
+		taken->resolve(StreamAction::Stop);
+	}
+}
+
+template <typename Result, typename Datum>
+void StreamReader<Result, Datum>::request()
+{
+	if (bound) {
+		auto taken = std::move(*state->taken);
+		state->taken.reset();
+		taken->resolve(StreamAction::Continue);
+		return;
+	}
+	bound = true;
+	/* The coroutine may resume (and destroy the reader) during the binding */
+	const auto stream = this->stream;
+	const auto state = this->state;
+	stream
+		->stream([state] (Datum&& datum) {
+			state->datum.emplace(std::move(datum));
+			Promise<StreamAction> taken;
+			state->taken = taken;
+			state->resumer.resume();
+			return taken;
+		})
+		->then(
+			[state] (Result result) {
+				state->result.emplace(std::move(result));
+				state->ended = true;
+				if (!state->stopped) {
+					state->resumer.resume();
+				}
+			},
+			[state] (std::exception_ptr error) {
+				state->error = error;
+				state->ended = true;
+				if (!state->stopped) {
+					state->resumer.resume();
+				}
+			});
+}
+
+/*** StreamReader::NextAwaiter ***/
+
+template <typename Result, typename Datum>
+bool StreamReader<Result, Datum>::NextAwaiter::await_suspend(std::coroutine_handle<> handle)
+{
+	if (reader.state->ended || reader.state->stopped) {
+		return false;
+	}
+	return reader.state->resumer.suspend(handle, [this] { reader.request(); });
+}
+
+template <typename Result, typename Datum>
+std::optional<Datum> StreamReader<Result, Datum>::NextAwaiter::await_resume()
+{
+	std::optional<Datum> datum = std::move(reader.state->datum);
+	reader.state->datum.reset();
+	return datum;
+}
+
+namespace promise {
+
+inline detail::PoolAwaiter resume_on(EventLoop& loop, const EventLoopPool pool)
+{
+	return detail::PoolAwaiter(loop, pool);
+}
+
+template <typename Result>
+detail::PromiseAwaiter<Result> resume_on(EventLoop& loop,
+	const EventLoopPool pool, Promise<Result> promise)
+{
+	return detail::PromiseAwaiter<Result>(std::move(promise), loop, pool);
+}
+
+}
+
+}
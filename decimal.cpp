@@ -1,7 +1,7 @@
-#include <thread>
-#include <future>
-#include <mutex>
+#include <memory>
+#include <utility>
 #include <algorithm>
+#include "parallel.h"
 #include "decimal.h"
 
 namespace kaiu {
@@ -269,67 +269,52 @@ bool decimal::operator <=(const decimal& b) const
 	return relation_to(b) <= 0;
 }
 
-decimal decimal::parallel_multiply(const decimal& l, const decimal& r)
+Promise<decimal> decimal::parallel_multiply(EventLoop& loop, const decimal& l, const decimal& r, const EventLoopPool pool)
 {
 	const decimal& a = l.length() <= r.length() ? l : r;
 	const decimal& b = l.length() > r.length() ? l : r;
-	if (a.isZero()) {
-		return decimal(0);
-	} else if (a.isUnity()) {
-		return b;
+	if (a.length() < 1000) {
+		return promise::resolved(l * r);
 	}
+	/* Held until the reduction completes */
+	const auto operands = make_shared<pair<decimal, decimal>>(a, b);
 	const auto as = a.length();
 	const auto bs = b.length();
-	const size_t cores = std::thread::hardware_concurrency();
-	const size_t workers = min<size_t>(cores, (as / 1000));
-	if (workers == 0) {
-		return l * r;
-	}
-	decimal result;
-	result.digits.resize(as + bs);
-	mutex mx;
-	function<int(size_t, size_t)> partial_product = [&a, &b, as, bs, &mx, &result] (size_t begin, size_t end) {
-		decimal c;
-		c.digits.resize(as + bs);
-		decimal tmp;
-		tmp.digits.reserve(bs + end + 1);
-		for (size_t i = begin; i < end; i++) {
-			const digit ad = a[i];
-			if (ad == 0) {
-				continue;
-			}
-			fill(tmp.digits.begin(), tmp.digits.end(), 0);
-			tmp.digits.resize(bs + i + 1);
-			digit carry = 0;
-			for (size_t j = 0; j < bs; j++) {
-				digit d = b[j] * ad + carry;
-				carry = d / 10;
-				tmp[j + i] = d - (carry * 10);
-			}
-			if (carry) {
-				tmp[bs + i] = carry;
-			} else {
-				tmp.digits.resize(bs + i);
-			}
-			c += tmp;
+	/* Partial products have room for the whole product, so need no resizing */
+	decimal zero;
+	zero.digits.resize(as + bs);
+	/* Add the row for one digit of a to a partial product */
+	const auto accumulate = [operands, bs] (decimal partial, const digit& ad) {
+		const decimal& a = operands->first;
+		const decimal& b = operands->second;
+		if (ad == 0) {
+			return partial;
+		}
+		const size_t i = &ad - a.digits.data();
+		digit carry = 0;
+		for (size_t j = 0; j < bs; j++) {
+			const digit d = partial[i + j] + b.digits[j] * ad + carry;
+			carry = d / 10;
+			partial[i + j] = d - (carry * 10);
+		}
+		for (size_t k = i + bs; carry; k++) {
+			const digit d = partial[k] + carry;
+			carry = d / 10;
+			partial[k] = d - (carry * 10);
 		}
-		lock_guard<mutex> lock(mx);
-		result += c;
-		return 0;
+		return partial;
 	};
-	vector<future<int>> futures;
-	futures.reserve(workers);
-	for (size_t worker = 0; worker < workers; worker++) {
-		const auto begin = (as * worker) / workers;
-		const auto end = (as * (worker + 1)) / workers;
-		futures.emplace_back(async(std::launch::async, partial_product, begin, end));
-	}
-	for (size_t worker = 0; worker < workers; worker++) {
-		auto& future = futures[worker];
-		future.get();
-	}
-	result.remove_lz();
-	return result;
+	const auto combine = [] (decimal x, const decimal& y) {
+		x += y;
+		return x;
+	};
+	return promise::parallel_reduce(loop, pool,
+			operands->first.digits.cbegin(), operands->first.digits.cend(),
+			move(zero), accumulate, combine, 16)
+		->then([] (decimal result) {
+			result.remove_lz();
+			return result;
+		});
 }
 
 }
@@ -3,6 +3,8 @@
 #include <string>
 #include <type_traits>
 #include <limits>
+#include "event_loop.h"
+#include "promise.h"
 
 /*
  * Not intended for production use, just something to provide load for testing
@@ -44,7 +46,9 @@ public:
 	bool operator <=(const decimal& b) const;
 	template <typename T, typename = typename std::enable_if<std::numeric_limits<T>::is_integer>::type>
 	bool operator ==(const T& b) const;
-	static decimal parallel_multiply(const decimal&, const decimal&);
+	/* Product, computed by parallel_reduce in the given pool */
+	static Promise<decimal> parallel_multiply(EventLoop& loop, const decimal&, const decimal&,
+		const EventLoopPool pool = EventLoopPool::calculation);
 private:
 	std::vector<digit> digits;
 	void remove_lz();
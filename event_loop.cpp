@@ -1,6 +1,17 @@
 #include <stdexcept>
 #include <algorithm>
-#include "lock_many.h"
+#include <system_error>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include "concurrent_ring.h"
+#include "timer_wheel.h"
+#include "work_stealing_queue.h"
 #include "event_loop.h"
 
 namespace kaiu {
@@ -8,6 +19,151 @@ namespace kaiu {
 using namespace std;
 
 thread_local EventLoopPool this_pool = EventLoopPool::unknown;
+/* Index of this thread within its pool, and the loop which owns the pool */
+thread_local int this_worker = -1;
+thread_local const ParallelEventLoop *this_loop = nullptr;
+
+/*** EventTimers ***/
+
+/*
+ * Delayed events of a loop, in a timer wheel with one millisecond resolution.
+ *
+ * If busy is given, it is kept incremented while any delayed events are
+ * pending or have been taken but not yet pushed, so that
+ * ParallelEventLoop::join waits for them.
+ */
+class EventTimers {
+public:
+	using Clock = EventLoop::Clock;
+	struct Item {
+		EventLoopPool pool{EventLoopPool::invalid};
+		EventLoop::Event event;
+	};
+	explicit EventTimers(ScopedCounter<int> *busy = nullptr) : busy(busy) { }
+	uint64_t insert(const EventLoopPool pool, const Clock::time_point when, EventLoop::Event&& event);
+	bool cancel(const uint64_t id);
+	bool empty() const;
+	Clock::time_point next_wakeup() const;
+	/* Take the items which are due, without waiting */
+	void take_due(vector<Item>& out);
+	/*
+	 * Wait until some items are due then take them, returns false if stop was
+	 * called.  Call settle once the items have been pushed.
+	 */
+	bool wait_take(vector<Item>& out);
+	void settle();
+	void stop();
+private:
+	mutable mutex timers_mutex;
+	condition_variable changed;
+	TimerWheel<Item> wheel;
+	bool in_flight{false};
+	bool stopping{false};
+	ScopedCounter<int> *busy;
+	unique_ptr<ScopedCounter<int>::Guard> busy_guard;
+	/* Call with timers_mutex held */
+	void update_busy();
+};
+
+uint64_t EventTimers::insert(const EventLoopPool pool, const Clock::time_point when, EventLoop::Event&& event)
+{
+	lock_guard<mutex> lock(timers_mutex);
+	if (wheel.empty()) {
+		/*
+		 * The timer thread doesn't advance an empty wheel, so catch it up now
+		 * (in one step, as there is nothing to fire), rather than leaving the
+		 * next advance to walk every tick since the wheel went idle
+		 */
+		vector<Item> none;
+		wheel.advance(Clock::now(), none);
+	}
+	const auto wakeup = wheel.next_wakeup();
+	const auto id = wheel.insert(when, Item{ pool, move(event) });
+	update_busy();
+	/* Only wake the timer thread if it needs to wake sooner */
+	if (wheel.next_wakeup() < wakeup) {
+		changed.notify_one();
+	}
+	return id;
+}
+
+bool EventTimers::cancel(const uint64_t id)
+{
+	lock_guard<mutex> lock(timers_mutex);
+	const bool cancelled = wheel.cancel(id);
+	update_busy();
+	return cancelled;
+}
+
+bool EventTimers::empty() const
+{
+	lock_guard<mutex> lock(timers_mutex);
+	return wheel.empty();
+}
+
+auto EventTimers::next_wakeup() const -> Clock::time_point
+{
+	lock_guard<mutex> lock(timers_mutex);
+	return wheel.next_wakeup();
+}
+
+void EventTimers::take_due(vector<Item>& out)
+{
+	lock_guard<mutex> lock(timers_mutex);
+	wheel.advance(Clock::now(), out);
+}
+
+bool EventTimers::wait_take(vector<Item>& out)
+{
+	unique_lock<mutex> lock(timers_mutex);
+	while (!stopping) {
+		if (wheel.advance(Clock::now(), out)) {
+			in_flight = true;
+			return true;
+		}
+		if (wheel.empty()) {
+			changed.wait(lock);
+		} else {
+			changed.wait_until(lock, wheel.next_wakeup());
+		}
+	}
+	return false;
+}
+
+void EventTimers::settle()
+{
+	lock_guard<mutex> lock(timers_mutex);
+	in_flight = false;
+	update_busy();
+}
+
+void EventTimers::stop()
+{
+	lock_guard<mutex> lock(timers_mutex);
+	stopping = true;
+	changed.notify_all();
+}
+
+void EventTimers::update_busy()
+{
+	if (!busy) {
+		return;
+	}
+	const bool is_busy = in_flight || !wheel.empty();
+	if (is_busy && !busy_guard) {
+		busy_guard.reset(new ScopedCounter<int>::Guard(*busy, +1));
+	} else if (!is_busy && busy_guard) {
+		busy_guard.reset();
+	}
+}
+
+/*** EventTimer ***/
+
+bool EventTimer::cancel() const
+{
+	auto timers = this->timers.lock();
+	return timers && timers->cancel(id);
+}
 
 /*** EventLoop ***/
 
@@ -16,25 +172,53 @@ EventLoop::EventLoop(const EventLoopPool defaultPool)
 	this->defaultPool = defaultPool;
 }
 
+void EventLoop::push_events(const EventLoopPool pool, vector<Event>&& events)
+{
+	for (auto& event : events) {
+		push_event(pool, move(event));
+	}
+}
+
 /*** SynchronousEventLoop ***/
 
 SynchronousEventLoop::SynchronousEventLoop(const EventFunc& start) : EventLoop()
 {
+	timers = make_shared<EventTimers>();
 	push(start);
 	do_loop();
 }
 
 void SynchronousEventLoop::do_loop()
 {
-	while (events.size()) {
-		auto event = next();
-		(*event)(*this);
+	vector<EventTimers::Item> due;
+	while (true) {
+		/* Queue any delayed events which are due */
+		if (!timers->empty()) {
+			timers->take_due(due);
+			for (auto& item : due) {
+				events.emplace(move(item.event));
+			}
+			due.clear();
+		}
+		if (events.size()) {
+			auto event = next();
+			event(*this);
+		} else if (timers->empty()) {
+			break;
+		} else {
+			this_thread::sleep_until(timers->next_wakeup());
+		}
 	}
 }
 
-void SynchronousEventLoop::push(const EventLoopPool pool, const EventFunc& event)
+void SynchronousEventLoop::push_event(const EventLoopPool pool, Event&& event)
+{
+	events.emplace(move(event));
+}
+
+EventTimer SynchronousEventLoop::push_timer(const EventLoopPool pool, const Clock::time_point when, Event&& event)
 {
-	events.emplace(new EventFunc(event));
+	return make_timer(timers->insert(pool, when, move(event)));
 }
 
 auto SynchronousEventLoop::next(const EventLoopPool pool) -> Event
@@ -44,18 +228,185 @@ auto SynchronousEventLoop::next(const EventLoopPool pool) -> Event
 	return event;
 }
 
+/*** ParallelEventLoop::PoolQueue ***/
+
+/*
+ * Event queue of a pool, hides the queueing strategy from the loop.
+ *
+ * worker is the index of the calling thread within the pool, or -1 if the
+ * calling thread is not one of the pool's workers.
+ */
+class ParallelEventLoop::PoolQueue {
+public:
+	virtual ~PoolQueue() = default;
+	virtual void push(const int worker, Event&& event) = 0;
+	virtual void push_bulk(const int worker, vector<Event>&& events) = 0;
+	/* The worker is considered idle (not_idle decremented) while waiting */
+	virtual bool pop(const int worker, Event& out, ScopedCounter<int>& not_idle) = 0;
+	/* Appends up to max events to out, returns number appended */
+	virtual size_t pop_batch(const int worker, vector<Event>& out, const size_t max, ScopedCounter<int>& not_idle) = 0;
+	virtual void set_nowaiting(bool value) = 0;
+	/* For join: never decreases, changes whenever an event is pushed */
+	virtual size_t push_count() const = 0;
+	virtual bool is_empty() const = 0;
+};
+
+class ParallelEventLoop::SharedPoolQueue : public ParallelEventLoop::PoolQueue {
+public:
+	virtual void push(const int worker, Event&& event) override
+		{ queue.push(move(event)); pushes.fetch_add(1, memory_order_relaxed); }
+	virtual void push_bulk(const int worker, vector<Event>&& events) override
+		{ queue.push_bulk(events.begin(), events.end()); pushes.fetch_add(events.size(), memory_order_relaxed); }
+	virtual bool pop(const int worker, Event& out, ScopedCounter<int>& not_idle) override
+		{ return queue.pop<ScopedCounter<int>::Guard>(out, not_idle, -1); }
+	virtual size_t pop_batch(const int worker, vector<Event>& out, const size_t max, ScopedCounter<int>& not_idle) override
+		{ return queue.pop_batch<ScopedCounter<int>::Guard>(out, max, not_idle, -1); }
+	virtual void set_nowaiting(bool value) override
+		{ queue.set_nowaiting(value); }
+	virtual size_t push_count() const override
+		{ return pushes.load(); }
+	virtual bool is_empty() const override
+		{ return queue.isEmpty(); }
+private:
+	ConcurrentQueue<Event> queue{false};
+	atomic<size_t> pushes{0};
+};
+
+class ParallelEventLoop::StealingPoolQueue : public ParallelEventLoop::PoolQueue {
+public:
+	explicit StealingPoolQueue(const int workers) : queue(workers) { }
+	virtual void push(const int worker, Event&& event) override
+		{ queue.push(worker, move(event)); }
+	virtual void push_bulk(const int worker, vector<Event>&& events) override
+		{ queue.push_bulk(worker, events.begin(), events.end()); }
+	virtual bool pop(const int worker, Event& out, ScopedCounter<int>& not_idle) override
+		{ return queue.pop<ScopedCounter<int>::Guard>(worker, out, not_idle, -1); }
+	virtual size_t pop_batch(const int worker, vector<Event>& out, const size_t max, ScopedCounter<int>& not_idle) override
+		{ return queue.pop_batch<ScopedCounter<int>::Guard>(worker, out, max, not_idle, -1); }
+	virtual void set_nowaiting(bool value) override
+		{ queue.set_nowaiting(value); }
+	virtual size_t push_count() const override
+		{ return queue.push_count(); }
+	virtual bool is_empty() const override
+		{ return queue.isEmpty(); }
+private:
+	WorkStealingQueue<Event> queue;
+};
+
+class ParallelEventLoop::RingPoolQueue : public ParallelEventLoop::PoolQueue {
+public:
+	explicit RingPoolQueue(const size_t capacity) : queue(capacity) { }
+	virtual void push(const int worker, Event&& event) override
+		{ queue.push(move(event)); }
+	virtual void push_bulk(const int worker, vector<Event>&& events) override
+		{ queue.push_bulk(events.begin(), events.end()); }
+	virtual bool pop(const int worker, Event& out, ScopedCounter<int>& not_idle) override
+		{ return queue.pop<ScopedCounter<int>::Guard>(out, not_idle, -1); }
+	virtual size_t pop_batch(const int worker, vector<Event>& out, const size_t max, ScopedCounter<int>& not_idle) override
+		{ return queue.pop_batch<ScopedCounter<int>::Guard>(out, max, not_idle, -1); }
+	virtual void set_nowaiting(bool value) override
+		{ queue.set_nowaiting(value); }
+	virtual size_t push_count() const override
+		{ return queue.push_count(); }
+	virtual bool is_empty() const override
+		{ return queue.isEmpty(); }
+private:
+	ConcurrentRing<Event> queue;
+};
+
+/*** CPU/NUMA placement ***/
+
+/* Parses a kernel CPU list, e.g. "0-3,8,10-11" */
+static vector<int> parse_cpu_list(const string& list)
+{
+	vector<int> cpus;
+	stringstream ss(list);
+	string range;
+	while (getline(ss, range, ',')) {
+		if (range.empty() || range == "\n") {
+			continue;
+		}
+		const auto dash = range.find('-');
+		const int first = stoi(range.substr(0, dash));
+		const int last = dash == string::npos ? first : stoi(range.substr(dash + 1));
+		for (int cpu = first; cpu <= last; cpu++) {
+			cpus.push_back(cpu);
+		}
+	}
+	return cpus;
+}
+
+/* CPUs of a NUMA node, empty if the node does not exist */
+static vector<int> node_cpus(const int node)
+{
+	ifstream file("/sys/devices/system/node/node" + to_string(node) + "/cpulist");
+	string list;
+	if (!getline(file, list)) {
+		return {};
+	}
+	return parse_cpu_list(list);
+}
+
+static void validate_placement(const EventLoopPoolConfig& config)
+{
+	for (const auto cpu : config.cpus) {
+		if (cpu < 0 || cpu >= CPU_SETSIZE) {
+			throw invalid_argument("Invalid CPU specified for a pool");
+		}
+	}
+	if (config.numa_node >= 0 && node_cpus(config.numa_node).empty()) {
+		throw invalid_argument("NUMA node specified for a pool does not exist or has no CPUs");
+	}
+}
+
+void ParallelEventLoop::place_worker(const int worker, const EventLoopPoolConfig& config)
+{
+	vector<int> affinity;
+	if (config.cpus.size()) {
+		affinity.push_back(config.cpus[worker % config.cpus.size()]);
+	} else if (config.numa_node >= 0) {
+		affinity = node_cpus(config.numa_node);
+	}
+	if (affinity.size()) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		for (const auto cpu : affinity) {
+			CPU_SET(cpu, &set);
+		}
+		const int error = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+		if (error) {
+			throw system_error(error, system_category(), "pthread_setaffinity_np");
+		}
+	}
+	if (config.numa_node >= 0) {
+		/*
+		 * Prefer the node's memory for this thread's allocations, falling back
+		 * to other nodes when it is exhausted.  Called via syscall so we don't
+		 * need to link libnuma.
+		 */
+		const size_t bits = 8 * sizeof(unsigned long);
+		vector<unsigned long> mask(config.numa_node / bits + 1);
+		mask[config.numa_node / bits] |= 1UL << (config.numa_node % bits);
+		if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask.data(), mask.size() * bits + 1) != 0) {
+			throw system_error(errno, system_category(), "set_mempolicy");
+		}
+	}
+}
+
 /*** ParallelEventLoop ***/
 
-ParallelEventLoop::ParallelEventLoop(const unordered_map<EventLoopPool, int, EventLoopPoolHash> pools) : EventLoop()
+ParallelEventLoop::ParallelEventLoop(const PoolConfigs pools) : EventLoop()
 {
+	timers = make_shared<EventTimers>(&threads_not_idle_counter);
 	/* Count how many threads we need (including this thread) */
 	int total_threads = 0;
 	for (const auto& pair : pools) {
-		const auto pool_size = pair.second;
+		const auto pool_size = pair.second.threads;
 		if (pool_size <= 0) {
 			throw invalid_argument("Thread count specified for a pool is zero or negative.  Use SynchronousEventLoop for non-threaded event loop.");
 			return;
 		}
+		validate_placement(pair.second);
 		total_threads += pool_size;
 	}
 	/* Include this thread in count of threads to initialize */
@@ -63,46 +414,127 @@ ParallelEventLoop::ParallelEventLoop(const unordered_map<EventLoopPool, int, Eve
 	/* Iterate over requested thread pools, creating threads */
 	for (const auto& pair : pools) {
 		const auto pool_type = pair.first;
-		const auto pool_size = pair.second;
-		queues.emplace(piecewise_construct, forward_as_tuple(pool_type), forward_as_tuple(false));
+		const auto pool_size = pair.second.threads;
+		switch (pair.second.queue) {
+		case EventLoopQueue::shared:
+			queues.emplace(pool_type, unique_ptr<PoolQueue>(new SharedPoolQueue()));
+			break;
+		case EventLoopQueue::work_stealing:
+			queues.emplace(pool_type, unique_ptr<PoolQueue>(new StealingPoolQueue(pool_size)));
+			break;
+		case EventLoopQueue::lock_free_ring:
+			queues.emplace(pool_type, unique_ptr<PoolQueue>(new RingPoolQueue(pair.second.ring_capacity)));
+			break;
+		default:
+			throw invalid_argument("Invalid queue type specified for a pool");
+		}
+		cpus.emplace(pool_type, unique_ptr<atomic<int>[]>(new atomic<int>[pool_size]));
+		pool_sizes.emplace(pool_type, pool_size);
+		for (int i = 0; i < pool_size; i++) {
+			cpus.at(pool_type)[i] = -1;
+		}
 		for (int i = 0; i < pool_size; i++) {
-			threads.emplace_back(bind(&ParallelEventLoop::do_threaded_loop, this, pool_type));
+			threads.emplace_back(bind(&ParallelEventLoop::do_threaded_loop, this, pool_type, i, pair.second));
 		}
 	}
 	/* Mark this thread as started, Wait for all threads to start */
 	starter_pistol.ready();
 }
 
-void ParallelEventLoop::do_threaded_loop(const EventLoopPool pool)
+void ParallelEventLoop::do_threaded_loop(const EventLoopPool pool, const int worker, const EventLoopPoolConfig config)
 {
 	this_pool = pool;
+	this_worker = worker;
+	this_loop = this;
+	/* Failure to place the worker is reported via the exception queue */
+	try {
+		place_worker(worker, config);
+	} catch (...) {
+		exceptions.push(current_exception());
+	}
+	const size_t batch = max<size_t>(config.batch, 1);
 	/*
 	 * Mark this thread as "working".  This will be undone temporarily by any
 	 * blocking wait operation on the event queue, via ConcurrentQueue<T>::pop.
 	 */
 	auto not_idle = threads_not_idle_counter.delta(+1);
 	starter_pistol.ready();
-	while (Event event = next(pool)) {
-		try {
-			(*event)(*this);
-		} catch (...) {
-			/* Store exception (uses exceptions_mutex) */
-			exceptions.push(current_exception());
-			/* Notify any ongoing join() that there is an exception to handle */
-			threads_not_idle_counter.notify();
+	PoolQueue& queue = *queues.at(pool);
+	atomic<int>& cpu = cpus.at(pool)[worker];
+	cpu = current_cpu();
+	vector<Event> events;
+	events.reserve(batch);
+	/* See next() regarding idle state while waiting */
+	while (queue.pop_batch(worker, events, batch, threads_not_idle_counter)) {
+		cpu.store(current_cpu(), memory_order_relaxed);
+		for (auto& event : events) {
+			try {
+				event(*this);
+			} catch (...) {
+				/* Store exception (uses exceptions_mutex) */
+				exceptions.push(current_exception());
+				/* Notify any ongoing join() that there is an exception to handle */
+				threads_not_idle_counter.notify();
+			}
 		}
+		events.clear();
 	}
 }
 
-void ParallelEventLoop::push(const EventLoopPool pool, const EventFunc& event)
+auto ParallelEventLoop::queue_for(const EventLoopPool pool, int& worker) -> PoolQueue&
 {
 	/* const-param antipattern */
 	auto _pool = pool == EventLoopPool::same ? current_pool() : pool;
 	if (int(_pool) <= 0) {
 		throw invalid_argument("Invalid thread pool");
 	}
-	ConcurrentQueue<Event>& queue = queues.at(_pool);
-	queue.emplace(new EventFunc(event));
+	worker = this_loop == this && this_pool == _pool ? this_worker : -1;
+	return *queues.at(_pool);
+}
+
+void ParallelEventLoop::push_event(const EventLoopPool pool, Event&& event)
+{
+	int worker;
+	PoolQueue& queue = queue_for(pool, worker);
+	queue.push(worker, move(event));
+}
+
+void ParallelEventLoop::push_events(const EventLoopPool pool, vector<Event>&& events)
+{
+	int worker;
+	PoolQueue& queue = queue_for(pool, worker);
+	if (events.size()) {
+		queue.push_bulk(worker, move(events));
+	}
+}
+
+EventTimer ParallelEventLoop::push_timer(const EventLoopPool pool, const Clock::time_point when, Event&& event)
+{
+	/* Resolve "same" now, as the timer thread is not in any pool */
+	int worker;
+	queue_for(pool, worker);
+	const auto _pool = pool == EventLoopPool::same ? current_pool() : pool;
+	call_once(timer_thread_started, [this] {
+		timer_thread = thread(&ParallelEventLoop::do_timer_loop, this);
+	});
+	return make_timer(timers->insert(_pool, when, move(event)));
+}
+
+void ParallelEventLoop::do_timer_loop()
+{
+	vector<EventTimers::Item> due;
+	while (timers->wait_take(due)) {
+		for (auto& item : due) {
+			try {
+				push_event(item.pool, move(item.event));
+			} catch (...) {
+				exceptions.push(current_exception());
+				threads_not_idle_counter.notify();
+			}
+		}
+		due.clear();
+		timers->settle();
+	}
 }
 
 void ParallelEventLoop::process_exceptions(function<void(exception_ptr)> handler)
@@ -117,18 +549,20 @@ void ParallelEventLoop::process_exceptions(function<void(exception_ptr)> handler
 
 auto ParallelEventLoop::next(const EventLoopPool pool) -> Event
 {
-	ConcurrentQueue<Event>& queue = queues.at(pool);
+	PoolQueue& queue = *queues.at(pool);
 	Event event;
 	/*
 	 * If pop waits, this thread is considered idle during the wait.
 	 *
-	 * queue_mutex is always acquired during this call, and may be
+	 * The queue's mutex(es) are acquired during this call, and may be
 	 * released/reacquired several times if a wait occurs.
 	 *
 	 * threads_not_idle_counter mutex will be acquired at the start and at the
-	 * end of a wait, always while queue_mutex is acquired.
+	 * end of a wait.  The thread stops being idle before it takes the event
+	 * which ended the wait, so join never sees an event which is neither
+	 * queued nor being processed.
 	 */
-	if (queue.pop<ScopedCounter<int>::Guard>(event, threads_not_idle_counter, -1)) {
+	if (queue.pop(this_worker, event, threads_not_idle_counter)) {
 		return event;
 	} else {
 		/* No events available and queue is in non-blocking mode */
@@ -138,37 +572,38 @@ auto ParallelEventLoop::next(const EventLoopPool pool) -> Event
 
 void ParallelEventLoop::join(function<void(exception_ptr)> handler)
 {
-	/* Proxy iterator for iterating over queue mutexes */
-	using src_it = typename decltype(queues)::const_iterator;
-	class queue_mutex_iterator {
-	public:
-		queue_mutex_iterator(src_it it) : it(it) { }
-		bool operator !=(const queue_mutex_iterator& b) { return it != b.it; }
-		void operator ++() { ++it; }
-		mutex& operator *() { return it->second.queue_mutex; }
-		mutex& operator ->() { return it->second.queue_mutex; }
-	private:
-		src_it it;
-	};
 	/* Sanity check */
 	if (current_pool() != EventLoopPool::unknown) {
 		throw logic_error("join called from worker thread");
 	}
-	/* Loop until all queues are empty and all threads are idle */
+	const auto push_count = [this] {
+		size_t count = 0;
+		for (const auto& pair : queues) {
+			count += pair.second->push_count();
+		}
+		return count;
+	};
+	/*
+	 * Loop until all queues are empty and all threads are idle.
+	 *
+	 * Not all queues have a mutex that we could hold to get a consistent
+	 * snapshot, so instead we check that no event was pushed while we were
+	 * checking.  A worker stops being idle before it takes an event, and only
+	 * non-idle workers push events, so if all queues were empty and then all
+	 * threads were idle, with no push in between, then the loop is idle.
+	 */
 	do {
 		/* Handle pending exceptions */
 		process_exceptions(handler);
 		/* Wait until all threads are idle */
 		threads_not_idle_counter.waitForZero();
-		/* Lock all queues */
-		lock_many lock(
-			queue_mutex_iterator(queues.cbegin()),
-			queue_mutex_iterator(queues.cend()));
+		const auto pushes_before = push_count();
 		bool all_queues_are_empty =
 			all_of(queues.cbegin(), queues.cend(),
-				[] (auto& pair) { return pair.second.isEmpty(true); });
+				[] (auto& pair) { return pair.second->is_empty(); });
 		/* If all queues are empty and all threads are idle, break */
-		if (all_queues_are_empty && threads_not_idle_counter.isZero()) {
+		if (all_queues_are_empty && threads_not_idle_counter.isZero() &&
+				push_count() == pushes_before) {
 			break;
 		}
 	} while (true);
@@ -187,13 +622,17 @@ ParallelEventLoop::~ParallelEventLoop()
 	 * are waiting for events.
 	 */
 	for (auto& pair : queues) {
-		auto& queue = pair.second;
+		auto& queue = *pair.second;
 		queue.set_nowaiting(true);
 	}
 	/* Wait for all workers to terminate */
 	for (auto& thread : threads) {
 		thread.join();
 	}
+	timers->stop();
+	if (timer_thread.joinable()) {
+		timer_thread.join();
+	}
 }
 
 EventLoopPool ParallelEventLoop::current_pool()
@@ -201,4 +640,20 @@ EventLoopPool ParallelEventLoop::current_pool()
 	return this_pool;
 }
 
+int ParallelEventLoop::current_cpu()
+{
+	return sched_getcpu();
+}
+
+vector<int> ParallelEventLoop::worker_cpus(const EventLoopPool pool) const
+{
+	const int size = pool_sizes.at(pool);
+	const auto& worker_cpu = cpus.at(pool);
+	vector<int> result;
+	for (int i = 0; i < size; i++) {
+		result.push_back(worker_cpu[i].load());
+	}
+	return result;
+}
+
 }
@@ -1,6 +1,9 @@
 #pragma once
 #include <functional>
 #include <memory>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <queue>
 #include <vector>
 #include <thread>
@@ -9,6 +12,7 @@
 #include <stdexcept>
 #include <unordered_map>
 #include "concurrent_queue.h"
+#include "small_function.h"
 #include "starter_pistol.h"
 #include "scoped_counter.h"
 
@@ -16,6 +20,7 @@ namespace kaiu {
 
 
 class EventLoop;
+class EventTimers;
 
 using EventFunc = std::function<void(EventLoop&)>;
 
@@ -40,6 +45,83 @@ struct EventLoopPoolHash
 	}
 };
 
+/*
+ * How the workers of a ParallelEventLoop pool receive their events
+ *
+ *   shared: one queue per pool, shared by all workers in the pool
+ *
+ *   work_stealing: one deque per worker; events pushed from a worker go to its
+ *   own deque, idle workers steal from the other workers in the pool
+ *
+ *   lock_free_ring: one bounded lock-free ring per pool, shared by all workers
+ *   in the pool (spills into a locked overflow queue when full)
+ */
+enum class EventLoopQueue : int {
+	shared,
+	work_stealing,
+	lock_free_ring
+};
+
+/*
+ * Configuration of a ParallelEventLoop pool
+ *
+ * Implicitly constructible from a thread count, so pools can be specified as
+ * { EventLoopPool::reactor, 1 } or as
+ * { EventLoopPool::calculation, { 8, EventLoopQueue::work_stealing } }
+ */
+struct EventLoopPoolConfig {
+	EventLoopPoolConfig(const int threads, const EventLoopQueue queue = EventLoopQueue::shared, const size_t ring_capacity = 1024, const size_t batch = 1) :
+		threads(threads), queue(queue), ring_capacity(ring_capacity), batch(batch) { }
+	int threads;
+	EventLoopQueue queue;
+	/* Only used by lock_free_ring */
+	size_t ring_capacity;
+	/*
+	 * Maximum number of events a worker takes from the queue at once.  Larger
+	 * batches mean fewer lock acquisitions, but events taken by a busy worker
+	 * cannot be run by an idle one in the meantime.
+	 */
+	size_t batch;
+	/*
+	 * CPUs to pin the pool's workers to.  Worker i is pinned to
+	 * cpus[i % cpus.size()].  If empty, workers are not pinned to single
+	 * CPUs.
+	 */
+	std::vector<int> cpus;
+	/*
+	 * NUMA node to bind the pool's workers to, or -1 for no binding.  Memory
+	 * allocated by the workers is preferably taken from this node, and if
+	 * cpus is empty then the workers may run on any of the node's CPUs.
+	 */
+	int numa_node{-1};
+	/* Chainable setters, e.g. EventLoopPoolConfig(4).pin({ 0, 1, 2, 3 }) */
+	EventLoopPoolConfig& pin(std::vector<int> cpus)
+		{ this->cpus = std::move(cpus); return *this; }
+	EventLoopPoolConfig& bind_node(const int numa_node)
+		{ this->numa_node = numa_node; return *this; }
+};
+
+/*
+ * Handle to a delayed event (see EventLoop::push_after), which may be copied
+ * freely and which may outlive the event loop
+ */
+class EventTimer {
+public:
+	EventTimer() = default;
+	/*
+	 * Stop the event from being pushed.  Returns false if the event has
+	 * already been pushed, has already been cancelled, or if the loop no
+	 * longer exists.
+	 */
+	bool cancel() const;
+private:
+	friend class EventLoop;
+	EventTimer(std::weak_ptr<EventTimers> timers, const std::uint64_t id) :
+		timers(std::move(timers)), id(id) { }
+	std::weak_ptr<EventTimers> timers;
+	std::uint64_t id{0};
+};
+
 /*
  * Base class for event loops
  */
@@ -47,19 +129,68 @@ class EventLoop {
 public:
 	EventLoop& operator =(const EventLoop&) = delete;
 	EventLoop(const EventLoop&) = delete;
+	/*
+	 * Move-only event, closures of up to seven pointers in size (e.g. those
+	 * created by task/task_stream) are stored without heap allocation.
+	 */
+	using Event = SmallFunction<void(EventLoop&), 7 * sizeof(void *)>;
 	/*
 	 * Push an event into the queue
+	 *
+	 * Any callable taking EventLoop& may be pushed.  Passing the callable by
+	 * rvalue avoids copying it, and unlike with EventFunc it need not be
+	 * copyable.
 	 */
-	virtual void push(const EventLoopPool pool, const EventFunc& event) = 0;
-	void push(const EventFunc& event) { push(defaultPool, event); }
+	template <typename Func>
+	void push(const EventLoopPool pool, Func&& func)
+		{ push_event(pool, Event(std::forward<Func>(func))); }
+	template <typename Func>
+	void push(Func&& func)
+		{ push_event(defaultPool, Event(std::forward<Func>(func))); }
+	/*
+	 * Push a range of events into the queue, with one lock acquisition and one
+	 * wakeup where the loop supports it.
+	 *
+	 * Elements of an rvalue range are moved from, elements of an lvalue range
+	 * are copied.
+	 */
+	template <typename Range>
+	void push_bulk(const EventLoopPool pool, Range&& funcs);
+	/*
+	 * Push an event into the queue after a delay / at a given time.  Never
+	 * pushes early, may push up to about one millisecond late.
+	 *
+	 * Pending delayed events count as pending events, e.g. for
+	 * ParallelEventLoop::join, so cancel them if they are no longer needed.
+	 */
+	using Clock = std::chrono::steady_clock;
+	template <typename Rep, typename Period, typename Func>
+	EventTimer push_after(const EventLoopPool pool, const std::chrono::duration<Rep, Period> delay, Func&& func)
+		{ return push_at(pool, Clock::now() + std::chrono::duration_cast<Clock::duration>(delay), std::forward<Func>(func)); }
+	template <typename Func>
+	EventTimer push_at(const EventLoopPool pool, const Clock::time_point when, Func&& func)
+		{ return push_timer(pool, when, Event(std::forward<Func>(func))); }
 protected:
-	using Event = std::unique_ptr<EventFunc>;
 	EventLoop(const EventLoopPool defaultPool = EventLoopPool::reactor);
 	virtual ~EventLoop() = default;
+	virtual void push_event(const EventLoopPool pool, Event&& event) = 0;
+	virtual EventTimer push_timer(const EventLoopPool pool, const Clock::time_point when, Event&& event) = 0;
+	/* Pending delayed events */
+	std::shared_ptr<EventTimers> timers;
+	EventTimer make_timer(const std::uint64_t id) { return EventTimer(timers, id); }
+	/* Default implementation pushes the events one at a time */
+	virtual void push_events(const EventLoopPool pool, std::vector<Event>&& events);
 	virtual Event next(const EventLoopPool pool) = 0;
 	Event next() { return next(defaultPool); }
 private:
 	EventLoopPool defaultPool{EventLoopPool::reactor};
+	/* Build events from [first, last), moving or copying as It dictates */
+	template <typename It>
+	static std::vector<Event> make_events(It first, It last);
+	template <typename Range>
+	static std::vector<Event> make_events(Range& funcs, std::true_type is_lvalue);
+	template <typename Range>
+	static std::vector<Event> make_events(Range& funcs, std::false_type is_lvalue);
 };
 
 /*
@@ -72,9 +203,9 @@ public:
 	SynchronousEventLoop& operator =(const EventLoop &) = delete;
 	SynchronousEventLoop(const EventLoop&) = delete;
 	SynchronousEventLoop(const EventFunc& start);
-	virtual void push(const EventLoopPool pool, const EventFunc& event) override;
-	void push(const EventFunc& event) { push(EventLoopPool::reactor, event); }
 protected:
+	virtual void push_event(const EventLoopPool pool, Event&& event) override;
+	virtual EventTimer push_timer(const EventLoopPool pool, const Clock::time_point when, Event&& event) override;
 	virtual Event next(const EventLoopPool pool) override;
 	Event next() { return next(EventLoopPool::reactor); }
 private:
@@ -94,11 +225,11 @@ class ParallelEventLoop : public virtual EventLoop {
 public:
 	ParallelEventLoop& operator =(const ParallelEventLoop &) = delete;
 	ParallelEventLoop(const ParallelEventLoop &) = delete;
-	ParallelEventLoop(const std::unordered_map<EventLoopPool, int, EventLoopPoolHash> pools);
+	using PoolConfigs = std::unordered_map<EventLoopPool, EventLoopPoolConfig, EventLoopPoolHash>;
+	ParallelEventLoop(const PoolConfigs pools);
 	virtual ~ParallelEventLoop() override;
 	/* If handler is nullptr, the exceptions are discarded */
 	void process_exceptions(std::function<void(std::exception_ptr)> handler);
-	virtual void push(const EventLoopPool pool, const EventFunc& event) override;
 	/*
 	 * Returns when all threads are idle and no events are pending.
 	 *
@@ -111,13 +242,34 @@ public:
 	 * ParallelEventLoop-pooled thread, e.g. the application's main thread.
 	 */
 	static EventLoopPool current_pool();
+	/* Get which CPU the current thread is running on, or -1 if unknown */
+	static int current_cpu();
+	/*
+	 * Get which CPU each worker of a pool last ran on (as of when it last
+	 * took events from the queue), or -1 for workers which have not started.
+	 */
+	std::vector<int> worker_cpus(const EventLoopPool pool) const;
 protected:
+	virtual void push_event(const EventLoopPool pool, Event&& event) override;
+	virtual void push_events(const EventLoopPool pool, std::vector<Event>&& events) override;
+	virtual EventTimer push_timer(const EventLoopPool pool, const Clock::time_point when, Event&& event) override;
 	virtual Event next(const EventLoopPool pool) override;
 private:
 	/* Threads */
 	std::vector<std::thread> threads;
-	/* Event queues (one per pool) */
-	std::unordered_map<EventLoopPool, ConcurrentQueue<Event>, EventLoopPoolHash> queues;
+	/* Pushes delayed events when they are due, started on first use */
+	std::thread timer_thread;
+	std::once_flag timer_thread_started;
+	void do_timer_loop();
+	/* Event queues (one per pool), see event_loop.cpp */
+	class PoolQueue;
+	class SharedPoolQueue;
+	class StealingPoolQueue;
+	class RingPoolQueue;
+	std::unordered_map<EventLoopPool, std::unique_ptr<PoolQueue>, EventLoopPoolHash> queues;
+	/* CPU that each worker of each pool last ran on */
+	std::unordered_map<EventLoopPool, std::unique_ptr<std::atomic<int>[]>, EventLoopPoolHash> cpus;
+	std::unordered_map<EventLoopPool, int, EventLoopPoolHash> pool_sizes;
 	/* Exception queue */
 	ConcurrentQueue<std::exception_ptr> exceptions{true};
 	/* Cause all threads to start at the same time */
@@ -130,7 +282,15 @@ private:
 	 */
 	ScopedCounter<int> threads_not_idle_counter;
 	/* Thread entry point */
-	void do_threaded_loop(const EventLoopPool pool);
+	void do_threaded_loop(const EventLoopPool pool, const int worker, const EventLoopPoolConfig config);
+	/* Applies CPU affinity and NUMA memory policy to the calling worker */
+	static void place_worker(const int worker, const EventLoopPoolConfig& config);
+	/* Resolves "same" and validates pool */
+	PoolQueue& queue_for(const EventLoopPool pool, int& worker);
 };
 
 }
+
+#ifndef event_loop_tcc
+#include "event_loop.tcc"
+#endif
@@ -0,0 +1,43 @@
+#define event_loop_tcc
+#include <iterator>
+#include "event_loop.h"
+
+namespace kaiu {
+
+
+/*** EventLoop ***/
+
+template <typename Range>
+void EventLoop::push_bulk(const EventLoopPool pool, Range&& funcs)
+{
+	push_events(pool, make_events(funcs, std::is_lvalue_reference<Range>()));
+}
+
+template <typename It>
+auto EventLoop::make_events(It first, It last) -> std::vector<Event>
+{
+	std::vector<Event> events;
+	for (; first != last; ++first) {
+		events.emplace_back(*first);
+	}
+	return events;
+}
+
+template <typename Range>
+auto EventLoop::make_events(Range& funcs, std::true_type) -> std::vector<Event>
+{
+	using std::begin;
+	using std::end;
+	return make_events(begin(funcs), end(funcs));
+}
+
+template <typename Range>
+auto EventLoop::make_events(Range& funcs, std::false_type) -> std::vector<Event>
+{
+	using std::begin;
+	using std::end;
+	return make_events(std::make_move_iterator(begin(funcs)),
+		std::make_move_iterator(end(funcs)));
+}
+
+}
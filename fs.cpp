@@ -1 +1,241 @@
+#include <system_error>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/types.h>
 #include "fs.h"
+
+namespace kaiu {
+
+using namespace std;
+
+static exception_ptr errno_error(const string& what, const int error = errno)
+{
+	return make_exception_ptr(system_error(error, system_category(), what));
+}
+
+/* Descriptors are closed when the last event referring to them is done */
+struct FileSystem::DirReader {
+	DirReader(const string& path, const size_t block_size) :
+		path(path), block_size(block_size) { }
+	~DirReader() { if (dir) { closedir(dir); } }
+	const string path;
+	const size_t block_size;
+	PromiseStream<size_t, vector<string>> stream;
+	DIR *dir{nullptr};
+	size_t total{0};
+};
+
+struct FileSystem::FileReader {
+	explicit FileReader(const string& path) : path(path) { }
+	~FileReader() { if (fd >= 0) { ::close(fd); } }
+	const string path;
+	PromiseStream<size_t, Buffer> stream;
+	int fd{-1};
+	size_t total{0};
+};
+
+struct FileSystem::FileWriter {
+	explicit FileWriter(const string& path) : path(path) { }
+	~FileWriter() { if (fd >= 0) { ::close(fd); } }
+	/* Open on first use, returns error or null */
+	exception_ptr open();
+	const string path;
+	int fd{-1};
+	size_t total{0};
+};
+
+exception_ptr FileSystem::FileWriter::open()
+{
+	if (fd < 0) {
+		fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+		if (fd < 0) {
+			return errno_error("open " + path);
+		}
+	}
+	return nullptr;
+}
+
+FileSystem::FileSystem(EventLoop& loop, const EventLoopPool pool,
+		const size_t chunk_size, const size_t max_buffers) :
+	loop(loop), pool(pool), buffer_pool(chunk_size, max_buffers)
+{
+}
+
+BufferPool& FileSystem::buffers()
+{
+	return buffer_pool;
+}
+
+/*** Directories ***/
+
+PromiseStream<size_t, vector<string>> FileSystem::read_dir(const string& path, const size_t block_size)
+{
+	auto reader = make_shared<DirReader>(path, block_size ? block_size : 1);
+	reader->stream->set_capacity(1);
+	loop.push(pool, [this, reader] (EventLoop&) {
+		reader->dir = opendir(reader->path.c_str());
+		if (!reader->dir) {
+			reader->stream->reject(errno_error("opendir " + reader->path));
+			return;
+		}
+		do_read_dir(reader);
+	});
+	return reader->stream;
+}
+
+void FileSystem::do_read_dir(shared_ptr<DirReader> reader)
+{
+	auto& stream = reader->stream;
+	if (stream->is_stopping()) {
+		stream->resolve(reader->total);
+		return;
+	}
+	vector<string> block;
+	block.reserve(reader->block_size);
+	while (block.size() < reader->block_size) {
+		errno = 0;
+		const dirent *entry = readdir(reader->dir);
+		if (!entry) {
+			if (errno) {
+				stream->reject(errno_error("readdir " + reader->path));
+				return;
+			}
+			break;
+		}
+		const char *name = entry->d_name;
+		if (name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0))) {
+			continue;
+		}
+		block.emplace_back(name);
+	}
+	const bool end = block.size() < reader->block_size;
+	if (block.empty()) {
+		stream->resolve(reader->total);
+		return;
+	}
+	reader->total += block.size();
+	/*
+	 * Read the next block once the consumer has taken this one, so a slow
+	 * consumer doesn't get the whole listing buffered.  Next block in a new
+	 * event, so other work can interleave.
+	 */
+	stream->write_async(move(block))
+		->then([this, reader, end] (StreamAction) {
+			if (end) {
+				reader->stream->resolve(reader->total);
+				return;
+			}
+			loop.push(pool, [this, reader] (EventLoop&) {
+				do_read_dir(reader);
+			});
+		});
+}
+
+/*** Files ***/
+
+PromiseStream<size_t, Buffer> FileSystem::read_file(const string& path)
+{
+	auto reader = make_shared<FileReader>(path);
+	loop.push(pool, [this, reader] (EventLoop&) {
+		reader->fd = ::open(reader->path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (reader->fd < 0) {
+			reader->stream->reject(errno_error("open " + reader->path));
+			return;
+		}
+		do_read_file(reader);
+	});
+	return reader->stream;
+}
+
+void FileSystem::do_read_file(shared_ptr<FileReader> reader)
+{
+	auto& stream = reader->stream;
+	if (stream->is_stopping()) {
+		stream->resolve(reader->total);
+		return;
+	}
+	/*
+	 * All buffers are held by the consumer (or queued in the stream), so
+	 * wait for one to be released rather than growing without bound.
+	 */
+	Buffer buffer;
+	const bool ready = buffer_pool.take_or_wait(buffer, [this, reader] {
+		loop.push(pool, [this, reader] (EventLoop&) {
+			do_read_file(reader);
+		});
+	});
+	if (!ready) {
+		return;
+	}
+	ssize_t count;
+	do {
+		count = ::read(reader->fd, buffer.data(), buffer.capacity());
+	} while (count < 0 && errno == EINTR);
+	if (count < 0) {
+		stream->reject(errno_error("read " + reader->path));
+		return;
+	}
+	if (count == 0) {
+		stream->resolve(reader->total);
+		return;
+	}
+	buffer.resize(count);
+	reader->total += count;
+	stream->write(move(buffer));
+	loop.push(pool, [this, reader] (EventLoop&) {
+		do_read_file(reader);
+	});
+}
+
+Promise<size_t> FileSystem::write_file(const string& path, PromiseStream<size_t, Buffer> chunks)
+{
+	auto writer = make_shared<FileWriter>(path);
+	/*
+	 * The consumer's promise completes once the chunk is written, so the
+	 * stream does not pass the next chunk until then, keeping writes ordered.
+	 */
+	auto consumer = [this, writer] (Buffer chunk) {
+		Promise<StreamAction> written;
+		loop.push(pool, [writer, chunk = move(chunk), written] (EventLoop&) {
+			if (auto error = writer->open()) {
+				written->reject(error);
+				return;
+			}
+			size_t offset = 0;
+			while (offset < chunk.size()) {
+				const ssize_t count = ::write(writer->fd, chunk.data() + offset, chunk.size() - offset);
+				if (count < 0 && errno == EINTR) {
+					continue;
+				} else if (count < 0) {
+					written->reject(errno_error("write " + writer->path));
+					return;
+				}
+				offset += count;
+			}
+			writer->total += offset;
+			written->resolve(StreamAction::Continue);
+		});
+		return written;
+	};
+	Promise<size_t> promise;
+	chunks->stream(consumer)
+		->then(
+			[this, writer, promise] (size_t) {
+				/* Empty streams still create the file */
+				loop.push(pool, [writer, promise] (EventLoop&) {
+					if (auto error = writer->open()) {
+						promise->reject(error);
+					} else {
+						promise->resolve(writer->total);
+					}
+				});
+			},
+			[promise] (exception_ptr error) {
+				promise->reject(error);
+			});
+	return promise;
+}
+
+}
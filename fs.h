@@ -1,22 +1,71 @@
 #pragma once
+#include <cstddef>
+#include <string>
 #include <vector>
-#include <functional>
-#include <exception>
-#include <stdio.h>
-#include <dirent.h>
-#include <sys/types.h>
 #include "event_loop.h"
+#include "promise.h"
+#include "promise_stream.h"
+#include "buffer_pool.h"
 
 namespace kaiu {
 
-/*class FileSystem {
+/*
+ * Asynchronous filesystem operations.
+ *
+ * Blocking system calls are made in a pool of the event loop (io_local by
+ * default), one block or chunk per event, so a huge directory or file does
+ * not monopolise a pool thread.  Only one block/chunk of any operation is in
+ * flight at a time, so data is written to streams in order.
+ *
+ * Returning StreamAction::Stop from a stream consumer stops the producer
+ * before it reads the next block.
+ *
+ * The event loop must outlive the FileSystem, and the FileSystem must outlive
+ * any operations started from it.
+ */
+class FileSystem {
 public:
-	FileSystem(AbstractEventLoop& loop);
-	void read_dir(std::function<bool(std::string)> callback);
-	void read_dir(size_t block_size, std::function<bool(std::vector<std::string>)> callback);
-
+	FileSystem(const FileSystem&) = delete;
+	FileSystem& operator =(const FileSystem&) = delete;
+	/*
+	 * File chunks are chunk_size bytes, taken from a pool of at most
+	 * max_buffers buffers (zero for no limit).  A file reader waits for the
+	 * consumer to release a chunk when all buffers are in use, so memory
+	 * held by a file read is bounded by chunk_size * max_buffers.
+	 */
+	explicit FileSystem(EventLoop& loop,
+		const EventLoopPool pool = EventLoopPool::io_local,
+		const size_t chunk_size = 65536, const size_t max_buffers = 16);
+	/*
+	 * Stream the names of the entries of a directory (excluding "." and
+	 * ".."), in blocks of up to block_size names.  Resolves to the number of
+	 * names streamed.  The next block is read once the consumer has taken the
+	 * previous one.
+	 */
+	PromiseStream<size_t, std::vector<std::string>> read_dir(const std::string& path, const size_t block_size = 1024);
+	/*
+	 * Stream the contents of a file in chunks.  Resolves to the number of
+	 * bytes streamed.  Drop (or release) each chunk when done with it, so its
+	 * buffer can be reused for the next chunk.
+	 */
+	PromiseStream<size_t, Buffer> read_file(const std::string& path);
+	/*
+	 * Create/truncate a file and write chunks from a stream to it, in order.
+	 * Resolves to the number of bytes written once the stream has resolved and
+	 * all chunks are written.
+	 */
+	Promise<size_t> write_file(const std::string& path, PromiseStream<size_t, Buffer> chunks);
+	/* Chunks for writing, so callers can fill pooled buffers */
+	BufferPool& buffers();
 private:
-	AbstractEventLoop& loop;
-};*/
+	struct DirReader;
+	struct FileReader;
+	struct FileWriter;
+	EventLoop& loop;
+	const EventLoopPool pool;
+	BufferPool buffer_pool;
+	void do_read_dir(std::shared_ptr<DirReader> reader);
+	void do_read_file(std::shared_ptr<FileReader> reader);
+};
 
 }
@@ -0,0 +1,433 @@
+#include <system_error>
+#include <stdexcept>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <cstdint>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <linux/io_uring.h>
+#include "io_engine.h"
+
+namespace kaiu {
+
+using namespace std;
+
+static exception_ptr errno_error(const char *what, const int error = errno)
+{
+	return make_exception_ptr(system_error(error, system_category(), what));
+}
+
+/* read(2) and write(2) transfer at most this much at once anyway */
+static const size_t max_transfer = 0x7ffff000;
+
+/* user_data of internal submissions, requests are pointers so never collide */
+static const uint64_t wake_tag = 0;
+static const uint64_t cancel_tag = 1;
+
+/*** Ring ***/
+
+/*
+ * Submission/completion rings shared with the kernel.  Only the engine thread
+ * touches the rings, so the only synchronisation needed is with the kernel:
+ * release our tails/heads, acquire the kernel's.
+ */
+struct IoEngine::Ring {
+	explicit Ring(const unsigned entries);
+	~Ring();
+	void release();
+	/* Next free submission entry (zeroed), or nullptr if the queue is full */
+	io_uring_sqe *get_sqe();
+	/* Submit all prepared entries, wait for at least one completion */
+	void enter();
+	void wake();
+	int fd{-1};
+	int wake_fd{-1};
+	uint64_t wake_value{0};
+	bool wake_armed{false};
+	bool cancelled{false};
+	unsigned sq_entries{0};
+	void *sq_map{MAP_FAILED};
+	void *cq_map{MAP_FAILED};
+	void *sqe_map{MAP_FAILED};
+	size_t sq_map_size{0};
+	size_t cq_map_size{0};
+	size_t sqe_map_size{0};
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	io_uring_sqe *sqes;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	io_uring_cqe *cqes;
+};
+
+IoEngine::Ring::Ring(const unsigned entries)
+{
+	io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	fd = syscall(__NR_io_uring_setup, entries, &params);
+	if (fd < 0) {
+		throw system_error(errno, system_category(), "io_uring_setup");
+	}
+	try {
+		/* IORING_OP_READ/WRITE and offset -1 arrived together (Linux 5.6) */
+		if (!(params.features & IORING_FEAT_RW_CUR_POS)) {
+			throw system_error(ENOSYS, system_category(), "io_uring: kernel too old");
+		}
+		sq_entries = params.sq_entries;
+		sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+		cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+		const bool single_map = params.features & IORING_FEAT_SINGLE_MMAP;
+		if (single_map) {
+			sq_map_size = cq_map_size = max(sq_map_size, cq_map_size);
+		}
+		sq_map = mmap(nullptr, sq_map_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+		if (sq_map == MAP_FAILED) {
+			throw system_error(errno, system_category(), "io_uring mmap");
+		}
+		if (!single_map) {
+			cq_map = mmap(nullptr, cq_map_size, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+			if (cq_map == MAP_FAILED) {
+				throw system_error(errno, system_category(), "io_uring mmap");
+			}
+		}
+		sqe_map_size = params.sq_entries * sizeof(io_uring_sqe);
+		sqe_map = mmap(nullptr, sqe_map_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+		if (sqe_map == MAP_FAILED) {
+			throw system_error(errno, system_category(), "io_uring mmap");
+		}
+		wake_fd = eventfd(0, EFD_CLOEXEC);
+		if (wake_fd < 0) {
+			throw system_error(errno, system_category(), "eventfd");
+		}
+	} catch (...) {
+		release();
+		throw;
+	}
+	auto sq = static_cast<char *>(sq_map);
+	auto cq = static_cast<char *>(cq_map == MAP_FAILED ? sq_map : cq_map);
+	sq_head = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+	sq_tail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+	sq_mask = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+	sq_array = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+	sqes = static_cast<io_uring_sqe *>(sqe_map);
+	cq_head = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+	cq_tail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+	cq_mask = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+	cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+}
+
+IoEngine::Ring::~Ring()
+{
+	release();
+}
+
+void IoEngine::Ring::release()
+{
+	if (sqe_map != MAP_FAILED) {
+		munmap(sqe_map, sqe_map_size);
+	}
+	if (cq_map != MAP_FAILED) {
+		munmap(cq_map, cq_map_size);
+	}
+	if (sq_map != MAP_FAILED) {
+		munmap(sq_map, sq_map_size);
+	}
+	sqe_map = cq_map = sq_map = MAP_FAILED;
+	if (wake_fd >= 0) {
+		::close(wake_fd);
+	}
+	if (fd >= 0) {
+		::close(fd);
+	}
+	wake_fd = fd = -1;
+}
+
+io_uring_sqe *IoEngine::Ring::get_sqe()
+{
+	const unsigned head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+	const unsigned tail = *sq_tail;
+	if (tail - head >= sq_entries) {
+		return nullptr;
+	}
+	const unsigned index = tail & *sq_mask;
+	io_uring_sqe *sqe = &sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	sq_array[index] = index;
+	__atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+	return sqe;
+}
+
+void IoEngine::Ring::enter()
+{
+	/* Everything not yet consumed by the kernel, including after EINTR */
+	const unsigned to_submit = *sq_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+	const int result = syscall(__NR_io_uring_enter, fd, to_submit, 1,
+		IORING_ENTER_GETEVENTS, nullptr, 0);
+	if (result < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+		throw system_error(errno, system_category(), "io_uring_enter");
+	}
+}
+
+void IoEngine::Ring::wake()
+{
+	const uint64_t one = 1;
+	if (::write(wake_fd, &one, sizeof(one)) < 0) {
+		/* Can only fail if the counter overflows, in which case it's awake */
+	}
+}
+
+/*** IoEngine ***/
+
+IoEngine::IoEngine(ParallelEventLoop& loop, const EventLoopPool pool,
+		const unsigned entries, const Backend backend) :
+	loop(loop), pool(pool)
+{
+	if (backend == Backend::threads) {
+		return;
+	}
+	try {
+		ring.reset(new Ring(max(entries, 2u)));
+	} catch (const system_error&) {
+		if (backend == Backend::uring) {
+			throw;
+		}
+		return;
+	}
+	thread = std::thread(&IoEngine::do_ring_loop, this);
+}
+
+IoEngine::~IoEngine()
+{
+	if (!ring) {
+		return;
+	}
+	{
+		lock_guard<mutex> lock(pending_mutex);
+		stopping = true;
+	}
+	ring->wake();
+	thread.join();
+}
+
+auto IoEngine::backend() const -> Backend
+{
+	return ring ? Backend::uring : Backend::threads;
+}
+
+Promise<size_t> IoEngine::read(const int fd, void *data, const size_t size, const off_t offset)
+{
+	return submit(IORING_OP_READ, fd, data, size, offset);
+}
+
+Promise<size_t> IoEngine::write(const int fd, const void *data, const size_t size, const off_t offset)
+{
+	return submit(IORING_OP_WRITE, fd, const_cast<void *>(data), size, offset);
+}
+
+Promise<size_t> IoEngine::submit(const unsigned char opcode, const int fd, void *data, const size_t size, const off_t offset)
+{
+	Promise<size_t> promise;
+	const size_t length = min(size, max_transfer);
+	if (!ring) {
+		/* Thread-pool backend: a blocking call in the pool */
+		loop.push(pool, [opcode, fd, data, length, offset, promise] (EventLoop&) {
+			ssize_t count;
+			do {
+				if (opcode == IORING_OP_READ) {
+					count = offset < 0 ? ::read(fd, data, length) : pread(fd, data, length, offset);
+				} else {
+					count = offset < 0 ? ::write(fd, data, length) : pwrite(fd, data, length, offset);
+				}
+			} while (count < 0 && errno == EINTR);
+			if (count < 0) {
+				promise->reject(errno_error(opcode == IORING_OP_READ ? "read" : "write"));
+			} else {
+				promise->resolve(size_t(count));
+			}
+		});
+		return promise;
+	}
+	unique_ptr<Request> request(new Request{ opcode, fd, data, unsigned(length), offset, promise });
+	bool wake;
+	{
+		lock_guard<mutex> lock(pending_mutex);
+		if (stopping) {
+			throw logic_error("IoEngine: operation started during destruction");
+		}
+		/* Only the first request of a batch needs to wake the engine thread */
+		wake = pending.empty();
+		pending.emplace_back(move(request));
+	}
+	if (wake) {
+		ring->wake();
+	}
+	return promise;
+}
+
+void IoEngine::do_ring_loop()
+{
+	vector<EventLoop::Event> events;
+	while (true) {
+		io_uring_sqe *sqe;
+		if (!ring->wake_armed && (sqe = ring->get_sqe())) {
+			sqe->opcode = IORING_OP_READ;
+			sqe->fd = ring->wake_fd;
+			sqe->addr = reinterpret_cast<uintptr_t>(&ring->wake_value);
+			sqe->len = sizeof(ring->wake_value);
+			sqe->user_data = wake_tag;
+			ring->wake_armed = true;
+		}
+		bool stop;
+		const bool done = prepare(events, stop) == 0 && stop && in_flight.empty();
+		if (!events.empty()) {
+			loop.push_bulk(pool, move(events));
+			events.clear();
+		}
+		if (done) {
+			break;
+		}
+		/* One system call submits the whole batch and waits for completions */
+		ring->enter();
+		reap(events);
+		if (!events.empty()) {
+			loop.push_bulk(pool, move(events));
+			events.clear();
+		}
+	}
+}
+
+unsigned IoEngine::prepare(vector<EventLoop::Event>& rejected, bool& stop)
+{
+	unsigned count = 0;
+	lock_guard<mutex> lock(pending_mutex);
+	stop = stopping;
+	if (stopping) {
+		const auto error = make_exception_ptr(runtime_error("IoEngine destroyed"));
+		for (auto& request : pending) {
+			rejected.emplace_back([promise = move(request->promise), error] (EventLoop&) {
+				promise->reject(error);
+			});
+		}
+		pending.clear();
+		if (!ring->cancelled) {
+			/* in_flight is capped below the queue size, so these all fit */
+			for (auto *request : in_flight) {
+				io_uring_sqe *sqe = ring->get_sqe();
+				if (!sqe) {
+					return count;
+				}
+				sqe->opcode = IORING_OP_ASYNC_CANCEL;
+				sqe->fd = -1;
+				sqe->addr = reinterpret_cast<uintptr_t>(request);
+				sqe->user_data = cancel_tag;
+				count++;
+			}
+			ring->cancelled = true;
+		}
+		return count;
+	}
+	/*
+	 * Leave a slot for the wake read, and don't let completions outrun the
+	 * completion queue (which is larger than the submission queue).
+	 */
+	auto it = pending.begin();
+	for (; it != pending.end() && in_flight.size() + 1 < ring->sq_entries; ++it) {
+		io_uring_sqe *sqe = ring->get_sqe();
+		if (!sqe) {
+			break;
+		}
+		Request *request = it->release();
+		sqe->opcode = request->opcode;
+		sqe->fd = request->fd;
+		sqe->addr = reinterpret_cast<uintptr_t>(request->data);
+		sqe->len = request->size;
+		sqe->off = request->offset;
+		sqe->user_data = reinterpret_cast<uintptr_t>(request);
+		in_flight.insert(request);
+		count++;
+	}
+	pending.erase(pending.begin(), it);
+	return count;
+}
+
+void IoEngine::reap(vector<EventLoop::Event>& completed)
+{
+	unsigned head = *ring->cq_head;
+	const unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+	for (; head != tail; head++) {
+		const io_uring_cqe& cqe = ring->cqes[head & *ring->cq_mask];
+		if (cqe.user_data == wake_tag) {
+			ring->wake_armed = false;
+			continue;
+		} else if (cqe.user_data == cancel_tag) {
+			continue;
+		}
+		unique_ptr<Request> request(reinterpret_cast<Request *>(cqe.user_data));
+		in_flight.erase(request.get());
+		const int result = cqe.res;
+		const char *what = request->opcode == IORING_OP_READ ? "read" : "write";
+		completed.emplace_back([promise = move(request->promise), result, what] (EventLoop&) {
+			if (result < 0) {
+				promise->reject(errno_error(what, -result));
+			} else {
+				promise->resolve(size_t(result));
+			}
+		});
+	}
+	__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+}
+
+/*** Streams ***/
+
+PromiseStream<size_t, Buffer> IoEngine::read_stream(const int fd, BufferPool& buffers, const off_t offset)
+{
+	PromiseStream<size_t, Buffer> stream;
+	loop.push(pool, [this, fd, &buffers, offset, stream] (EventLoop&) {
+		do_read_stream(fd, buffers, offset, stream, 0);
+	});
+	return stream;
+}
+
+void IoEngine::do_read_stream(const int fd, BufferPool& buffers, const off_t offset, PromiseStream<size_t, Buffer> stream, const size_t total)
+{
+	if (stream->is_stopping()) {
+		stream->resolve(total);
+		return;
+	}
+	Buffer buffer;
+	const bool ready = buffers.take_or_wait(buffer, [this, fd, &buffers, offset, stream, total] {
+		loop.push(pool, [this, fd, &buffers, offset, stream, total] (EventLoop&) {
+			do_read_stream(fd, buffers, offset, stream, total);
+		});
+	});
+	if (!ready) {
+		return;
+	}
+	/* Shared so that the buffer lives until the read completes */
+	auto chunk = make_shared<Buffer>(move(buffer));
+	read(fd, chunk->data(), chunk->capacity(), offset)
+		->then(
+			[this, fd, &buffers, offset, stream, total, chunk] (size_t count) {
+				if (count == 0) {
+					stream->resolve(total);
+					return;
+				}
+				chunk->resize(count);
+				stream->write(move(*chunk));
+				do_read_stream(fd, buffers, offset < 0 ? offset : offset + off_t(count), stream, total + count);
+			},
+			[stream] (exception_ptr error) {
+				stream->reject(error);
+			});
+}
+
+}
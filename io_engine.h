@@ -0,0 +1,99 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <vector>
+#include <unordered_set>
+#include <thread>
+#include <mutex>
+#include <sys/types.h>
+#include "event_loop.h"
+#include "promise.h"
+#include "promise_stream.h"
+#include "buffer_pool.h"
+
+namespace kaiu {
+
+
+/*
+ * Asynchronous I/O engine for files and sockets, built on io_uring.
+ *
+ * Operations may be started from any thread.  They are queued, and one engine
+ * thread submits everything queued since its last submission with a single
+ * io_uring_enter, then collects completions and resolves/rejects their
+ * promises in a pool of the event loop (one push_bulk per set of completions).
+ * No pool thread ever blocks on I/O.
+ *
+ * If io_uring is unavailable (old kernel, disabled by sysctl or seccomp), or
+ * the threads backend is requested, each operation is instead a blocking
+ * system call made in the pool, so the pool size limits concurrency.
+ *
+ * Offset -1 means "current file position", as for read(2)/write(2), and is
+ * required for sockets and pipes.
+ *
+ * The caller must keep buffers valid until the operation completes.  As with
+ * the Reactor, operations in flight are not counted by
+ * ParallelEventLoop::join; the engine must not be destroyed while operations
+ * are being completed in the pool (e.g. destroy it after join).  Operations
+ * still in flight when the engine is destroyed are cancelled and rejected.
+ */
+class IoEngine {
+public:
+	enum class Backend { automatic, uring, threads };
+	IoEngine(const IoEngine&) = delete;
+	IoEngine& operator =(const IoEngine&) = delete;
+	/*
+	 * entries: submission queue size of the ring, which limits how many
+	 * operations are submitted per io_uring_enter.  A uring backend throws
+	 * system_error if the ring cannot be created, automatic falls back to
+	 * threads.
+	 */
+	explicit IoEngine(ParallelEventLoop& loop,
+		const EventLoopPool pool = EventLoopPool::io_local,
+		const unsigned entries = 256, const Backend backend = Backend::automatic);
+	~IoEngine();
+	/* Backend in use (never automatic) */
+	Backend backend() const;
+	/* Read up to size bytes, resolves to bytes read (zero at end of file) */
+	Promise<size_t> read(const int fd, void *data, const size_t size, const off_t offset = -1);
+	/* Write up to size bytes, resolves to bytes written */
+	Promise<size_t> write(const int fd, const void *data, const size_t size, const off_t offset = -1);
+	/*
+	 * Stream from offset to end of file in chunks from the given buffer pool
+	 * (which must outlive the stream).  One read is in flight at a time, and
+	 * at most the pool's max_buffers chunks are held.  Resolves to the number
+	 * of bytes read.
+	 */
+	PromiseStream<size_t, Buffer> read_stream(const int fd, BufferPool& buffers, const off_t offset = 0);
+private:
+	struct Ring;
+	struct Request {
+		unsigned char opcode;
+		int fd;
+		void *data;
+		unsigned size;
+		off_t offset;
+		Promise<size_t> promise;
+	};
+	ParallelEventLoop& loop;
+	const EventLoopPool pool;
+	std::unique_ptr<Ring> ring;
+	/* Queued requests, taken by the engine thread */
+	std::mutex pending_mutex;
+	std::vector<std::unique_ptr<Request>> pending;
+	bool stopping{false};
+	/* Submitted requests, engine thread only */
+	std::unordered_set<Request *> in_flight;
+	std::thread thread;
+	Promise<size_t> submit(const unsigned char opcode, const int fd, void *data, const size_t size, const off_t offset);
+	void do_ring_loop();
+	/*
+	 * Engine thread: move queued requests into the ring, returns count.  When
+	 * stopping, rejects queued requests and cancels those in flight instead.
+	 */
+	unsigned prepare(std::vector<EventLoop::Event>& rejected, bool& stop);
+	/* Engine thread: collect completions */
+	void reap(std::vector<EventLoop::Event>& completed);
+	void do_read_stream(const int fd, BufferPool& buffers, const off_t offset, PromiseStream<size_t, Buffer> stream, const size_t total);
+};
+
+}
@@ -0,0 +1,123 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <utility>
+#include "event_loop.h"
+#include "promise.h"
+#include "task_group.h"
+
+namespace kaiu {
+
+
+namespace promise {
+
+/*
+ * Parallel algorithms over random-access ranges, run in a pool of an event
+ * loop (no threads are created) and returning promises:
+ *
+ *   parallel_transform(loop, EventLoopPool::calculation,
+ *       in.begin(), in.end(), out.begin(), [] (const X& x) { return f(x); })
+ *     ->then(...);
+ *
+ * The range is split in halves recursively, each half being a task in a
+ * TaskGroup, down to chunks which are processed in one go.  How far it is
+ * split adapts to the load: a range is first split into a few chunks per
+ * hardware thread, and a range which another thread picks up (i.e. one which
+ * was waiting while a worker was idle) is split further, so busy pools get few
+ * large chunks and idle workers get smaller ones.  Ranges are never split into
+ * chunks smaller than grain elements (for cheap per-element work, pass a grain
+ * which makes a chunk worth a task).
+ *
+ * The range (and anything that func refers to) must outlive the returned
+ * promise.  If func throws, the promise rejects with the first exception once
+ * the other chunks have completed.
+ */
+
+/* Call func(element) for each element of [first, last) */
+template <typename It, typename Func>
+Promise<std::nullptr_t> parallel_for(
+	EventLoop& loop,
+	const EventLoopPool pool,
+	It first,
+	It last,
+	Func func,
+	const std::size_t grain = 1);
+
+/*
+ * Assign func(element) to the corresponding element of out, resolves to the
+ * end of the output range
+ */
+template <typename InIt, typename OutIt, typename Func>
+Promise<OutIt> parallel_transform(
+	EventLoop& loop,
+	const EventLoopPool pool,
+	InIt first,
+	InIt last,
+	OutIt out,
+	Func func,
+	const std::size_t grain = 1);
+
+/*
+ * Each chunk is reduced from a copy of identity with
+ * accumulate(T, element) -> T, then the chunks' results are reduced in order
+ * with combine(T, T) -> T, which must be associative.  Resolves to identity
+ * for an empty range.
+ */
+template <typename It, typename T, typename Accumulate, typename Combine>
+Promise<T> parallel_reduce(
+	EventLoop& loop,
+	const EventLoopPool pool,
+	It first,
+	It last,
+	T identity,
+	Accumulate accumulate,
+	Combine combine,
+	const std::size_t grain = 1);
+
+}
+
+namespace detail {
+
+/*
+ * Splits a range into tasks of a group, calling chunk(first, last) for each
+ * piece which is not split further
+ */
+template <typename It, typename Chunk>
+class ParallelSplitter : public std::enable_shared_from_this<ParallelSplitter<It, Chunk>> {
+public:
+	ParallelSplitter(EventLoop& loop, const EventLoopPool pool, Chunk chunk, const std::size_t grain);
+	/* Split and process [first, last), resolving once it is all processed */
+	Promise<std::nullptr_t> run(It first, It last);
+private:
+	Chunk chunk;
+	TaskGroup group;
+	const std::size_t grain;
+	/* Process a range, splitting it at most depth times more */
+	void split(It first, It last, unsigned depth, std::thread::id spawner);
+	/* Times to split the whole range, and extra times to split a stolen one */
+	static unsigned initial_depth();
+	static constexpr unsigned stolen_depth = 2;
+};
+
+/* Results of reduced chunks, keyed by the offset of the chunk */
+template <typename T>
+class ParallelResults {
+public:
+	void add(const std::size_t offset, T result);
+	template <typename Combine>
+	T combine(T identity, Combine& combine);
+private:
+	std::mutex lock;
+	std::vector<std::pair<std::size_t, T>> results;
+};
+
+}
+
+}
+
+#ifndef parallel_tcc
+#include "parallel.tcc"
+#endif
@@ -0,0 +1,173 @@
+#define parallel_tcc
+#include <algorithm>
+#include <iterator>
+#include "parallel.h"
+
+namespace kaiu {
+
+
+namespace detail {
+
+/*** ParallelSplitter ***/
+
+template <typename It, typename Chunk>
+ParallelSplitter<It, Chunk>::ParallelSplitter(EventLoop& loop, const EventLoopPool pool, Chunk chunk, const std::size_t grain) :
+	chunk(std::move(chunk)), group(loop, pool), grain(std::max<std::size_t>(grain, 1))
+{
+}
+
+template <typename It, typename Chunk>
+Promise<std::nullptr_t> ParallelSplitter<It, Chunk>::run(It first, It last)
+{
+	if (first != last) {
+		auto self = this->shared_from_this();
+		const unsigned depth = initial_depth();
+		group.spawn([self, first, last, depth] (EventLoop&) {
+			self->split(first, last, depth, std::thread::id());
+		});
+	}
+	return group.join();
+}
+
+template <typename It, typename Chunk>
+void ParallelSplitter<It, Chunk>::split(It first, It last, unsigned depth, const std::thread::id spawner)
+{
+	const auto self_id = std::this_thread::get_id();
+	if (spawner != std::thread::id() && spawner != self_id) {
+		depth += stolen_depth;
+	}
+	/* Keep the left half, so the right halves are left for other workers */
+	while (depth > 0 && std::size_t(last - first) >= 2 * grain) {
+		depth--;
+		const It middle = first + (last - first) / 2;
+		auto self = this->shared_from_this();
+		group.spawn([self, middle, last, depth, self_id] (EventLoop&) {
+			self->split(middle, last, depth, self_id);
+		});
+		last = middle;
+	}
+	chunk(first, last);
+}
+
+template <typename It, typename Chunk>
+unsigned ParallelSplitter<It, Chunk>::initial_depth()
+{
+	/* About four chunks per hardware thread */
+	const unsigned threads = std::max(std::thread::hardware_concurrency(), 1u);
+	unsigned depth = 2;
+	while ((1u << depth) < 4 * threads) {
+		depth++;
+	}
+	return depth;
+}
+
+/*** ParallelResults ***/
+
+template <typename T>
+void ParallelResults<T>::add(const std::size_t offset, T result)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	results.emplace_back(offset, std::move(result));
+}
+
+template <typename T>
+template <typename Combine>
+T ParallelResults<T>::combine(T identity, Combine& combine)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	if (results.empty()) {
+		return identity;
+	}
+	std::sort(results.begin(), results.end(),
+		[] (const std::pair<std::size_t, T>& a, const std::pair<std::size_t, T>& b) {
+			return a.first < b.first;
+		});
+	T result = std::move(results.front().second);
+	for (auto it = std::next(results.begin()); it != results.end(); ++it) {
+		result = combine(std::move(result), std::move(it->second));
+	}
+	results.clear();
+	return result;
+}
+
+template <typename It, typename Chunk>
+std::shared_ptr<ParallelSplitter<It, Chunk>> make_parallel_splitter(
+	EventLoop& loop, const EventLoopPool pool, Chunk chunk, const std::size_t grain)
+{
+	return std::make_shared<ParallelSplitter<It, Chunk>>(loop, pool, std::move(chunk), grain);
+}
+
+}
+
+namespace promise {
+
+template <typename It, typename Func>
+Promise<std::nullptr_t> parallel_for(
+	EventLoop& loop,
+	const EventLoopPool pool,
+	It first,
+	It last,
+	Func func,
+	const std::size_t grain)
+{
+	auto chunk = [func] (It first, It last) {
+		for (; first != last; ++first) {
+			func(*first);
+		}
+	};
+	return detail::make_parallel_splitter<It>(loop, pool, std::move(chunk), grain)
+		->run(first, last);
+}
+
+template <typename InIt, typename OutIt, typename Func>
+Promise<OutIt> parallel_transform(
+	EventLoop& loop,
+	const EventLoopPool pool,
+	InIt first,
+	InIt last,
+	OutIt out,
+	Func func,
+	const std::size_t grain)
+{
+	auto chunk = [first, out, func] (InIt begin, InIt end) {
+		OutIt it = out + (begin - first);
+		for (; begin != end; ++begin, ++it) {
+			*it = func(*begin);
+		}
+	};
+	const OutIt out_end = out + (last - first);
+	return detail::make_parallel_splitter<InIt>(loop, pool, std::move(chunk), grain)
+		->run(first, last)
+		->then([out_end] (std::nullptr_t) { return out_end; });
+}
+
+template <typename It, typename T, typename Accumulate, typename Combine>
+Promise<T> parallel_reduce(
+	EventLoop& loop,
+	const EventLoopPool pool,
+	It first,
+	It last,
+	T identity,
+	Accumulate accumulate,
+	Combine combine,
+	const std::size_t grain)
+{
+	auto results = std::make_shared<detail::ParallelResults<T>>();
+	auto chunk = [first, identity, accumulate, results] (It begin, It end) {
+		const std::size_t offset = begin - first;
+		T result = identity;
+		for (; begin != end; ++begin) {
+			result = accumulate(std::move(result), *begin);
+		}
+		results->add(offset, std::move(result));
+	};
+	return detail::make_parallel_splitter<It>(loop, pool, std::move(chunk), grain)
+		->run(first, last)
+		->then([results, identity, combine] (std::nullptr_t) mutable {
+			return results->combine(std::move(identity), combine);
+		});
+}
+
+}
+
+}
@@ -39,10 +39,15 @@ PromiseStateBase::~PromiseStateBase() noexcept(false)
 	 * Don't throw if stack is being unwound, it'll prevent catch blocks from
 	 * being run and will generally ruin your debugging experience.
 	 */
+#if __cplusplus >= 201703L
+	if (std::uncaught_exceptions() > 0) {
+#else
 	if (std::uncaught_exception()) {
+#endif
 		return;
 	}
-	if (callbacks_assigned && state != promise_state::completed) {
+	const unsigned flags = state.load(memory_order_acquire);
+	if ((flags & bound) && !(flags & completed)) {
 		/* Bound but not completed */
 		throw logic_error("Promise destructor called on bound but uncompleted promise");
 	}
@@ -51,9 +56,9 @@ PromiseStateBase::~PromiseStateBase() noexcept(false)
 
 void PromiseStateBase::reject(exception_ptr error)
 {
-	auto lock = get_lock();
-	set_error(lock, error);
-	set_state(lock, promise_state::rejected);
+	claim_settle();
+	set_error(error);
+	publish(rejected);
 }
 
 void PromiseStateBase::reject(const string& error)
@@ -61,111 +66,92 @@ void PromiseStateBase::reject(const string& error)
 	reject(make_exception_ptr(runtime_error(error)));
 }
 
-void PromiseStateBase::set_callbacks(ensure_locked lock, function<void(ensure_locked)> resolve, function<void(ensure_locked)> reject)
+void PromiseStateBase::claim_settle()
 {
-#if defined(SAFE_PROMISES)
-	if (callbacks_assigned) {
-		throw logic_error("Attempted to double-bind to promise");
+	/*
+	 * Checked in all builds: a second producer would otherwise overwrite the
+	 * result while the consumer may be reading it.
+	 */
+	if (state.fetch_or(settle_claimed, memory_order_relaxed) & settle_claimed) {
+		throw logic_error("Cannot resolve/reject promise: it is already resolved/rejected");
 	}
-	if (!resolve || !reject) {
+}
+
+void PromiseStateBase::set_callback(Callback callback)
+{
+#if defined(SAFE_PROMISES)
+	if (!callback) {
 		throw logic_error("Attempted to bind null callback");
 	}
 #endif
-	on_resolve = resolve;
-	on_reject = reject;
-	callbacks_assigned = true;
-	update_state(lock);
+	if (state.fetch_or(bind_claimed, memory_order_relaxed) & bind_claimed) {
+		throw logic_error("Attempted to double-bind to promise");
+	}
+	on_complete = move(callback);
+	publish(bound);
 }
 
-void PromiseStateBase::set_state(ensure_locked lock, const promise_state next_state)
+void PromiseStateBase::publish(const state_bits bit)
 {
-#if defined(SAFE_PROMISES)
-	/* Validate transition */
-	switch (next_state) {
-	case promise_state::pending:
-		throw logic_error("Cannot explicitly mark a promise as pending");
-	case promise_state::rejected:
-	case promise_state::resolved:
-		if (state == promise_state::pending) {
-			make_immortal(lock);
-			break;
-		}
-		if (state == next_state) {
-			break;
-		}
-		throw logic_error("Cannot resolve/reject promise: it is already resolved/rejected");
-	case promise_state::completed:
-		if (state == promise_state::rejected || state == promise_state::resolved) {
-			break;
-		}
-		throw logic_error("Cannot mark promise as completed: promise has not been resolved/rejected");
-	default:
-		throw logic_error("Invalid state");
+	/* Release our data, acquire the other side's */
+	const unsigned flags = state.fetch_or(bit, memory_order_acq_rel) | bit;
+	const bool settled = flags & (resolved | rejected);
+	if (settled && (flags & bound)) {
+		complete(flags);
 	}
-#endif
-	/* Apply transition */
-	state = next_state;
-	update_state(lock);
 }
 
-void PromiseStateBase::update_state(ensure_locked lock)
+void PromiseStateBase::complete(const unsigned flags)
 {
 	/*
-	 * After unlock_self(), this instance may be destroyed.  Hence, we must not
-	 * do anything that accesses *this after calling unlock_self().
-	 * Consequently, any method which calls update_state(...) or set_state()
-	 * must not access *this after that call.
+	 * Only this thread can reach here, so the callback is ours.  Move it out
+	 * so that its captures are released once it has run.  The callback may
+	 * release the last handle, so hold a reference until we are done.
 	 */
-	switch (state) {
-	case promise_state::pending:
-		break;
-	case promise_state::rejected:
-		if (callbacks_assigned) {
-			auto callback = on_reject;
-			callback(lock);
-			set_state(lock, promise_state::completed);
-		}
-		break;
-	case promise_state::resolved:
-		if (callbacks_assigned) {
-			auto callback = on_resolve;
-			callback(lock);
-			set_state(lock, promise_state::completed);
-		}
-		break;
-	case promise_state::completed:
-		on_resolve = nullptr;
-		on_reject = nullptr;
-		make_mortal(lock);
-		break;
+	add_ref();
+	auto callback = move(on_complete);
+	try {
+		callback(flags & rejected);
+	} catch (...) {
+		state.fetch_or(completed, memory_order_release);
+		release();
+		throw;
+	}
+	state.fetch_or(completed, memory_order_release);
+	release();
+}
+
+void PromiseStateBase::release()
+{
+	/* Release our accesses, and the last one out acquires everyone else's */
+	if (refs.fetch_sub(1, memory_order_release) == 1) {
+		atomic_thread_fence(memory_order_acquire);
+		dispose();
 	}
 }
 
-void PromiseStateBase::set_error(ensure_locked lock, exception_ptr error)
+void PromiseStateBase::set_error(exception_ptr error)
 {
 	this->error = error;
 }
 
-exception_ptr PromiseStateBase::get_error(ensure_locked) const
+exception_ptr PromiseStateBase::get_error() const
 {
 	return error;
 }
 
-void PromiseStateBase::set_terminator(ensure_locked lock)
+void PromiseStateBase::set_terminator()
 {
-	set_callbacks(lock,
-		[] (ensure_locked) {},
-		[this] (ensure_locked) {
-			if (error) {
-				rethrow_exception(error);
-			}
-		});
+	set_callback([this] (const bool rejected) {
+		if (rejected && error) {
+			rethrow_exception(error);
+		}
+	});
 }
 
 void PromiseStateBase::finish()
 {
-	auto lock = get_lock();
-	set_terminator(lock);
+	set_terminator();
 }
 
 /*** Utils ***/
@@ -1,5 +1,6 @@
 #pragma once
 #include <functional>
+#include <atomic>
 #include <exception>
 #include <cstddef>
 #include <mutex>
@@ -7,14 +8,22 @@
 #include <type_traits>
 #include <vector>
 #include <tuple>
-#include "self_managing.h"
+#include "small_function.h"
+#include "slab_pool.h"
+#include "cancellation.h"
 
 #if defined(DEBUG)
 #define SAFE_PROMISES
 #endif
 
+#if !defined(MALLOC_PROMISES)
+#define POOLED_PROMISES
+#endif
+
 #include "promise/fwd.h"
 #include "promise/traits.h"
+#include "promise/callbacks.h"
+#include "promise/allocation.h"
 #include "promise/factories.h"
 #include "promise/combiners.h"
 #include "promise/callback_pack.h"
@@ -39,25 +48,35 @@ public:
 	using result_type = DResult;
 	/* Promise */
 	Promise();
+	/* Promise whose state is allocated by the given allocator */
+	template <typename Alloc>
+	Promise(std::allocator_arg_t, const Alloc& alloc);
 	/* Copy/move/cast constructors */
 	Promise(const Promise<DResult>&);
 	Promise(const Promise<DResult&>&);
 	Promise(const Promise<DResult&&>&);
-	Promise(Promise<Result>&&) = default;
+	Promise(Promise<Result>&&) noexcept;
 	/* Assignment */
-	Promise<Result>& operator =(Promise<Result>&&) = default;
-	Promise<Result>& operator =(const Promise<Result>&) = default;
+	Promise<Result>& operator =(Promise<Result>&&) noexcept;
+	Promise<Result>& operator =(const Promise<Result>&);
+	~Promise();
 	/* Access promise state (then/except/finally/resolve/reject) */
 	PromiseState<DResult> *operator ->() const;
 private:
 	friend class Promise<DResult>;
 	friend class Promise<DResult&>;
 	friend class Promise<DResult&&>;
+	template <typename> friend class PromiseState;
 	static_assert(!std::is_void<DResult>::value, "Void promises are no longer supported");
 	static_assert(!std::is_same<DResult, std::exception_ptr>::value, "Promise result type cannot be std::exception_ptr");
 	static_assert(!is_promise<DResult>::value, "Promise<Promise<T>> is invalid, use Promise<T>/forward_to instead");
-	Promise(std::shared_ptr<PromiseState<DResult>> const promise);
-	std::shared_ptr<PromiseState<DResult>> promise;
+	/* Share a state (or none, if null) */
+	Promise(PromiseState<DResult> * const promise);
+	/*
+	 * The state is reference counted intrusively, so a handle is one pointer
+	 * and copying it touches only the state's own counter.
+	 */
+	PromiseState<DResult> *promise;
 };
 
 static_assert(is_promise<Promise<int>>::value, "Promise traits test #1 failed");
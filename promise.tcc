@@ -60,13 +60,13 @@ callback_pack<Range, Domain>::callback_pack(const Next next, const Handler handl
 /*** PromiseState ***/
 
 template <typename Result>
-void PromiseState<Result>::set_result(ensure_locked lock, Result&& value)
+void PromiseState<Result>::set_result(Result&& value)
 {
 	result = std::move(value);
 }
 
 template <typename Result>
-Result PromiseState<Result>::get_result(ensure_locked lock)
+Result PromiseState<Result>::get_result()
 {
 	return std::move(result);
 }
@@ -74,23 +74,22 @@ Result PromiseState<Result>::get_result(ensure_locked lock)
 template <typename Result>
 void PromiseState<Result>::resolve(Result result)
 {
-	auto lock = get_lock();
-	set_result(lock, std::move(result));
-	set_state(lock, promise_state::resolved);
+	claim_settle();
+	set_result(std::move(result));
+	publish(resolved);
 }
 
 template <typename Result>
 template <typename NextPromise>
 void PromiseState<Result>::forward_to(NextPromise next)
 {
-	auto lock = get_lock();
-	auto resolve = [next, this] (ensure_locked lock) {
-		next->resolve(std::move(get_result(lock)));
-	};
-	auto reject = [next, this] (ensure_locked lock) {
-		next->reject(get_error(lock));
-	};
-	set_callbacks(lock, resolve, reject);
+	set_callback([next, this] (const bool rejected) {
+		if (rejected) {
+			next->reject(get_error());
+		} else {
+			next->resolve(std::move(get_result()));
+		}
+	});
 }
 
 template <typename Result>
@@ -108,65 +107,50 @@ Promise<NextResult> PromiseState<Result>::then(
 	Except except_func,
 	Finally finally_func)
 {
-	auto lock = get_lock();
-	NextPromise promise;
-	NextFunc<NextPromise> next(next_func);
-	ExceptFunc<NextPromise> handler(except_func);
-	FinallyFunc finally(finally_func);
-	if (next == nullptr) {
-		next = PromiseState<Result>::default_next<NextResult>;
-	}
-	if (handler == nullptr) {
-		handler = PromiseState<Result>::default_except<NextResult>;
-	}
-	if (finally == nullptr) {
-		finally = PromiseState<Result>::default_finally;
-	}
-	/*
-	 * Finally is called at the end of both branches (resolve and reject).
-	 *
-	 * Returns false iff the finally() callback threw.
-	 */
-	auto call_finally = [promise, finally] {
+	Promise<NextResult> promise;
+	auto callback = [
+			promise, this,
+			next = detail::optional_callback(next_func),
+			handler = detail::optional_callback(except_func),
+			finally = detail::optional_callback(finally_func)
+		] (const bool rejected) mutable {
+		/* Null handle, only assigned if a callback produces a promise */
+		NextPromise next_promise{nullptr};
+		std::exception_ptr error;
 		try {
-			finally();
+			if (rejected && !detail::has_callback(handler)) {
+				/*
+				 * No handler: pass the rejection on as it is.  Only errors
+				 * thrown by user code ever reach the catch block.
+				 */
+				error = get_error();
+			} else if (rejected) {
+				next_promise = detail::call_callback<NextPromise>(handler, get_error());
+			} else if (detail::has_callback(next)) {
+				next_promise = detail::call_callback<NextPromise>(next, get_result());
+			} else {
+				next_promise = promise::resolved<NextResult>(forward_result<NextResult>(get_result()));
+			}
 		} catch (...) {
-			promise->reject(std::current_exception());
-			return false;
+			error = std::current_exception();
 		}
-		return true;
-	};
-	/* Branch for if promise is resolved */
-	auto resolve = [promise, next, call_finally, this] (ensure_locked lock) {
-		Promise<NextResult> nextResult;
-		try {
-			nextResult = next(get_result(lock));
-		} catch (...) {
-			if (call_finally()) {
+		/* If finally throws, its error replaces the result */
+		if (detail::has_callback(finally)) {
+			try {
+				detail::call_callback<void>(finally);
+			} catch (...) {
 				promise->reject(std::current_exception());
+				return;
 			}
-			return;
 		}
-		if (call_finally()) {
-			nextResult->forward_to(promise);
+		/* Outside of the try blocks, errors downstream are not ours */
+		if (error) {
+			promise->reject(error);
+		} else {
+			next_promise->forward_to(promise);
 		}
 	};
-	/* Branch for if promise is rejected */
-	auto reject = [promise, handler, call_finally, this] (ensure_locked lock) {
-		Promise<NextResult> nextResult;
-		try {
-			nextResult = handler(get_error(lock));
-		} catch (...) {
-			if (call_finally()) {
-				promise->reject(std::current_exception());
-			}
-			return;
-		}
-		if (call_finally()) {
-			nextResult->forward_to(promise);
-		}
-	};
-	set_callbacks(lock, resolve, reject);
+	set_callback(std::move(callback));
 	return promise;
 }
 
@@ -177,10 +161,52 @@ Promise<NextResult> PromiseState<Result>::then(
 	const Except except_func,
 	const Finally finally_func)
 {
-	return then(
-		promise::factory(NextFunc<NextResult>(next_func)),
-		promise::factory(ExceptFunc<NextResult>(except_func)),
-		finally_func);
+	/*
+	 * The value is written straight into the next promise, so a link costs
+	 * one state allocation (plus one for the callback if its captures don't
+	 * fit inline), with no intermediate promise and no std::function.
+	 */
+	Promise<NextResult> promise;
+	auto callback = [
+			promise, this,
+			next = detail::optional_callback(next_func),
+			handler = detail::optional_callback(except_func),
+			finally = detail::optional_callback(finally_func)
+		] (const bool rejected) mutable {
+		NextResult value{};
+		std::exception_ptr error;
+		try {
+			if (rejected && !detail::has_callback(handler)) {
+				/* No handler: pass the rejection on */
+				error = get_error();
+			} else if (rejected) {
+				value = detail::call_callback<NextResult>(handler, get_error());
+			} else if (detail::has_callback(next)) {
+				value = detail::call_callback<NextResult>(next, get_result());
+			} else {
+				value = forward_result<NextResult>(get_result());
+			}
+		} catch (...) {
+			error = std::current_exception();
+		}
+		/* If finally throws, its error replaces the result */
+		if (detail::has_callback(finally)) {
+			try {
+				detail::call_callback<void>(finally);
+			} catch (...) {
+				promise->reject(std::current_exception());
+				return;
+			}
+		}
+		/* Outside of the try blocks, errors downstream are not ours */
+		if (error) {
+			promise->reject(error);
+		} else {
+			promise->resolve(std::move(value));
+		}
+	};
+	set_callback(std::move(callback));
+	return promise;
 }
 
 template <typename Result>
@@ -190,20 +216,38 @@ void PromiseState<Result>::then(
 	const Except except_func,
 	const Finally finally_func)
 {
-	NextFunc<nullptr_t> then_forward = [next_func] (Result result) {
-		if (NextVoidFunc(next_func) != nullptr) {
-			next_func(std::move(result));
+	/*
+	 * Bound directly, with no terminator promise: errors thrown by the
+	 * callbacks propagate to whoever completed this promise, as they would
+	 * from a terminator.  A rejection without a handler ends here.
+	 */
+	auto callback = [
+			this,
+			next = detail::optional_callback(next_func),
+			handler = detail::optional_callback(except_func),
+			finally = detail::optional_callback(finally_func)
+		] (const bool rejected) mutable {
+		std::exception_ptr error;
+		try {
+			if (rejected) {
+				if (detail::has_callback(handler)) {
+					detail::call_callback<void>(handler, get_error());
+				}
+			} else if (detail::has_callback(next)) {
+				detail::call_callback<void>(next, get_result());
+			}
+		} catch (...) {
+			error = std::current_exception();
 		}
-		return (nullptr_t) nullptr;
-	};
-	ExceptFunc<nullptr_t> except_forward = [except_func] (std::exception_ptr error) {
-		if (ExceptVoidFunc(except_func) != nullptr) {
-			except_func(error);
+		/* If finally throws, its error replaces the callback's */
+		if (detail::has_callback(finally)) {
+			detail::call_callback<void>(finally);
+		}
+		if (error) {
+			std::rethrow_exception(error);
 		}
-		return (nullptr_t) nullptr;
 	};
-	then(then_forward, except_forward, finally_func)
-		->finish();
+	set_callback(std::move(callback));
 }
 
 template <typename Result>
@@ -220,25 +264,6 @@ NextResult PromiseState<Result>::forward_result(Result result)
 	throw std::logic_error("If promise <A> is followed by promise <B>, but promise <A> has no 'next' callback, then promise <A> must produce exact same data-type as promise <B>.");
 }
 
-template <typename Result>
-template <typename NextResult>
-Promise<NextResult> PromiseState<Result>::default_next(Result result)
-{
-	return promise::resolved<NextResult>(forward_result<NextResult>(std::move(result)));
-}
-
-template <typename Result>
-template <typename NextResult>
-Promise<NextResult> PromiseState<Result>::default_except(std::exception_ptr error)
-{
-	std::rethrow_exception(error);
-}
-
-template <typename Result>
-void PromiseState<Result>::default_finally()
-{
-}
-
 /*** Promise ***/
 
 /* Access promise */
@@ -246,26 +271,37 @@ void PromiseState<Result>::default_finally()
 template <typename Result>
 auto Promise<Result>::operator ->() const -> PromiseState<DResult> *
 {
-	return promise.get();
+	return promise;
 }
 
 /* Constructor for sharing state with another promise */
 
 template <typename Result>
-Promise<Result>::Promise(std::shared_ptr<PromiseState<DResult>> const state) :
+Promise<Result>::Promise(PromiseState<DResult> * const state) :
 	promise(state)
 {
+	if (promise) {
+		promise->add_ref();
+	}
 }
 
-/* Constructor for creating a new state */
+/* Constructor for creating a new state (which starts with one reference) */
 
 template <typename Result>
 Promise<Result>::Promise() :
-	promise(std::make_shared<PromiseState<DResult>>())
+	promise(detail::allocate_state<PromiseState<DResult>>(
+		detail::state_allocator<PromiseState<DResult>>()))
 {
 }
 
-/* Cast/copy constructors */
+template <typename Result>
+template <typename Alloc>
+Promise<Result>::Promise(std::allocator_arg_t, const Alloc& alloc) :
+	promise(detail::allocate_state<PromiseState<DResult>>(alloc))
+{
+}
+
+/* Cast/copy/move constructors */
 
 template <typename Result>
 Promise<Result>::Promise(const Promise<DResult>& p) :
@@ -285,6 +321,40 @@ Promise<Result>::Promise(const Promise<DResult&&>& p) :
 {
 }
 
+template <typename Result>
+Promise<Result>::Promise(Promise<Result>&& p) noexcept :
+	promise(p.promise)
+{
+	p.promise = nullptr;
+}
+
+/* Assignment */
+
+template <typename Result>
+Promise<Result>& Promise<Result>::operator =(Promise<Result>&& p) noexcept
+{
+	std::swap(promise, p.promise);
+	return *this;
+}
+
+template <typename Result>
+Promise<Result>& Promise<Result>::operator =(const Promise<Result>& p)
+{
+	Promise<Result> copy(p);
+	std::swap(promise, copy.promise);
+	return *this;
+}
+
+/* Destructor */
+
+template <typename Result>
+Promise<Result>::~Promise()
+{
+	if (promise) {
+		promise->release();
+	}
+}
+
 /*** Utils ***/
 namespace promise {
 
@@ -340,43 +410,33 @@ Factory<Result, Args...> factory(std::function<Result(Args...)> func)
 
 /*** Combine multiple heterogenous promises into one promise ***/
 
-/* State object, shared between callbacks on all promises */
+/*
+ * State object, shared between callbacks on all promises.  Each promise
+ * writes only its own element of the results, so no lock is needed: the last
+ * finalizer to run (by the countdown) sees every result, and any rejection
+ * sets "failed" before its own finalizer counts down.
+ */
 template <typename NextResult>
 struct HeterogenousCombineState {
-	std::mutex state_lock;
 	Promise<NextResult> nextPromise;
 	NextResult results;
-	size_t remaining = std::tuple_size<NextResult>::value;
-	bool failed = false;
+	std::atomic<size_t> remaining{std::tuple_size<NextResult>::value};
+	std::atomic<bool> failed{false};
 	template <typename Result, const size_t index>
 	void next(Result result)
 	{
-		std::lock_guard<std::mutex> lock(state_lock);
-		if (failed) {
-			return;
-		}
 		std::get<index>(results) = std::move(result);
 	}
 	void handler(std::exception_ptr error)
 	{
-		{
-			std::lock_guard<std::mutex> lock(state_lock);
-			if (failed) {
-				return;
-			}
-			failed = true;
+		if (!failed.exchange(true, std::memory_order_relaxed)) {
+			nextPromise->reject(error);
 		}
-		nextPromise->reject(error);
 	}
 	void finally()
 	{
-		bool resolved;
-		{
-			std::lock_guard<std::mutex> lock(state_lock);
-			remaining--;
-			resolved = remaining == 0 && !failed;
-		}
-		if (resolved) {
+		if (remaining.fetch_sub(1, std::memory_order_acq_rel) == 1 &&
+				!failed.load(std::memory_order_relaxed)) {
 			nextPromise->resolve(std::move(results));
 		}
 	}
@@ -408,7 +468,7 @@ Promise<std::tuple<typename std::decay<Result>::type...>> combine(Promise<Result
 	/* Convert promise pack to tuple */
 	auto promises = std::make_tuple(std::forward<Promise<Result>>(promise)...);
 	/* State */
-	auto state = std::make_shared<HeterogenousCombineState<NextResult>>();
+	auto state = detail::make_state<HeterogenousCombineState<NextResult>>();
 	/* Template metaprogramming "dynamically typed" functional fun */
 	tuple_each_with_index(promises,
 		HeterogenousCombineIterator<NextResult>{state});
@@ -418,46 +478,31 @@ Promise<std::tuple<typename std::decay<Result>::type...>> combine(Promise<Result
 
 /*** Combine multiple homogenous promises into one promise ***/
 
-/* State object, shared between callbacks on all promises */
+/* State object, shared between callbacks on all promises (lock-free, as above) */
 template <typename NextResult>
 struct HomogenousCombineState {
-	std::mutex state_lock;
 	Promise<std::vector<NextResult>> nextPromise;
 	std::vector<NextResult> results;
-	size_t remaining;
-	bool failed = false;
+	std::atomic<size_t> remaining;
+	std::atomic<bool> failed{false};
 	HomogenousCombineState(const size_t count) :
 		results(count), remaining(count)
 			{ };
 	using Result = NextResult;
 	void next(const size_t index, Result result)
 	{
-		std::lock_guard<std::mutex> lock(state_lock);
-		if (failed) {
-			return;
-		}
 		results[index] = std::move(result);
 	}
 	void handler(std::exception_ptr error)
 	{
-		{
-			std::lock_guard<std::mutex> lock(state_lock);
-			if (failed) {
-				return;
-			}
-			failed = true;
+		if (!failed.exchange(true, std::memory_order_relaxed)) {
+			nextPromise->reject(error);
 		}
-		nextPromise->reject(error);
 	}
 	void finalizer()
 	{
-		bool resolved;
-		{
-			std::lock_guard<std::mutex> lock(state_lock);
-			remaining--;
-			resolved = remaining == 0 && !failed;
-		}
-		if (resolved) {
+		if (remaining.fetch_sub(1, std::memory_order_acq_rel) == 1 &&
+				!failed.load(std::memory_order_relaxed)) {
 			nextPromise->resolve(std::move(results));
 		}
 	}
@@ -484,11 +529,15 @@ struct HomogenousCombineIterator {
 template <typename It, typename Result>
 Promise<std::vector<Result>> combine(It first, It last, const size_t size)
 {
-	auto state = std::make_shared<HomogenousCombineState<Result>>(size);
+	auto state = detail::make_state<HomogenousCombineState<Result>>(size);
 	size_t index = 0;
 	for (It it = first; it != last; ++it, ++index) {
 		HomogenousCombineIterator<Result>{state}(*it, index);
 	}
+	/* No finalizer will count down to zero */
+	if (size == 0) {
+		state->nextPromise->resolve({});
+	}
 	/* Return new promise */
 	return state->nextPromise;
 }
@@ -508,6 +557,204 @@ Promise<std::vector<Result>> combine(List promises)
 		promises.size());
 }
 
+/*** Race, any, some ***/
+
+/*
+ * State shared by callbacks on all promises.  Whichever callback flips
+ * "decided" owns the outcome: it cancels the losers, then moves the next
+ * promise (and any results) out and settles it, so the state left for the
+ * losers' callbacks to release is just the counters.
+ */
+template <typename NextResult>
+struct RaceState {
+	RaceState(const size_t count, const size_t needed, CancellationToken losers) :
+		needed(needed), spare(count - needed), losers(losers)
+			{ }
+	Promise<NextResult> nextPromise;
+	const size_t needed;
+	const size_t spare;
+	std::atomic<size_t> rejections{0};
+	std::atomic<bool> decided{false};
+	CancellationToken losers;
+	/* True if this call decided the outcome (and so must settle) */
+	bool decide()
+	{
+		if (decided.exchange(true, std::memory_order_acq_rel)) {
+			return false;
+		}
+		if (losers.can_cancel()) {
+			losers.cancel();
+		}
+		return true;
+	}
+	void resolve(NextResult result)
+	{
+		if (decide()) {
+			auto next = std::move(nextPromise);
+			next->resolve(std::move(result));
+		}
+	}
+	void reject(std::exception_ptr error)
+	{
+		if (decide()) {
+			auto next = std::move(nextPromise);
+			next->reject(error);
+		}
+	}
+	/* Reject once more promises have rejected than can be spared */
+	void rejected(std::exception_ptr error)
+	{
+		if (rejections.fetch_add(1, std::memory_order_relaxed) == spare) {
+			reject(error);
+		}
+	}
+};
+
+template <typename It, typename Result>
+Promise<Result> race(It first, It last, CancellationToken losers)
+{
+	if (first == last) {
+		return promise::rejected<Result>(std::make_exception_ptr(std::logic_error("race of no promises")));
+	}
+	auto state = detail::make_state<RaceState<Result>>(1, 1, losers);
+	Promise<Result> promise = state->nextPromise;
+	for (It it = first; it != last; ++it) {
+		(*it)->then(
+			[state] (Result result) { state->resolve(std::move(result)); },
+			[state] (std::exception_ptr error) { state->reject(error); });
+	}
+	return promise;
+}
+
+template <typename List, typename Result>
+Promise<Result> race(List promises, CancellationToken losers)
+{
+	return race<typename List::iterator, Result>(promises.begin(), promises.end(), losers);
+}
+
+template <typename It, typename Result>
+Promise<Result> any(It first, It last, CancellationToken losers)
+{
+	const size_t count = std::distance(first, last);
+	if (count == 0) {
+		return promise::rejected<Result>(std::make_exception_ptr(std::logic_error("any of no promises")));
+	}
+	auto state = detail::make_state<RaceState<Result>>(count, 1, losers);
+	Promise<Result> promise = state->nextPromise;
+	for (It it = first; it != last; ++it) {
+		(*it)->then(
+			[state] (Result result) { state->resolve(std::move(result)); },
+			[state] (std::exception_ptr error) { state->rejected(error); });
+	}
+	return promise;
+}
+
+template <typename List, typename Result>
+Promise<Result> any(List promises, CancellationToken losers)
+{
+	return any<typename List::iterator, Result>(promises.begin(), promises.end(), losers);
+}
+
+/*
+ * Results are written to slots claimed in order of resolution, and the
+ * callback which completes the count-th slot decides, so it sees every write.
+ */
+template <typename Result>
+struct SomeState : RaceState<std::vector<Result>> {
+	SomeState(const size_t count, const size_t needed, CancellationToken losers) :
+		RaceState<std::vector<Result>>(count, needed, losers), results(needed)
+			{ }
+	std::vector<Result> results;
+	std::atomic<size_t> claimed{0};
+	std::atomic<size_t> filled{0};
+	void resolved(Result result)
+	{
+		const size_t slot = claimed.fetch_add(1, std::memory_order_relaxed);
+		if (slot >= this->needed) {
+			return;
+		}
+		results[slot] = std::move(result);
+		if (filled.fetch_add(1, std::memory_order_acq_rel) + 1 == this->needed) {
+			this->resolve(std::move(results));
+		}
+	}
+};
+
+template <typename It, typename Result>
+Promise<std::vector<Result>> some(const size_t count, It first, It last, CancellationToken losers)
+{
+	const size_t size = std::distance(first, last);
+	if (count > size) {
+		return promise::rejected<std::vector<Result>>(std::make_exception_ptr(std::logic_error("some: fewer promises than required")));
+	}
+	if (count == 0) {
+		return promise::resolved(std::vector<Result>());
+	}
+	auto state = detail::make_state<SomeState<Result>>(size, count, losers);
+	Promise<std::vector<Result>> promise = state->nextPromise;
+	for (It it = first; it != last; ++it) {
+		(*it)->then(
+			[state] (Result result) { state->resolved(std::move(result)); },
+			[state] (std::exception_ptr error) { state->rejected(error); });
+	}
+	return promise;
+}
+
+template <typename List, typename Result>
+Promise<std::vector<Result>> some(const size_t count, List promises, CancellationToken losers)
+{
+	return some<typename List::iterator, Result>(count, promises.begin(), promises.end(), losers);
+}
+
+/*** All settled ***/
+
+template <typename Result>
+struct AllSettledState {
+	AllSettledState(const size_t count) :
+		results(count), remaining(count)
+			{ }
+	Promise<std::vector<Settled<Result>>> nextPromise;
+	std::vector<Settled<Result>> results;
+	std::atomic<size_t> remaining;
+	void settled()
+	{
+		if (remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+			auto next = std::move(nextPromise);
+			next->resolve(std::move(results));
+		}
+	}
+};
+
+template <typename It, typename Result>
+Promise<std::vector<Settled<Result>>> all_settled(It first, It last)
+{
+	const size_t count = std::distance(first, last);
+	if (count == 0) {
+		return promise::resolved(std::vector<Settled<Result>>());
+	}
+	auto state = detail::make_state<AllSettledState<Result>>(count);
+	Promise<std::vector<Settled<Result>>> promise = state->nextPromise;
+	size_t index = 0;
+	for (It it = first; it != last; ++it, ++index) {
+		(*it)->then(
+			[state, index] (Result result) {
+				state->results[index].value = std::move(result);
+				state->settled();
+			},
+			[state, index] (std::exception_ptr error) {
+				state->results[index].error = error;
+				state->settled();
+			});
+	}
+	return promise;
+}
+
+template <typename List, typename Result>
+Promise<std::vector<Settled<Result>>> all_settled(List promises)
+{
+	return all_settled<typename List::iterator, Result>(promises.begin(), promises.end());
+}
+
 }
 
 }
@@ -0,0 +1,65 @@
+#pragma once
+
+namespace kaiu {
+
+namespace detail {
+
+/*
+ * Allocator for promise and promise stream states which are not given one
+ * explicitly.  States are small and short-lived, and are often created by
+ * one thread and released by another, so by default they come from the
+ * per-thread slab pools.  Define MALLOC_PROMISES to use the global heap.
+ */
+#if defined(POOLED_PROMISES)
+template <typename T>
+using state_allocator = SlabAllocator<T>;
+#else
+template <typename T>
+using state_allocator = std::allocator<T>;
+#endif
+
+template <typename State, typename... Args>
+std::shared_ptr<State> make_state(Args&&... args)
+{
+	return std::allocate_shared<State>(state_allocator<State>(), std::forward<Args>(args)...);
+}
+
+/*
+ * Intrusively counted promise state, which keeps the allocator that created
+ * it (as a base, so a stateless allocator takes no space) in order to free
+ * itself when its last handle releases it.
+ */
+template <typename State, typename Alloc>
+class AllocatedState final : private Alloc, public State {
+public:
+	explicit AllocatedState(const Alloc& alloc) : Alloc(alloc) { }
+private:
+	using Rebound = typename std::allocator_traits<Alloc>::template rebind_alloc<AllocatedState>;
+	void dispose() override
+	{
+		Rebound alloc(static_cast<const Alloc&>(*this));
+		this->~AllocatedState();
+		std::allocator_traits<Rebound>::deallocate(alloc, this, 1);
+	}
+};
+
+/* Create a promise state holding one reference */
+template <typename State, typename Alloc>
+State *allocate_state(const Alloc& alloc)
+{
+	using Allocated = AllocatedState<State, Alloc>;
+	using Rebound = typename std::allocator_traits<Alloc>::template rebind_alloc<Allocated>;
+	Rebound rebound(alloc);
+	Allocated *state = std::allocator_traits<Rebound>::allocate(rebound, 1);
+	try {
+		new (state) Allocated(alloc);
+	} catch (...) {
+		std::allocator_traits<Rebound>::deallocate(rebound, state, 1);
+		throw;
+	}
+	return state;
+}
+
+}
+
+}
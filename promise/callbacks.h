@@ -0,0 +1,40 @@
+#pragma once
+
+namespace kaiu {
+
+namespace detail {
+
+/*
+ * Continuation callbacks are stored by value in the promise state's callback,
+ * rather than wrapped in std::function.  Callbacks may be omitted (nullptr)
+ * or be empty std::functions, so these helpers normalise nullptr to an empty
+ * tag type and test/call the callback without knowing its type.
+ */
+
+struct no_callback { };
+
+template <typename Func>
+Func optional_callback(Func func) { return func; }
+
+inline no_callback optional_callback(std::nullptr_t) { return {}; }
+
+template <typename Func>
+bool has_callback(const Func&) { return true; }
+
+template <typename Signature>
+bool has_callback(const std::function<Signature>& func) { return bool(func); }
+
+inline bool has_callback(const no_callback&) { return false; }
+
+/* Only called after has_callback returned true */
+template <typename Result, typename Func, typename... Args>
+Result call_callback(Func& func, Args&&... args)
+	{ return func(std::forward<Args>(args)...); }
+
+template <typename Result, typename... Args>
+Result call_callback(no_callback&, Args&&...)
+	{ throw std::bad_function_call(); }
+
+}
+
+}
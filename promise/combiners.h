@@ -35,6 +35,67 @@ Promise<std::vector<Result>> combine(It first, It last);
 template <typename List, typename Result = typename remove_cvr<typename List::value_type::result_type>::type>
 Promise<std::vector<Result>> combine(List promises);
 
+/*
+ * Take the first of a homogenous set of promises to settle (race), or the
+ * first to resolve (any).  "any" rejects with the error of the last promise
+ * to reject if they all reject.  Both reject with logic_error if the set is
+ * empty.
+ *
+ * The losers are not waited for.  Once the outcome is known, the combined
+ * state releases the next promise (so the chain after it does not wait on
+ * the losers either), and the "losers" token is cancelled, so that losers
+ * created as cancellable tasks with that token stop taking up workers:
+ *
+ *   auto losers = CancellationToken::create();
+ *   auto fetch = task(fetch_fac, EventLoopPool::io_remote,
+ *     EventLoopPool::reactor, losers) << ref(loop);
+ *   race(vector<Promise<Data>>{ fetch(replica1), fetch(replica2), fetch(replica3) }, losers)
+ *     ->then(use_data);
+ */
+template <typename It, typename Result = typename remove_cvr<typename It::value_type::result_type>::type>
+Promise<Result> race(It first, It last, CancellationToken losers = {});
+
+template <typename List, typename Result = typename remove_cvr<typename List::value_type::result_type>::type>
+Promise<Result> race(List promises, CancellationToken losers = {});
+
+template <typename It, typename Result = typename remove_cvr<typename It::value_type::result_type>::type>
+Promise<Result> any(It first, It last, CancellationToken losers = {});
+
+template <typename List, typename Result = typename remove_cvr<typename List::value_type::result_type>::type>
+Promise<Result> any(List promises, CancellationToken losers = {});
+
+/*
+ * Take the first count promises to resolve, in the order that they resolve.
+ * Rejects (with the error of the promise which made it impossible) as soon as
+ * too many have rejected for count to resolve, and cancels the losers token
+ * once either is known.
+ */
+template <typename It, typename Result = typename remove_cvr<typename It::value_type::result_type>::type>
+Promise<std::vector<Result>> some(const size_t count, It first, It last, CancellationToken losers = {});
+
+template <typename List, typename Result = typename remove_cvr<typename List::value_type::result_type>::type>
+Promise<std::vector<Result>> some(const size_t count, List promises, CancellationToken losers = {});
+
+/* Outcome of one promise, for all_settled */
+template <typename Result>
+struct Settled {
+	/* Default-constructed if the promise rejected */
+	Result value{};
+	/* Null if the promise resolved */
+	std::exception_ptr error{};
+	bool resolved() const { return !error; }
+};
+
+/*
+ * Resolves once all given promises have settled, to their outcomes in the
+ * order given.  Never rejects.
+ */
+template <typename It, typename Result = typename remove_cvr<typename It::value_type::result_type>::type>
+Promise<std::vector<Settled<Result>>> all_settled(It first, It last);
+
+template <typename List, typename Result = typename remove_cvr<typename List::value_type::result_type>::type>
+Promise<std::vector<Settled<Result>>> all_settled(List promises);
+
 }
 
 }
@@ -44,14 +44,19 @@ public:
 	/* Bind a callback pack */
 	template <typename Range>
 	Promise<Range> then(const promise::callback_pack<Range, Result>);
-	/* Then (callbacks return immediate value) */
+	/*
+	 * Then (callbacks return immediate value)
+	 *
+	 * Callbacks are held by value, so omitted ones default to nullptr_t
+	 * rather than to an empty std::function.
+	 */
 	template <typename Next>
 	using ThenResult = typename std::result_of<Next(Result)>::type;
 	template <
 		typename Next,
 		typename NextResult = ThenResult<Next>,
-		typename Except = ExceptFunc<NextResult>,
-		typename Finally = FinallyFunc,
+		typename Except = std::nullptr_t,
+		typename Finally = std::nullptr_t,
 		typename = typename std::enable_if<
 			!is_promise<NextResult>::value &&
 			!std::is_void<NextResult>::value &&
@@ -66,8 +71,8 @@ public:
 		typename Next,
 		typename NextPromise = ThenResult<Next>,
 		typename NextResult = typename NextPromise::result_type,
-		typename Except = ExceptFunc<NextPromise>,
-		typename Finally = FinallyFunc,
+		typename Except = std::nullptr_t,
+		typename Finally = std::nullptr_t,
 		typename = typename std::enable_if<
 			is_promise<NextPromise>::value &&
 			!is_callback_pack<Next>::value
@@ -76,12 +81,12 @@ public:
 			Next next_func,
 			Except except_func = nullptr,
 			Finally finally_func = nullptr);
-	/* Then (end promise chain) */
+	/* Then (end promise chain, no next promise is created) */
 	template <
 		typename Next,
 		typename NextResult = ThenResult<Next>,
-		typename Except = ExceptVoidFunc,
-		typename Finally = FinallyFunc,
+		typename Except = std::nullptr_t,
+		typename Finally = std::nullptr_t,
 		typename = typename std::enable_if<
 			std::is_void<NextResult>::value &&
 			!is_callback_pack<Next>::value
@@ -133,8 +138,8 @@ public:
 	using PromiseStateBase::finish;
 protected:
 	/* Get/set promise result */
-	void set_result(ensure_locked, Result&& value);
-	Result get_result(ensure_locked);
+	void set_result(Result&& value);
+	Result get_result();
 private:
 	Result result;
 	/* Helper functions to pass current value onwards if no 'next' callback */
@@ -144,11 +149,6 @@ private:
 	template <typename NextResult, int dummy = 0,
 		typename = typename std::enable_if<!std::is_same<Result, NextResult>::value>::type>
 	static NextResult forward_result(Result result);
-	template <typename NextResult>
-	static Promise<NextResult> default_next(Result result);
-	template <typename NextResult>
-	static Promise<NextResult> default_except(std::exception_ptr error);
-	static void default_finally();
 };
 
 }
@@ -4,9 +4,21 @@ namespace kaiu {
 
 /***
  * Untyped promise state
+ *
+ * Lock-free: the pending/resolved/rejected/completed transitions are a state
+ * machine on a single atomic word.  The producer (resolve/reject) and the
+ * consumer (set_callbacks) each store their data then publish it by setting a
+ * bit.  Whichever of them publishes second sees the other's bit and runs the
+ * callback, so the callback runs exactly once, in whichever thread completed
+ * the pair, without any lock.
+ *
+ * Promise handles share the state through an intrusive reference count held
+ * next to the state word.  A state is only ever created by
+ * detail::allocate_state, which frees it (through the allocator which
+ * created it) when the last handle releases it.
  */
 
-class PromiseStateBase : public self_managing {
+class PromiseStateBase {
 public:
 	/* Reject */
 	void reject(std::exception_ptr error);
@@ -25,32 +37,58 @@ public:
 	/* Make terminator */
 	void finish();
 protected:
-	enum class promise_state { pending, rejected, resolved, completed };
-	/* Validates that the above state transitions are being followed */
-	void set_state(ensure_locked, const promise_state next_state);
-	/* Re-applies the current state, advances to next state if possible */
-	void update_state(ensure_locked);
+	/* Destroy and deallocate this state */
+	virtual void dispose() = 0;
 	/*
-	 * Set the resolve/reject callbacks.  If the promise has been
-	 * resolved/rejected, the appropriate callback will be called immediately.
+	 * Bits of the state word.  The *_claimed bits are taken before the data
+	 * is stored, so double resolution/binding is detected before it can race
+	 * with the data being read.
 	 */
-	void set_callbacks(ensure_locked, std::function<void(ensure_locked)> resolve, std::function<void(ensure_locked)> reject);
-	/* Get/set rejection result */
-	void set_error(ensure_locked, std::exception_ptr error);
-	std::exception_ptr get_error(ensure_locked) const;
+	enum state_bits : unsigned {
+		settle_claimed = 1 << 0,
+		resolved = 1 << 1,
+		rejected = 1 << 2,
+		bind_claimed = 1 << 3,
+		bound = 1 << 4,
+		completed = 1 << 5
+	};
+	/* Claim the right to resolve/reject, throws if already claimed */
+	void claim_settle();
+	/*
+	 * Publish a bit (resolved, rejected or bound) and run the callback if the
+	 * other side has already published.  Must not access *this after calling
+	 * this, the callback may release the last reference to it.
+	 */
+	void publish(const state_bits bit);
+	/*
+	 * Completion callback, called with true if the promise was rejected.  One
+	 * callback for both outcomes, stored inline when its captures are small,
+	 * so binding a continuation usually costs no allocation beyond the next
+	 * promise's state.
+	 */
+	using Callback = SmallFunction<void(bool), 8 * sizeof(void *)>;
+	/*
+	 * Set the callback.  If the promise has been resolved/rejected, it will be
+	 * called immediately.
+	 */
+	void set_callback(Callback callback);
+	/* Get/set rejection result (set before publishing, get from callbacks) */
+	void set_error(std::exception_ptr error);
+	std::exception_ptr get_error() const;
 	/* Make this promise a terminator */
-	void set_terminator(ensure_locked);
+	void set_terminator();
 private:
-	promise_state state{promise_state::pending};
+	template <typename> friend class Promise;
+	std::atomic<unsigned> state{0};
+	/* Number of Promise handles, the creating handle holds the first */
+	std::atomic<unsigned> refs{1};
 	std::exception_ptr error{};
-	/*
-	 * We release the callbacks after using them, so this variable is used to
-	 * track whether we have bound callbacks at all, so that re-binding cannot
-	 * happen after unbinding (and completion).
-	 */
-	bool callbacks_assigned{false};
-	std::function<void(ensure_locked)> on_resolve{nullptr};
-	std::function<void(ensure_locked)> on_reject{nullptr};
+	Callback on_complete{nullptr};
+	/* Run the appropriate callback, given the state word after publishing */
+	void complete(const unsigned flags);
+	/* Reference counting, for Promise handles */
+	void add_ref() { refs.fetch_add(1, std::memory_order_relaxed); }
+	void release();
 };
 
 }
@@ -77,7 +77,7 @@ void PromiseStreamStateBase::update_state(ensure_locked lock)
 		}
 		break;
 	case stream_state::streaming3:
-		if (!consumer_is_running) {
+		if (consumers_running == 0) {
 			set_state(lock, stream_state::completed);
 		}
 		break;
@@ -88,10 +88,22 @@ void PromiseStreamStateBase::update_state(ensure_locked lock)
 			callback(lock);
 			make_mortal(lock);
 		}
+		remove_cancel_callbacks(lock);
 		break;
 	}
 }
 
+void PromiseStreamStateBase::remove_cancel_callbacks(ensure_locked lock)
+{
+	/* The token may be running its callbacks, which take our lock */
+	for (auto& callback : cancel_callbacks) {
+		after_unlock(lock, [token = move(callback.first), id = callback.second] {
+			token.remove(id);
+		});
+	}
+	cancel_callbacks.clear();
+}
+
 auto PromiseStreamStateBase::get_state(ensure_locked) const -> stream_state
 {
 	return state;
@@ -117,9 +129,10 @@ void PromiseStreamStateBase::set_stream_result(ensure_locked lock, stream_result
 		 * producer
 		 */
 		return;
-	} else if (result != stream_result::pending) {
+	} else if (result != stream_result::pending && result_ != stream_result::consumer_failed) {
 		/*
-		 * Throw on multiple resolutions by producer
+		 * Throw on multiple resolutions by producer (a consumer which fails
+		 * after the producer's result overrides it, as above)
 		 */
 		throw logic_error("Attempted to resolve promise stream multiple times");
 	}
@@ -142,27 +155,60 @@ void PromiseStreamStateBase::set_consumer_is_running(ensure_locked lock,
 	bool value)
 {
 #if defined(SAFE_PROMISE_STREAMS)
-	if (consumer_is_running == value) {
-		throw logic_error("set_consumer_is_running: concurrent consumers detected");
+	if (value ? consumers_running == max_consumers : consumers_running == 0) {
+		throw logic_error("set_consumer_is_running: more consumers than allowed, or none running");
 	}
 #endif
-	consumer_is_running = value;
+	if (value) {
+		consumers_running++;
+	} else {
+		consumers_running--;
+	}
 	update_state(lock);
 }
 
 bool PromiseStreamStateBase::get_consumer_is_running(ensure_locked) const
 {
-	return consumer_is_running;
+	return consumers_running > 0;
+}
+
+void PromiseStreamStateBase::set_max_consumers(ensure_locked, size_t value)
+{
+	if (value == 0) {
+		throw logic_error("At least one consumer must be allowed to run");
+	}
+	max_consumers = value;
+}
+
+bool PromiseStreamStateBase::can_start_consumer(ensure_locked) const
+{
+	return consumers_running < max_consumers;
+}
+
+void PromiseStreamStateBase::remove_on_completion(ensure_locked lock, CancellationToken token, const size_t id)
+{
+	cancel_callbacks.emplace_back(move(token), id);
+	if (state == stream_state::completed) {
+		remove_cancel_callbacks(lock);
+	}
 }
 
 void PromiseStreamStateBase::set_action(ensure_locked, StreamAction action)
 {
-	this->action = action;
+	/*
+	 * Discard and Stop are final, so neither a stop requested while the
+	 * consumer is running nor a discard from one parallel consumer is undone
+	 * when another returns.  Only a stronger action (Stop over Discard)
+	 * replaces them.
+	 */
+	if (action > this->action.load(memory_order_relaxed)) {
+		this->action.store(action, memory_order_release);
+	}
 }
 
 StreamAction PromiseStreamStateBase::get_action(ensure_locked) const
 {
-	return action;
+	return action.load(memory_order_relaxed);
 }
 
 void PromiseStreamStateBase::set_data_callback_assigned(ensure_locked lock)
@@ -182,14 +228,12 @@ void PromiseStreamStateBase::set_data_callback_assigned(ensure_locked lock)
 
 bool PromiseStreamStateBase::is_stopping() const
 {
-	auto lock = get_lock();
-	return get_action(lock) == StreamAction::Stop;
+	return data_action() == StreamAction::Stop;
 }
 
 StreamAction PromiseStreamStateBase::data_action() const
 {
-	auto lock = get_lock();
-	return get_action(lock);
+	return action.load(memory_order_acquire);
 }
 
 }
@@ -1,21 +1,25 @@
 #pragma once
 #include <deque>
-#include <queue>
+#include <vector>
 #include <memory>
 #include <functional>
 #include <utility>
 #include <type_traits>
 #include <mutex>
+#include <atomic>
+#include <thread>
 #include "promise.h"
 #include "self_managing.h"
+#include "cancellation.h"
 
 #if defined(DEBUG)
 #define SAFE_PROMISE_STREAMS
 #endif
 
 #include "promise_stream/fwd.h"
-#include "promise_stream/traits.h"
 #include "promise_stream/defs.h"
+#include "promise_stream/traits.h"
+#include "promise_stream/slots.h"
 #include "promise_stream/factories.h"
 #include "promise_stream/consumers.h"
 #include "promise_stream/monad.h"
@@ -36,6 +40,9 @@ public:
 	using datum_type = Datum;
 	/* Promise stream */
 	PromiseStream();
+	/* Promise stream whose state is allocated by the given allocator */
+	template <typename Alloc>
+	PromiseStream(std::allocator_arg_t, const Alloc& alloc);
 	/* Copy/move/cast constructors */
 	PromiseStream(PromiseStream<Result, Datum>&&) = default;
 	PromiseStream(const PromiseStream<Result, Datum>&) = default;
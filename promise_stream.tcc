@@ -2,6 +2,10 @@
 #include <exception>
 #include <stdexcept>
 #include <thread>
+#include <mutex>
+#include <map>
+#include <vector>
+#include <algorithm>
 #include "shared_functor.h"
 #include "promise_stream.h"
 
@@ -37,6 +41,9 @@ template <typename Result, typename Datum>
 template <typename... Args>
 void PromiseStreamState<Result, Datum>::write(Args&&... args)
 {
+	if (ring_write(std::forward<Args>(args)...)) {
+		return;
+	}
 	auto lock = get_lock();
 	if (get_action(lock) == StreamAction::Continue) {
 		emplace_data(lock, std::forward<Args>(args)...);
@@ -46,34 +53,254 @@ void PromiseStreamState<Result, Datum>::write(Args&&... args)
 }
 
 template <typename Result, typename Datum>
-void PromiseStreamState<Result, Datum>::set_data_callback(DataFunc data_callback)
+template <typename Range>
+void PromiseStreamState<Result, Datum>::write_bulk(Range&& data)
+{
+	using Value = typename std::conditional<
+		std::is_lvalue_reference<Range>::value,
+		const Datum&, Datum&&>::type;
+	auto lock = get_lock();
+	if (get_action(lock) == StreamAction::Continue) {
+		bool any = false;
+		for (auto& datum : data) {
+			emplace_data(lock, static_cast<Value>(datum));
+			any = true;
+		}
+		if (any) {
+			set_stream_has_been_written_to(lock);
+		}
+	}
+	process_data(lock);
+}
+
+template <typename Result, typename Datum>
+void PromiseStreamState<Result, Datum>::set_capacity(const size_t capacity)
+{
+	auto lock = get_lock();
+	this->capacity = capacity;
+	admit_waiting_writes(lock);
+	process_data(lock);
+}
+
+template <typename Result, typename Datum>
+template <typename... Args>
+bool PromiseStreamState<Result, Datum>::try_write(Args&&... args)
+{
+	/* The ring is only open while there is no capacity */
+	if (ring_write(std::forward<Args>(args)...)) {
+		return true;
+	}
+	auto lock = get_lock();
+	if (get_action(lock) == StreamAction::Continue) {
+		if (buffer_full(lock)) {
+			return false;
+		}
+		emplace_data(lock, std::forward<Args>(args)...);
+		set_stream_has_been_written_to(lock);
+	}
+	process_data(lock);
+	return true;
+}
+
+template <typename Result, typename Datum>
+template <typename... Args>
+Promise<StreamAction> PromiseStreamState<Result, Datum>::write_async(Args&&... args)
+{
+	if (ring_write(std::forward<Args>(args)...)) {
+		return promise::resolved(data_action());
+	}
+	auto lock = get_lock();
+	if (get_action(lock) == StreamAction::Continue && buffer_full(lock)) {
+		Promise<StreamAction> written;
+		waiting_writes.emplace_back(detail::make_datum_slot<Datum>(std::forward<Args>(args)...), written);
+		/* Not buffered yet, but the stream must not complete without it */
+		set_stream_has_been_written_to(lock);
+		process_data(lock);
+		return written;
+	}
+	if (get_action(lock) == StreamAction::Continue) {
+		emplace_data(lock, std::forward<Args>(args)...);
+		set_stream_has_been_written_to(lock);
+	}
+	process_data(lock);
+	return promise::resolved(get_action(lock));
+}
+
+template <typename Result, typename Datum>
+bool PromiseStreamState<Result, Datum>::buffer_full(ensure_locked lock) const
+{
+	return capacity != 0 && data_size(lock) >= capacity;
+}
+
+template <typename Result, typename Datum>
+void PromiseStreamState<Result, Datum>::admit_waiting_writes(ensure_locked lock)
+{
+	const auto action = get_action(lock);
+	/* Waiting writes follow anything in the ring */
+	if (!waiting_writes.empty()) {
+		drain_ring(lock);
+	}
+	while (!waiting_writes.empty() && (action != StreamAction::Continue || !buffer_full(lock))) {
+		auto write = std::move(waiting_writes.front());
+		waiting_writes.pop_front();
+		if (action == StreamAction::Continue) {
+			buffer.push(std::move(write.first));
+		}
+		/* The writer may write again from the callback */
+		auto written = std::move(write.second);
+		after_unlock(lock, [written, action] {
+			written->resolve(action);
+		});
+	}
+}
+
+template <typename Result, typename Datum>
+void PromiseStreamState<Result, Datum>::set_single_producer(const size_t ring_size)
+{
+	auto lock = get_lock();
+	if (ring || get_state(lock) != stream_state::pending) {
+		throw std::logic_error("set_single_producer must be called once, before the first write");
+	}
+	ring = std::make_unique<detail::DatumSlotRing<Datum>>(ring_size);
+}
+
+template <typename Result, typename Datum>
+void PromiseStreamState<Result, Datum>::update_ring_open(ensure_locked lock)
+{
+	if (!ring) {
+		return;
+	}
+	/* Once written to, and until completed or stopped, if unbounded */
+	ring_open.store(
+		get_state(lock) == stream_state::streaming1 &&
+		get_action(lock) == StreamAction::Continue &&
+		capacity == 0 && waiting_writes.empty(),
+		std::memory_order_release);
+}
+
+template <typename Result, typename Datum>
+template <typename... Args>
+bool PromiseStreamState<Result, Datum>::ring_write(Args&&... args)
+{
+	/* Data written after a stop are dropped by the locked write */
+	if (!ring_open.load(std::memory_order_acquire) ||
+			data_action() != StreamAction::Continue || ring->full()) {
+		return false;
+	}
+	if (ring->push(detail::make_datum_slot<Datum>(std::forward<Args>(args)...))) {
+		/*
+		 * The ring was empty, so the consumer may have stopped for want of
+		 * data.  Otherwise, whoever took the older data takes this too.
+		 */
+		auto lock = get_lock();
+		process_data(lock);
+	}
+	return true;
+}
+
+template <typename Result, typename Datum>
+void PromiseStreamState<Result, Datum>::drain_ring(ensure_locked)
+{
+	if (!ring) {
+		return;
+	}
+	while (!ring->empty()) {
+		buffer.push(ring->pop());
+	}
+}
+
+template <typename Result, typename Datum>
+bool PromiseStreamState<Result, Datum>::data_empty(ensure_locked) const
+{
+	return buffer.empty() && (!ring || ring->empty());
+}
+
+template <typename Result, typename Datum>
+size_t PromiseStreamState<Result, Datum>::data_size(ensure_locked) const
+{
+	return buffer.size() + (ring ? ring->size() : 0);
+}
+
+template <typename Result, typename Datum>
+auto PromiseStreamState<Result, Datum>::pop_data(ensure_locked) -> Slot
+{
+	/* Ring data are newer than buffered data */
+	if (!buffer.empty()) {
+		return buffer.pop();
+	}
+	return ring->pop();
+}
+
+template <typename Result, typename Datum>
+void PromiseStreamState<Result, Datum>::clear_data(ensure_locked)
+{
+	buffer.clear();
+	if (ring) {
+		ring->clear();
+	}
+}
+
+template <typename Result, typename Datum>
+void PromiseStreamState<Result, Datum>::set_data_callback(DataFunc data_callback, const size_t max_consumers)
 {
 	auto lock = get_lock();
 #if defined(SAFE_PROMISE_STREAMS)
-	if (on_data != nullptr) {
+	if (on_data != nullptr || on_batch != nullptr) {
 		throw std::logic_error("Callbacks are already assigned");
 	}
 	if (data_callback == nullptr) {
 		throw std::logic_error("Attempted to bind null callback");
 	}
 #endif
+	set_max_consumers(lock, max_consumers);
 	on_data = data_callback;
 	set_data_callback_assigned(lock);
 	process_data(lock);
 }
 
+template <typename Result, typename Datum>
+void PromiseStreamState<Result, Datum>::set_batch_callback(BatchFunc batch_callback, const size_t max_batch)
+{
+	auto lock = get_lock();
+#if defined(SAFE_PROMISE_STREAMS)
+	if (on_data != nullptr || on_batch != nullptr) {
+		throw std::logic_error("Callbacks are already assigned");
+	}
+	if (batch_callback == nullptr) {
+		throw std::logic_error("Attempted to bind null callback");
+	}
+#endif
+	if (max_batch == 0) {
+		throw std::logic_error("Batch size must be at least one");
+	}
+	this->max_batch = max_batch;
+	on_batch = batch_callback;
+	set_data_callback_assigned(lock);
+	process_data(lock);
+}
+
 template <typename Result, typename Datum>
 Promise<Result> PromiseStreamState<Result, Datum>::
 	do_stream(stream_consumer consumer)
 {
-	auto data = [consumer] (ensure_locked, Datum datum) {
+	auto data = [consumer] (size_t, Datum& datum) {
+		return consumer(std::move(datum));
+	};
+	return do_indexed_stream(data, 1);
+}
+
+template <typename Result, typename Datum>
+Promise<Result> PromiseStreamState<Result, Datum>::
+	do_indexed_stream(DataFunc consumer, const size_t max_consumers)
+{
+	auto data = [consumer] (const size_t index, Datum& datum) {
 		try {
-			return consumer(std::move(datum));
+			return consumer(index, datum);
 		} catch (...) {
 			return promise::rejected<StreamAction>(std::current_exception());
 		}
 	};
-	set_data_callback(data);
+	set_data_callback(data, max_consumers);
 	return proxy_promise;
 }
 
@@ -83,7 +310,7 @@ Promise<std::pair<State, Result>> PromiseStreamState<Result, Datum>::
 	do_stateful_stream(stateful_stream_consumer<State> consumer, Args&&... args)
 {
 	auto state = std::make_shared<State>(std::forward<Args>(args)...);
-	auto consumer_proxy = [this, consumer, state] (Datum datum) {
+	auto consumer_proxy = [this, consumer, state] (Datum&& datum) {
 		return consumer(*state, std::move(datum));
 	};
 	auto next_proxy = [this, state] (Result result) {
@@ -96,7 +323,7 @@ Promise<std::pair<State, Result>> PromiseStreamState<Result, Datum>::
 template <typename Result, typename Datum>
 Promise<Result> PromiseStreamState<Result, Datum>::always(StreamAction action)
 {
-	auto consumer = [action] (Datum datum) {
+	auto consumer = [action] (const Datum&) {
 		return promise::resolved(action);
 	};
 	return do_stream(consumer);
@@ -114,11 +341,43 @@ Promise<Result> PromiseStreamState<Result, Datum>::stop()
 	return always(StreamAction::Stop);
 }
 
+template <typename Result, typename Datum>
+bool PromiseStreamState<Result, Datum>::stop_requested() const
+{
+	return is_stopping();
+}
+
+template <typename Result, typename Datum>
+void PromiseStreamState<Result, Datum>::request_stop()
+{
+	auto lock = get_lock();
+	set_action(lock, StreamAction::Stop);
+	/* Releases waiting writers, even if no consumer is bound */
+	admit_waiting_writes(lock);
+	process_data(lock);
+}
+
+template <typename Result, typename Datum>
+void PromiseStreamState<Result, Datum>::stop_on(CancellationToken token)
+{
+	/* The token may outlive the stream */
+	std::weak_ptr<self_managing> weak = shared_from_this();
+	const auto id = token.on_cancel([weak] {
+		if (auto self = weak.lock()) {
+			static_cast<PromiseStreamState<Result, Datum> *>(self.get())->request_stop();
+		}
+	});
+	if (id) {
+		auto lock = get_lock();
+		remove_on_completion(lock, std::move(token), id);
+	}
+}
+
 template <typename Result, typename Datum>
 void PromiseStreamState<Result, Datum>::forward_to(PromiseStream<Result, Datum> next)
 {
 	this
-		->stream<void>([next] (Datum datum) {
+		->stream<void>([next] (Datum&& datum) {
 			next->write(std::move(datum));
 			return next->data_action();
 		})
@@ -134,7 +393,7 @@ void PromiseStreamState<Result, Datum>::forward_to(Promise<Result> next)
 }
 
 template <typename Result, typename Datum>
-void PromiseStreamState<Result, Datum>::call_data_callback(ensure_locked lock, Datum datum) try {
+void PromiseStreamState<Result, Datum>::call_data_callback(ensure_locked lock, ConsumerCall call) try {
 	/*
 	 * Asynchronous on_data callbacks will obviously not trigger the catch block
 	 * if they throw.  Synchronous on_data callbacks also will not, as the
@@ -152,65 +411,114 @@ void PromiseStreamState<Result, Datum>::call_data_callback(ensure_locked lock, D
 	 * or not.  If run asynchronously, they could be in the same thread as the
 	 * caller, or a different one.  Hence we need to combine two variables:
 	 *  * "current thread id"
-	 *  * the async_check boolean
+	 *  * the call being bound (binding_call)
 	 *
-	 * async_check detects asynchronous calling when the callbacks run in the
+	 * binding_call detects asynchronous calling when the callbacks run in the
 	 * calling thread, but may not always work if the callbacks are called in
 	 * another thread.  "current thread id" fixes that case.
+	 *
+	 * A synchronous consumer's callback leaves taking the next datum to the
+	 * loop in process_data, rather than recursing, so a long backlog does not
+	 * grow the stack.
 	 */
-	auto async_check = std::make_shared<std::atomic<bool>>(false);
+	const auto call_id = ++consumer_calls;
 	const auto caller_id = std::this_thread::get_id();
-	const auto is_async = [=] {
-		return *async_check || std::this_thread::get_id() != caller_id;
-	};
-	using lock_type = typename std::decay<decltype(lock)>::type;
+	binding_call.store(call_id, std::memory_order_relaxed);
+	binding_lock = &lock;
 	/* Run consumer */
-	on_data(lock, std::move_if_noexcept(datum))
+	call_consumer(lock, std::move(call))
 		->then(
-			[this, is_async, lck=&lock] (const StreamAction action) {
-				/* Get lock if we're running asynchronously */
-				const bool async = is_async();
-				lock_type new_lock;
-				if (async) {
-					new_lock = get_lock();
-				}
-				lock_type& lock = async ? new_lock : *lck;
-				/* Lock acquired */
-				set_action(lock, action);
-				set_consumer_is_running(lock, false);
-				/* Will release the lock */
-				process_data(lock);
+			[this, call_id, caller_id] (const StreamAction action) {
+				with_consumer_lock(call_id, caller_id, [this, action] (ensure_locked lock, const bool async) {
+					set_action(lock, action);
+					set_consumer_is_running(lock, false);
+					if (async) {
+						process_data(lock);
+					}
+				});
 			},
-			[this, is_async, lck=&lock] (std::exception_ptr error) {
-				/* Get lock if we're running asynchronously */
-				const bool async = is_async();
-				lock_type new_lock;
-				if (async) {
-					new_lock = get_lock();
-				}
-				lock_type& lock = async ? new_lock : *lck;
-				/* Lock acquired */
-				do_reject(lock, error, true);
-				set_consumer_is_running(lock, false);
+			[this, call_id, caller_id] (std::exception_ptr error) {
+				with_consumer_lock(call_id, caller_id, [this, error] (ensure_locked lock, bool) {
+					do_reject(lock, error, true);
+					set_consumer_is_running(lock, false);
+				});
 			});
-	*async_check = true;
+	binding_call.store(0, std::memory_order_relaxed);
 } catch (...) {
 	set_consumer_is_running(lock, false);
 	/* Rethrowing is implicit since this is a function-try-catch block */
 	throw;
 }
 
+template <typename Result, typename Datum>
+template <typename Func>
+void PromiseStreamState<Result, Datum>::with_consumer_lock(const std::size_t call_id,
+	const std::thread::id caller_id, Func func)
+{
+	const bool async = std::this_thread::get_id() != caller_id ||
+		binding_call.load(std::memory_order_relaxed) != call_id;
+	self_managing_helper new_lock;
+	if (async) {
+		new_lock = get_lock();
+	}
+	/* Lock acquired */
+	func(async ? new_lock : *binding_lock, async);
+}
+
+template <typename Result, typename Datum>
+auto PromiseStreamState<Result, Datum>::call_consumer(ensure_locked, ConsumerCall call)
+	-> Promise<StreamAction>
+{
+	return call();
+}
+
 template <typename Result, typename Datum>
 void PromiseStreamState<Result, Datum>::process_data(ensure_locked lock)
 {
-	Datum datum;
-	if (take_data(lock, datum)) {
-		call_data_callback(lock, std::move(datum));
+	update_ring_open(lock);
+	/*
+	 * Start consumers until the buffer is empty or the limit is reached.  The
+	 * callbacks are assigned before any data is taken, and never change, so
+	 * the calls may run without the lock.
+	 */
+	Slot slot;
+	while (take_data(lock, slot)) {
+		ConsumerCall call(this);
+		if (on_batch == nullptr) {
+			call.index = taken++;
+			call.slot = std::move(slot);
+			call_data_callback(lock, std::move(call));
+			continue;
+		}
+		/*
+		 * Take the rest of the batch directly: take_data would mark the
+		 * buffer empty before the consumer is marked running
+		 */
+		auto& batch = call.batch;
+		batch.reserve(std::min(max_batch, data_size(lock) + 1));
+		batch.emplace_back(std::move(slot->datum));
+		slot.reset();
+		while (batch.size() < max_batch && !data_empty(lock)) {
+			batch.emplace_back(std::move(pop_data(lock)->datum));
+			admit_waiting_writes(lock);
+		}
+		taken += batch.size();
+		call_data_callback(lock, std::move(call));
 	}
 }
 
 template <typename Result, typename Datum>
-bool PromiseStreamState<Result, Datum>::take_data(ensure_locked lock, Datum& out)
+Promise<StreamAction> PromiseStreamState<Result, Datum>::ConsumerCall::operator ()()
+{
+	/* The slot is freed with the call, once the consumer has returned */
+	if (slot) {
+		return state->on_data(index, slot->datum);
+	}
+	return state->on_batch(std::move(batch));
+}
+
+template <typename Result, typename Datum>
+bool PromiseStreamState<Result, Datum>::take_data(ensure_locked lock, Slot& out)
 {
 	auto state = get_state(lock);
 	/* Wrong state */
@@ -218,21 +526,19 @@ bool PromiseStreamState<Result, Datum>::take_data(ensure_locked lock, Datum& out
 		return false;
 	}
 	/* No consumer assigned yet */
-	if (on_data == nullptr) {
-		return false;
-	}
-	/* Don't run the consumer multiple time simultaneously */
-	if (get_consumer_is_running(lock)) {
+	if (on_data == nullptr && on_batch == nullptr) {
 		return false;
 	}
 	/*
 	 * If consumer has finished, empty the buffer (and ignore subsequent
-	 * writes, see "write" method)
+	 * writes, see "write" method).  Done even while consumers are running, so
+	 * a stop does not wait for them to drop the remaining data.
 	 */
 	if (get_action(lock) != StreamAction::Continue) {
-		decltype(buffer)().swap(buffer);
+		clear_data(lock);
+		admit_waiting_writes(lock);
 	}
-	if (buffer.empty()) {
+	if (data_empty(lock)) {
 		/*
 		 * When removing the last data from the buffer, this call must occur
 		 * AFTER set_consumer_is_running(lock, true) in order for state
@@ -244,36 +550,58 @@ bool PromiseStreamState<Result, Datum>::take_data(ensure_locked lock, Datum& out
 		set_buffer_is_empty(lock);
 		return false;
 	}
-	out = std::move(buffer.front());
-	buffer.pop();
+	/* Don't run more consumers at once than allowed (one unless parallel) */
+	if (!can_start_consumer(lock)) {
+		return false;
+	}
+	out = pop_data(lock);
+	admit_waiting_writes(lock);
 	/* Return success */
 	return true;
 }
 
 template <typename Result, typename Datum>
 template <typename... Args>
-void PromiseStreamState<Result, Datum>::emplace_data(ensure_locked, Args&&... args)
+void PromiseStreamState<Result, Datum>::emplace_data(ensure_locked lock, Args&&... args)
 {
-	buffer.emplace(std::forward<Args>(args)...);
+	/* Keep the order of writes */
+	drain_ring(lock);
+	buffer.push(detail::make_datum_slot<Datum>(std::forward<Args>(args)...));
 }
 
 template <typename Result, typename Datum>
-bool PromiseStreamState<Result, Datum>::has_data(ensure_locked) const
+bool PromiseStreamState<Result, Datum>::has_data(ensure_locked lock) const
 {
-	return buffer.size() > 0;
+	return !data_empty(lock);
 }
 
 template <typename Result, typename Datum>
 void PromiseStreamState<Result, Datum>::do_resolve(ensure_locked lock, Result result)
 {
+	mark_ring_written(lock);
 	set_stream_result(lock, stream_result::resolved, resolve_completer(std::move(result)));
+	update_ring_open(lock);
 }
 
 template <typename Result, typename Datum>
 void PromiseStreamState<Result, Datum>::do_reject(ensure_locked lock, std::exception_ptr error, bool consumer_failed)
 {
+	mark_ring_written(lock);
 	set_action(lock, StreamAction::Stop);
 	set_stream_result(lock, consumer_failed ? stream_result::consumer_failed : stream_result::rejected, reject_completer(error));
+	update_ring_open(lock);
+}
+
+template <typename Result, typename Datum>
+void PromiseStreamState<Result, Datum>::mark_ring_written(ensure_locked lock)
+{
+	/*
+	 * Writes to the ring don't mark the buffer as non-empty, so do that
+	 * before a result lets the stream complete once the buffer is empty
+	 */
+	if (ring && !ring->empty() && get_state(lock) == stream_state::streaming1) {
+		set_stream_has_been_written_to(lock);
+	}
 }
 
 template <typename Result, typename Datum>
@@ -310,7 +638,7 @@ template <typename, typename Consumer>
 auto PromiseStreamState<Result, Datum>::stream(Consumer consumer)
 	-> stream_sel<Consumer, result_of_not_promise_is, StreamAction, Result, Datum>
 {
-	auto data_proxy = [consumer] (Datum datum) {
+	auto data_proxy = [consumer] (Datum&& datum) {
 		return promise::resolved<StreamAction>(consumer(std::move(datum)));
 	};
 	return do_stream(data_proxy);
@@ -322,7 +650,7 @@ template <typename, typename Consumer>
 auto PromiseStreamState<Result, Datum>::stream(Consumer consumer)
 	-> stream_sel<Consumer, result_of_not_promise_is, void, Result, Datum>
 {
-	auto data_proxy = [consumer] (Datum datum) {
+	auto data_proxy = [consumer] (Datum&& datum) {
 		consumer(std::move(datum));
 		return promise::resolved(StreamAction::Continue);
 	};
@@ -344,7 +672,7 @@ template <typename State, typename Consumer, typename... Args>
 auto PromiseStreamState<Result, Datum>::stream(Consumer consumer, Args&&... args)
 	-> stream_sel<Consumer, result_of_not_promise_is, StreamAction, std::pair<State, Result>, State&, Datum>
 {
-	auto data_proxy = [consumer] (State& state, Datum datum) {
+	auto data_proxy = [consumer] (State& state, Datum&& datum) {
 		return promise::resolved<StreamAction>(consumer(state, std::move(datum)));
 	};
 	return do_stateful_stream<State, Args...>(data_proxy, std::forward<Args>(args)...);
@@ -356,13 +684,134 @@ template <typename State, typename Consumer, typename... Args>
 auto PromiseStreamState<Result, Datum>::stream(Consumer consumer, Args&&... args)
 	-> stream_sel<Consumer, result_of_not_promise_is, void, std::pair<State, Result>, State&, Datum>
 {
-	auto data_proxy = [consumer] (State& state, Datum datum) {
+	auto data_proxy = [consumer] (State& state, Datum&& datum) {
 		consumer(state, std::move(datum));
 		return promise::resolved(StreamAction::Continue);
 	};
 	return do_stateful_stream<State, Args...>(data_proxy, std::forward<Args>(args)...);
 }
 
+/* Parallel consumer */
+template <typename Result, typename Datum>
+template <typename Consumer>
+Promise<Result> PromiseStreamState<Result, Datum>::stream_parallel(
+	Consumer consumer, const size_t max_in_flight)
+{
+	using Call = detail::consumer_call<typename std::result_of<Consumer(Datum)>::type>;
+	auto data = [consumer] (size_t, Datum& datum) {
+		return Call::call(consumer, std::move(datum));
+	};
+	return do_indexed_stream(data, max_in_flight);
+}
+
+/* Batched consumer */
+template <typename Result, typename Datum>
+template <typename Consumer>
+Promise<Result> PromiseStreamState<Result, Datum>::stream_batch(
+	Consumer consumer, const size_t max_batch)
+{
+	using Call = detail::consumer_call<typename std::result_of<Consumer(std::vector<Datum>)>::type>;
+	auto batch = [consumer] (std::vector<Datum> data) {
+		try {
+			return Call::call(consumer, std::move(data));
+		} catch (...) {
+			return promise::rejected<StreamAction>(std::current_exception());
+		}
+	};
+	set_batch_callback(batch, max_batch);
+	return proxy_promise;
+}
+
+/*
+ * Results of a parallel map which are waiting for earlier results, with the
+ * promises which free their consumer slots once written, and the index of the
+ * next result to write
+ */
+template <typename Out>
+struct ParallelStreamReorder {
+	std::mutex mx;
+	std::map<size_t, std::pair<Out, Promise<StreamAction>>> waiting;
+	size_t next_index{0};
+	bool failed{false};
+};
+
+/* Parallel map */
+template <typename Result, typename Datum>
+template <typename Consumer, typename Out>
+PromiseStream<Result, Out> PromiseStreamState<Result, Datum>::stream_parallel(
+	Consumer consumer, const size_t max_in_flight, const StreamOrder order)
+{
+	using Call = detail::consumer_call<typename std::result_of<Consumer(Datum)>::type>;
+	PromiseStream<Result, Out> next;
+	auto reorder = std::make_shared<ParallelStreamReorder<Out>>();
+	/*
+	 * Writes a result, resolves to the action for the upstream consumer once
+	 * written.  Waiting results keep their consumer slots, so no more than
+	 * max_in_flight results are ever held.
+	 */
+	auto writer = [next, order, reorder] (const size_t index, Out out) {
+		if (order == StreamOrder::unordered) {
+			next->write(std::move(out));
+			return promise::resolved(next->data_action());
+		}
+		Promise<StreamAction> written;
+		std::vector<Promise<StreamAction>> released;
+		{
+			std::lock_guard<std::mutex> lock(reorder->mx);
+			if (reorder->failed) {
+				return promise::resolved(StreamAction::Stop);
+			}
+			auto& waiting = reorder->waiting;
+			waiting.emplace(index, std::make_pair(std::move(out), written));
+			for (auto it = waiting.begin(); it != waiting.end() && it->first == reorder->next_index; ) {
+				next->write(std::move(it->second.first));
+				released.emplace_back(std::move(it->second.second));
+				it = waiting.erase(it);
+				reorder->next_index++;
+			}
+		}
+		/* Outside the lock, as freeing a slot may start the next call */
+		const auto action = next->data_action();
+		for (auto& promise : released) {
+			promise->resolve(action);
+		}
+		return written;
+	};
+	/* A failed call never writes, so stop waiting for it */
+	auto failed = [reorder] (std::exception_ptr error) {
+		std::vector<Promise<StreamAction>> released;
+		{
+			std::lock_guard<std::mutex> lock(reorder->mx);
+			reorder->failed = true;
+			for (auto& pair : reorder->waiting) {
+				released.emplace_back(std::move(pair.second.second));
+			}
+			reorder->waiting.clear();
+		}
+		for (auto& promise : released) {
+			promise->resolve(StreamAction::Stop);
+		}
+		return promise::rejected<StreamAction>(error);
+	};
+	auto data = [consumer, writer, failed] (const size_t index, Datum& datum) {
+		Promise<Out> result;
+		try {
+			result = Call::call(consumer, std::move(datum));
+		} catch (...) {
+			return failed(std::current_exception());
+		}
+		return result
+			->then(
+				[writer, index] (Out out) {
+					return writer(index, std::move(out));
+				},
+				failed);
+	};
+	do_indexed_stream(data, max_in_flight)
+		->forward_to(next);
+	return next;
+}
+
 /*** PromiseStream ***/
 
 /* Access stream */
@@ -385,7 +834,14 @@ PromiseStream<Result, Datum>::PromiseStream(std::shared_ptr<PromiseStreamState<R
 
 template <typename Result, typename Datum>
 PromiseStream<Result, Datum>::PromiseStream() :
-	stream(std::make_shared<PromiseStreamState<Result, Datum>>())
+	stream(detail::make_state<PromiseStreamState<Result, Datum>>())
+{
+}
+
+template <typename Result, typename Datum>
+template <typename Alloc>
+PromiseStream<Result, Datum>::PromiseStream(std::allocator_arg_t, const Alloc& alloc) :
+	stream(std::allocate_shared<PromiseStreamState<Result, Datum>>(alloc))
 {
 }
 
@@ -8,4 +8,10 @@ enum class StreamAction {
 	Stop
 };
 
+/* Order of results from a parallel map (see stream_parallel) */
+enum class StreamOrder {
+	ordered,
+	unordered
+};
+
 }
@@ -0,0 +1,161 @@
+#pragma once
+
+namespace kaiu {
+
+namespace detail {
+
+/*
+ * A written datum, constructed in place in a slot from the state pools.  The
+ * slot is passed on by pointer (from the buffer to the consumer call, and to
+ * whichever thread runs it) so the datum is never moved on the way, and the
+ * consumer gets a reference to it.
+ */
+template <typename Datum>
+struct DatumSlot {
+	template <typename... Args>
+	explicit DatumSlot(Args&&... args) :
+		datum(std::forward<Args>(args)...)
+			{ }
+	Datum datum;
+	DatumSlot *next{nullptr};
+};
+
+template <typename Datum>
+struct DatumSlotDeleter {
+	void operator ()(DatumSlot<Datum> *slot) const
+	{
+		using Alloc = state_allocator<DatumSlot<Datum>>;
+		Alloc alloc;
+		std::allocator_traits<Alloc>::destroy(alloc, slot);
+		std::allocator_traits<Alloc>::deallocate(alloc, slot, 1);
+	}
+};
+
+template <typename Datum>
+using DatumSlotPtr = std::unique_ptr<DatumSlot<Datum>, DatumSlotDeleter<Datum>>;
+
+template <typename Datum, typename... Args>
+DatumSlotPtr<Datum> make_datum_slot(Args&&... args)
+{
+	using Alloc = state_allocator<DatumSlot<Datum>>;
+	Alloc alloc;
+	DatumSlot<Datum> *slot = std::allocator_traits<Alloc>::allocate(alloc, 1);
+	try {
+		std::allocator_traits<Alloc>::construct(alloc, slot, std::forward<Args>(args)...);
+	} catch (...) {
+		std::allocator_traits<Alloc>::deallocate(alloc, slot, 1);
+		throw;
+	}
+	return DatumSlotPtr<Datum>(slot);
+}
+
+/* FIFO of slots, linked through the slots themselves */
+template <typename Datum>
+class DatumSlotQueue {
+public:
+	DatumSlotQueue() = default;
+	DatumSlotQueue(const DatumSlotQueue&) = delete;
+	DatumSlotQueue& operator =(const DatumSlotQueue&) = delete;
+	~DatumSlotQueue() { clear(); }
+	bool empty() const { return head == nullptr; }
+	std::size_t size() const { return count; }
+	void push(DatumSlotPtr<Datum> slot)
+	{
+		DatumSlot<Datum> *last = slot.release();
+		if (tail) {
+			tail->next = last;
+		} else {
+			head = last;
+		}
+		tail = last;
+		count++;
+	}
+	/* Only call when not empty */
+	DatumSlotPtr<Datum> pop()
+	{
+		DatumSlotPtr<Datum> first(head);
+		head = head->next;
+		if (!head) {
+			tail = nullptr;
+		}
+		first->next = nullptr;
+		count--;
+		return first;
+	}
+	void clear()
+	{
+		while (!empty()) {
+			pop();
+		}
+	}
+private:
+	DatumSlot<Datum> *head{nullptr};
+	DatumSlot<Datum> *tail{nullptr};
+	std::size_t count{0};
+};
+
+/*
+ * Bounded single-producer single-consumer ring of slots.  The count is the
+ * only variable shared by both sides: the producer publishes a slot by
+ * incrementing it, and learns from its old value whether the ring was empty
+ * (so the consumer needs waking).  Consumer calls may come from any thread,
+ * provided they are serialized (the stream's lock does that).
+ */
+template <typename Datum>
+class DatumSlotRing {
+public:
+	explicit DatumSlotRing(const std::size_t min_size) :
+		mask(round_up(min_size) - 1),
+		cells(new DatumSlot<Datum> *[mask + 1])
+			{ }
+	DatumSlotRing(const DatumSlotRing&) = delete;
+	DatumSlotRing& operator =(const DatumSlotRing&) = delete;
+	~DatumSlotRing() { clear(); }
+	/* Producer: only push if not full, returns true if the ring was empty */
+	bool full() const
+		{ return count.load(std::memory_order_acquire) > mask; }
+	bool push(DatumSlotPtr<Datum> slot)
+	{
+		cells[tail++ & mask] = slot.release();
+		return count.fetch_add(1, std::memory_order_acq_rel) == 0;
+	}
+	/* Consumer: only pop if not empty */
+	bool empty() const
+		{ return count.load(std::memory_order_acquire) == 0; }
+	std::size_t size() const
+		{ return count.load(std::memory_order_acquire); }
+	DatumSlotPtr<Datum> pop()
+	{
+		DatumSlotPtr<Datum> slot(cells[head++ & mask]);
+		count.fetch_sub(1, std::memory_order_release);
+		return slot;
+	}
+	void clear()
+	{
+		while (!empty()) {
+			pop();
+		}
+	}
+private:
+	static std::size_t round_up(const std::size_t size)
+	{
+		std::size_t result = 1;
+		while (result < size) {
+			result <<= 1;
+		}
+		return result;
+	}
+	const std::size_t mask;
+	const std::unique_ptr<DatumSlot<Datum> *[]> cells;
+	/* Keeps each side's index off the other's cache line */
+	char padding0[64];
+	std::size_t tail{0};
+	char padding1[64];
+	std::size_t head{0};
+	char padding2[64];
+	std::atomic<std::size_t> count{0};
+};
+
+}
+
+}
@@ -29,9 +29,39 @@ public:
 	void forward_to(PromiseStream<Result, Datum> next);
 	void forward_to(Promise<Result> next);
 	/*** Used by producer ***/
-	/* Write new data */
+	/* Write new data (ignores the capacity) */
 	template <typename... Args>
 	void write(Args&&...);
+	/*
+	 * Write a range of data with one lock acquisition, moving from an rvalue
+	 * range (ignores the capacity).  A batched consumer receives them in as
+	 * few calls as its batch size allows.
+	 */
+	template <typename Range>
+	void write_bulk(Range&& data);
+	/*
+	 * Limit the number of buffered data, for backpressure (zero, the default,
+	 * for no limit).  Only try_write and write_async honour the limit.
+	 */
+	void set_capacity(std::size_t capacity);
+	/* Write if the buffer has room, returns false (not written) if full */
+	template <typename... Args>
+	bool try_write(Args&&...);
+	/*
+	 * Write once the buffer has room.  The promise resolves with the
+	 * consumer's latest action when the datum has been buffered (or dropped,
+	 * if the consumer stopped), so a producer which waits for it before
+	 * writing again never has more than one datum waiting.
+	 */
+	template <typename... Args>
+	Promise<StreamAction> write_async(Args&&...);
+	/*
+	 * Promise that writes, resolve and reject come from one thread at a time,
+	 * so writes can go to a lock-free ring of (at least) ring_size data.  The
+	 * lock is then only taken to wake the consumer when the ring was empty,
+	 * or when it is full.  Call before the first write.
+	 */
+	void set_single_producer(std::size_t ring_size = 1024);
 	/* Resolve / reject */
 	void resolve(Result result);
 	void reject(std::exception_ptr error);
@@ -42,6 +72,12 @@ public:
 	/* Bind callbacks that don't care about the data */
 	Promise<Result> discard();
 	Promise<Result> stop();
+	/*
+	 * Ask the producer to stop (as if the consumer had returned Stop), now
+	 * or when the token is cancelled
+	 */
+	void request_stop();
+	void stop_on(CancellationToken token);
 	/* Stateless consumer returning promise */
 	template <typename = void, typename Consumer>
 	stream_sel<Consumer, result_of_promise_is, StreamAction, Result, Datum>
@@ -66,11 +102,59 @@ public:
 	template <typename State, typename Consumer, typename... Args>
 	stream_sel<Consumer, result_of_not_promise_is, void, std::pair<State, Result>, State&, Datum>
 		stream(Consumer consumer, Args&&... args);
+	/*
+	 * Parallel consumer (returning void, action, or promise of action): up to
+	 * max_in_flight data are consumed at once, so the consumer must be safe
+	 * to call concurrently.  On an AsyncPromiseStream each call is dispatched
+	 * to the stream pool, otherwise calls are made by the writer and only the
+	 * promises which they return overlap.
+	 */
+	template <typename Consumer>
+	Promise<Result> stream_parallel(Consumer consumer, std::size_t max_in_flight);
+	/*
+	 * Parallel map (consumer returning value or promise of value): results
+	 * are written to the returned stream in the order of the data, or as they
+	 * complete.  Ordered results count against max_in_flight until written.
+	 * Stop/Discard from the returned stream's consumer stops intake, as for
+	 * forward_to.
+	 */
+	template <
+		typename Consumer,
+		typename Out = typename detail::unwrap_promise<
+			typename std::result_of<Consumer(Datum)>::type>::type>
+	PromiseStream<Result, Out> stream_parallel(Consumer consumer,
+		std::size_t max_in_flight, StreamOrder order);
+	/*
+	 * Batched consumer (returning void, action, or promise of action): called
+	 * with everything buffered, up to max_batch data, in order.  The cost of
+	 * a consumer call (its promise and continuation) is paid per batch.
+	 */
+	template <typename Consumer>
+	Promise<Result> stream_batch(Consumer consumer, std::size_t max_batch);
 protected:
 	/* Is data queued? */
 	bool has_data(ensure_locked) const;
-	/* Call the on_data callback */
-	virtual void call_data_callback(ensure_locked, Datum);
+	using Slot = detail::DatumSlotPtr<Datum>;
+	/*
+	 * A consumer call, on one datum (still in its slot) or on a batch.  Small
+	 * enough to be pushed to an event loop without an allocation.
+	 */
+	class ConsumerCall {
+	public:
+		Promise<StreamAction> operator ()();
+	private:
+		friend class PromiseStreamState;
+		PromiseStreamState *state;
+		std::size_t index;
+		Slot slot;
+		std::vector<Datum> batch;
+		explicit ConsumerCall(PromiseStreamState *state) : state(state) { }
+	};
+	/*
+	 * Start a consumer call.  The default runs it here, with the lock held;
+	 * overrides may run it elsewhere instead, without the lock.
+	 */
+	virtual Promise<StreamAction> call_consumer(ensure_locked, ConsumerCall call);
 	/* Bind resolve/reject dispatchers */
 	using completer_func = typename PromiseStreamStateBase::completer_func;
 	virtual completer_func resolve_completer(Result);
@@ -79,27 +163,74 @@ protected:
 	Promise<Result> proxy_promise;
 private:
 	Promise<Result> always(StreamAction);
-	using stream_consumer = std::function<Promise<StreamAction>(Datum)>;
+	/* Consumers are passed the datum in its slot, so take it by rvalue */
+	using stream_consumer = std::function<Promise<StreamAction>(Datum&&)>;
 	template <typename State>
 	using stateful_stream_consumer =
-		std::function<Promise<StreamAction>(State&, Datum)>;
+		std::function<Promise<StreamAction>(State&, Datum&&)>;
 	Promise<Result> do_stream(stream_consumer consumer);
 	template <typename State, typename... Args>
 	Promise<std::pair<State, Result>> do_stateful_stream(
 		stateful_stream_consumer<State> consumer,
 		Args&&... args);
-	using DataFunc = std::function<Promise<StreamAction>(ensure_locked, Datum)>;
+	/* Consumers given the index of the datum (counting data taken) */
+	using DataFunc = std::function<Promise<StreamAction>(std::size_t, Datum&)>;
+	Promise<Result> do_indexed_stream(DataFunc consumer, std::size_t max_consumers);
+	using BatchFunc = std::function<Promise<StreamAction>(std::vector<Datum>)>;
 	/* Buffer */
-	std::queue<Datum> buffer{};
+	detail::DatumSlotQueue<Datum> buffer{};
 	template <typename... Args>
 	void emplace_data(ensure_locked, Args&&...);
-	/* Callbacks */
+	/* Number of data taken from the buffer */
+	std::size_t taken{0};
+	/* Buffer capacity, and writes waiting for room */
+	std::size_t capacity{0};
+	std::deque<std::pair<Slot, Promise<StreamAction>>> waiting_writes{};
+	bool buffer_full(ensure_locked) const;
+	/* Buffer waiting writes while there is room, or drop them if stopped */
+	void admit_waiting_writes(ensure_locked);
+	/*
+	 * Single-producer ring, holding data written since the buffer was last
+	 * written to under the lock (so ring data are always the newest).  The
+	 * producer may use it while ring_open, which is updated under the lock.
+	 */
+	std::unique_ptr<detail::DatumSlotRing<Datum>> ring{};
+	std::atomic<bool> ring_open{false};
+	void update_ring_open(ensure_locked);
+	/* Write to the ring without the lock, returns false if it can't */
+	template <typename... Args>
+	bool ring_write(Args&&...);
+	/* Move data from the ring to the end of the buffer */
+	void drain_ring(ensure_locked);
+	/* Data in buffer and ring, in order of writing */
+	bool data_empty(ensure_locked) const;
+	std::size_t data_size(ensure_locked) const;
+	Slot pop_data(ensure_locked);
+	void clear_data(ensure_locked);
+	void mark_ring_written(ensure_locked);
+	/* Callbacks (one of) */
 	DataFunc on_data{nullptr};
-	void set_data_callback(DataFunc);
+	BatchFunc on_batch{nullptr};
+	std::size_t max_batch{1};
+	void set_data_callback(DataFunc, std::size_t max_consumers);
+	void set_batch_callback(BatchFunc, std::size_t max_batch);
 	/* Call consumer */
 	void process_data(ensure_locked);
-	/* If data is available, moves data into <out> */
-	bool take_data(ensure_locked, Datum& out);
+	void call_data_callback(ensure_locked, ConsumerCall);
+	/*
+	 * The consumer call whose result is being bound, and the caller's lock.  A
+	 * consumer's result callback runs synchronously (with the lock held) only
+	 * if it runs in the calling thread while its call is being bound.  Kept
+	 * here rather than captured, so the callbacks fit inline in the promise.
+	 */
+	std::size_t consumer_calls{0};
+	std::atomic<std::size_t> binding_call{0};
+	self_managing_helper *binding_lock{nullptr};
+	/* Call func(lock, async) with the lock, taking it if completed async */
+	template <typename Func>
+	void with_consumer_lock(std::size_t call_id, std::thread::id caller_id, Func func);
+	/* If data is available, moves its slot into <out> */
+	bool take_data(ensure_locked, Slot& out);
 	/* Capture value and set resolve/reject completer */
 	void do_resolve(ensure_locked, Result);
 	void do_reject(ensure_locked, std::exception_ptr, bool consumer_failed);
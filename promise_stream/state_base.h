@@ -13,7 +13,7 @@ public:
 #if defined(SAFE_PROMISE_STREAMS)
 	~PromiseStreamStateBase() noexcept(false);
 #endif
-	/* Stop has been requested by consumer */
+	/* Stop has been requested by consumer (read without the lock) */
 	bool is_stopping() const;
 	StreamAction data_action() const;
 protected:
@@ -37,9 +37,14 @@ protected:
 	void set_stream_result(ensure_locked, stream_result, completer_func);
 	/* C→D: When buffer is empty */
 	void set_buffer_is_empty(ensure_locked);
-	/* D→E: When consumer is not running */
+	/* D→E: When no consumer is running (true/false start/end one consumer) */
 	void set_consumer_is_running(ensure_locked, bool);
 	bool get_consumer_is_running(ensure_locked) const;
+	/* Number of consumers which may run at once (one unless parallel) */
+	void set_max_consumers(ensure_locked, std::size_t);
+	bool can_start_consumer(ensure_locked) const;
+	/* Remove a callback from a token (e.g. of stop_on) once completed */
+	void remove_on_completion(ensure_locked, CancellationToken token, std::size_t id);
 	/*
 	 * Note: When taking the last data from the
 	 * buffer,
@@ -54,19 +59,24 @@ private:
 	stream_state state{stream_state::pending};
 	/* Validates state transitions */
 	void set_state(ensure_locked, stream_state);
-	/* Action requested by consumer */
-	StreamAction action{StreamAction::Continue};
+	/* Removes the callbacks from their tokens, once the lock is released */
+	void remove_cancel_callbacks(ensure_locked);
+	/* Action requested by consumer (written with the lock held) */
+	std::atomic<StreamAction> action{StreamAction::Continue};
 	/* Stream has been written to */
 	bool stream_has_been_written_to{false};
 	/* Buffer is empty */
 	bool buffer_is_empty{true};
 	/* Has an on_data callback been assigned (in derived class)? */
 	bool data_callback_assigned{false};
-	/* Is consumer running */
-	bool consumer_is_running{false};
+	/* Number of consumers running, and the limit */
+	std::size_t consumers_running{0};
+	std::size_t max_consumers{1};
 	/* Called on completion (bool stores if completer represents rejection) */
 	completer_func completer{nullptr};
 	stream_result result{stream_result::pending};
+	/* Callbacks to remove from cancellation tokens on completion */
+	std::vector<std::pair<CancellationToken, std::size_t>> cancel_callbacks;
 };
 
 }
@@ -13,4 +13,40 @@ public:
 	static constexpr auto value = decltype(check<T>(0))::value;
 };
 
+namespace detail {
+
+/* T, or the result type of T if T is a promise */
+template <typename T>
+struct unwrap_promise { using type = T; };
+
+template <typename T>
+struct unwrap_promise<Promise<T>> { using type = T; };
+
+/* Calls a consumer, wrapping its result in a promise (void → Continue) */
+template <typename T>
+struct consumer_call {
+	template <typename Func, typename Arg>
+	static Promise<T> call(Func& func, Arg&& arg)
+		{ return promise::resolved<T>(func(std::forward<Arg>(arg))); }
+};
+
+template <typename T>
+struct consumer_call<Promise<T>> {
+	template <typename Func, typename Arg>
+	static Promise<T> call(Func& func, Arg&& arg)
+		{ return func(std::forward<Arg>(arg)); }
+};
+
+template <>
+struct consumer_call<void> {
+	template <typename Func, typename Arg>
+	static Promise<StreamAction> call(Func& func, Arg&& arg)
+	{
+		func(std::forward<Arg>(arg));
+		return promise::resolved(StreamAction::Continue);
+	}
+};
+
+}
+
 }
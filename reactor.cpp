@@ -0,0 +1,422 @@
+#include <system_error>
+#include <stdexcept>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include "reactor.h"
+
+namespace kaiu {
+
+using namespace std;
+
+static exception_ptr errno_error(const char *what, const int error = errno)
+{
+	return make_exception_ptr(system_error(error, system_category(), what));
+}
+
+static bool would_block(const int error)
+{
+	return error == EAGAIN || error == EWOULDBLOCK;
+}
+
+/*** Reactor ***/
+
+Reactor::Reactor(ParallelEventLoop& loop, const EventLoopPool pool) :
+	loop(loop), pool(pool)
+{
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd < 0) {
+		throw system_error(errno, system_category(), "epoll_create1");
+	}
+	wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (wake_fd < 0) {
+		const int error = errno;
+		::close(epoll_fd);
+		throw system_error(error, system_category(), "eventfd");
+	}
+	epoll_event event{};
+	event.events = EPOLLIN;
+	event.data.fd = wake_fd;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &event) < 0) {
+		const int error = errno;
+		::close(wake_fd);
+		::close(epoll_fd);
+		throw system_error(error, system_category(), "epoll_ctl");
+	}
+	thread = std::thread(&Reactor::do_reactor_loop, this);
+}
+
+Reactor::~Reactor()
+{
+	const uint64_t one = 1;
+	if (::write(wake_fd, &one, sizeof(one)) < 0) {
+		/* Can only fail if the counter overflows */
+	}
+	thread.join();
+	/* Abort anything still waiting, in the pool like any other rejection */
+	fail(make_exception_ptr(runtime_error("Reactor destroyed")));
+	::close(wake_fd);
+	::close(epoll_fd);
+}
+
+void Reactor::set_nonblocking(const int fd)
+{
+	const int flags = fcntl(fd, F_GETFL);
+	if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+		throw system_error(errno, system_category(), "fcntl");
+	}
+}
+
+void Reactor::do_reactor_loop()
+{
+	epoll_event events[64];
+	vector<Ready> ready;
+	while (true) {
+		const int count = epoll_wait(epoll_fd, events, 64, -1);
+		if (count < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			fail(errno_error("epoll_wait"));
+			return;
+		}
+		/*
+		 * Shutting down: leave every waiter registered (even those whose
+		 * descriptors are ready in this batch) for the destructor to abort
+		 */
+		for (int i = 0; i < count; i++) {
+			if (events[i].data.fd == wake_fd) {
+				return;
+			}
+		}
+		{
+			lock_guard<mutex> lock(watch_mutex);
+			for (int i = 0; i < count; i++) {
+				const int fd = events[i].data.fd;
+				auto it = watches.find(fd);
+				if (it == watches.end()) {
+					continue;
+				}
+				Watch& watch = it->second;
+				/* Errors and hang-ups wake both directions, the retry reports them */
+				const auto flags = events[i].events;
+				if (watch.reader.ready && (flags & (EPOLLIN | EPOLLERR | EPOLLHUP))) {
+					ready.emplace_back(move(watch.reader.ready));
+					watch.reader = Waiter();
+				}
+				if (watch.writer.ready && (flags & (EPOLLOUT | EPOLLERR | EPOLLHUP))) {
+					ready.emplace_back(move(watch.writer.ready));
+					watch.writer = Waiter();
+				}
+				/*
+				 * One-shot registration: re-arm for whatever is still waiting.
+				 * If that fails (e.g. descriptor was closed behind our back),
+				 * retry now so that the operation reports the error.
+				 */
+				try {
+					arm(fd, watch);
+				} catch (...) {
+					for (auto *waiter : { &watch.reader, &watch.writer }) {
+						if (waiter->ready) {
+							ready.emplace_back(move(waiter->ready));
+							*waiter = Waiter();
+						}
+					}
+				}
+			}
+		}
+		vector<EventLoop::Event> retries;
+		retries.reserve(ready.size());
+		for (auto& func : ready) {
+			retries.emplace_back([func = move(func)] (EventLoop&) { func(); });
+		}
+		ready.clear();
+		loop.push_bulk(pool, move(retries));
+	}
+}
+
+void Reactor::fail(exception_ptr error)
+{
+	unordered_map<int, Watch> aborted;
+	{
+		lock_guard<mutex> lock(watch_mutex);
+		failed = error;
+		swap(aborted, watches);
+	}
+	for (auto& pair : aborted) {
+		for (auto *waiter : { &pair.second.reader, &pair.second.writer }) {
+			if (waiter->abort) {
+				loop.push(pool, [abort = move(waiter->abort), error] (EventLoop&) {
+					abort(error);
+				});
+			}
+		}
+	}
+}
+
+void Reactor::arm(const int fd, Watch& watch)
+{
+	epoll_event event{};
+	event.events = EPOLLONESHOT;
+	if (watch.reader.ready) {
+		event.events |= EPOLLIN | EPOLLRDHUP;
+	}
+	if (watch.writer.ready) {
+		event.events |= EPOLLOUT;
+	}
+	event.data.fd = fd;
+	if (event.events == EPOLLONESHOT) {
+		/* Nothing waiting, stays disarmed until next registration */
+		return;
+	}
+	int result = epoll_ctl(epoll_fd, watch.added ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &event);
+	if (result < 0 && watch.added && errno == ENOENT) {
+		/*
+		 * Closed behind our back (which removed it from epoll) and the number
+		 * has since been reused, so register the new descriptor
+		 */
+		result = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+	}
+	if (result < 0) {
+		throw system_error(errno, system_category(), "epoll_ctl");
+	}
+	watch.added = true;
+}
+
+void Reactor::when_ready(const int fd, const bool write, Ready ready, Abort abort)
+{
+	exception_ptr error;
+	{
+		lock_guard<mutex> lock(watch_mutex);
+		Watch& watch = watches[fd];
+		Waiter& waiter = write ? watch.writer : watch.reader;
+		if (failed) {
+			error = failed;
+		} else if (waiter.ready) {
+			error = make_exception_ptr(logic_error("Reactor: operation already pending on descriptor in this direction"));
+		} else {
+			waiter.ready = move(ready);
+			waiter.abort = abort;
+			try {
+				arm(fd, watch);
+			} catch (...) {
+				waiter = Waiter();
+				error = current_exception();
+			}
+		}
+	}
+	/* Failures are reported via abort, outside of the lock */
+	if (error) {
+		abort(error);
+	}
+}
+
+void Reactor::when_readable(const int fd, Ready ready, Abort abort)
+{
+	when_ready(fd, false, move(ready), move(abort));
+}
+
+void Reactor::when_writable(const int fd, Ready ready, Abort abort)
+{
+	when_ready(fd, true, move(ready), move(abort));
+}
+
+void Reactor::close(const int fd)
+{
+	Watch watch;
+	{
+		lock_guard<mutex> lock(watch_mutex);
+		auto it = watches.find(fd);
+		if (it != watches.end()) {
+			watch = move(it->second);
+			watches.erase(it);
+			if (watch.added) {
+				epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+			}
+		}
+	}
+	::close(fd);
+	const auto error = make_exception_ptr(runtime_error("Descriptor closed"));
+	for (auto *waiter : { &watch.reader, &watch.writer }) {
+		if (waiter->abort) {
+			loop.push(pool, [abort = move(waiter->abort), error] (EventLoop&) {
+				abort(error);
+			});
+		}
+	}
+}
+
+/*** Operations ***/
+
+Promise<vector<char>> Reactor::read(const int fd, const size_t max)
+{
+	Promise<vector<char>> promise;
+	loop.push(pool, [this, fd, max, promise] (EventLoop&) {
+		do_read(fd, max, promise);
+	});
+	return promise;
+}
+
+void Reactor::do_read(const int fd, const size_t max, Promise<vector<char>> promise)
+{
+	vector<char> buffer(max);
+	ssize_t count;
+	do {
+		count = ::read(fd, buffer.data(), max);
+	} while (count < 0 && errno == EINTR);
+	if (count >= 0) {
+		buffer.resize(count);
+		promise->resolve(move(buffer));
+	} else if (would_block(errno)) {
+		when_readable(fd,
+			[this, fd, max, promise] { do_read(fd, max, promise); },
+			[promise] (exception_ptr error) { promise->reject(error); });
+	} else {
+		promise->reject(errno_error("read"));
+	}
+}
+
+Promise<size_t> Reactor::write(const int fd, vector<char> data)
+{
+	Promise<size_t> promise;
+	/* Shared so that retries don't copy the buffer */
+	auto buffer = make_shared<vector<char>>(move(data));
+	loop.push(pool, [this, fd, buffer, promise] (EventLoop&) {
+		do_write(fd, buffer, 0, promise);
+	});
+	return promise;
+}
+
+void Reactor::do_write(const int fd, shared_ptr<vector<char>> data, size_t offset, Promise<size_t> promise)
+{
+	while (offset < data->size()) {
+		/* send avoids SIGPIPE for sockets, write is needed for everything else */
+		ssize_t count = send(fd, data->data() + offset, data->size() - offset, MSG_NOSIGNAL);
+		if (count < 0 && errno == ENOTSOCK) {
+			count = ::write(fd, data->data() + offset, data->size() - offset);
+		}
+		if (count >= 0) {
+			offset += count;
+		} else if (errno == EINTR) {
+			continue;
+		} else if (would_block(errno)) {
+			when_writable(fd,
+				[this, fd, data, offset, promise] { do_write(fd, data, offset, promise); },
+				[promise] (exception_ptr error) { promise->reject(error); });
+			return;
+		} else {
+			promise->reject(errno_error("write"));
+			return;
+		}
+	}
+	promise->resolve(offset);
+}
+
+Promise<int> Reactor::accept(const int fd)
+{
+	Promise<int> promise;
+	loop.push(pool, [this, fd, promise] (EventLoop&) {
+		do_accept(fd, promise);
+	});
+	return promise;
+}
+
+void Reactor::do_accept(const int fd, Promise<int> promise)
+{
+	int client;
+	do {
+		client = accept4(fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	} while (client < 0 && errno == EINTR);
+	if (client >= 0) {
+		promise->resolve(client);
+	} else if (would_block(errno)) {
+		when_readable(fd,
+			[this, fd, promise] { do_accept(fd, promise); },
+			[promise] (exception_ptr error) { promise->reject(error); });
+	} else {
+		promise->reject(errno_error("accept"));
+	}
+}
+
+Promise<nullptr_t> Reactor::connect(const int fd, const sockaddr *addr, const socklen_t addr_len)
+{
+	Promise<nullptr_t> promise;
+	/* Copy the address, the caller's may not outlive the operation */
+	sockaddr_storage storage;
+	memcpy(&storage, addr, min<size_t>(addr_len, sizeof(storage)));
+	loop.push(pool, [this, fd, storage, addr_len, promise] (EventLoop&) {
+		int result;
+		do {
+			result = ::connect(fd, reinterpret_cast<const sockaddr *>(&storage), addr_len);
+		} while (result < 0 && errno == EINTR);
+		if (result == 0) {
+			promise->resolve(nullptr);
+		} else if (errno == EINPROGRESS) {
+			auto completed = [fd, promise] {
+				int error = 0;
+				socklen_t len = sizeof(error);
+				if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len) < 0) {
+					error = errno;
+				}
+				if (error) {
+					promise->reject(errno_error("connect", error));
+				} else {
+					promise->resolve(nullptr);
+				}
+			};
+			when_writable(fd, completed,
+				[promise] (exception_ptr error) { promise->reject(error); });
+		} else {
+			promise->reject(errno_error("connect"));
+		}
+	});
+	return promise;
+}
+
+PromiseStream<size_t, vector<char>> Reactor::read_stream(const int fd, const size_t block_size)
+{
+	PromiseStream<size_t, vector<char>> stream;
+	loop.push(pool, [this, fd, block_size, stream] (EventLoop&) {
+		do_read_stream(fd, block_size, stream, 0);
+	});
+	return stream;
+}
+
+void Reactor::do_read_stream(const int fd, const size_t block_size, PromiseStream<size_t, vector<char>> stream, const size_t total)
+{
+	if (stream->is_stopping()) {
+		stream->resolve(total);
+		return;
+	}
+	vector<char> buffer(block_size);
+	ssize_t count;
+	do {
+		count = ::read(fd, buffer.data(), block_size);
+	} while (count < 0 && errno == EINTR);
+	if (count > 0) {
+		buffer.resize(count);
+		stream->write(move(buffer));
+		/*
+		 * Next block is read in a new event, so one busy descriptor can't
+		 * hog a pool thread.  Only one read is in flight per stream, so
+		 * blocks are written in order.
+		 */
+		const size_t next_total = total + count;
+		loop.push(pool, [this, fd, block_size, stream, next_total] (EventLoop&) {
+			do_read_stream(fd, block_size, stream, next_total);
+		});
+	} else if (count == 0) {
+		stream->resolve(total);
+	} else if (would_block(errno)) {
+		when_readable(fd,
+			[this, fd, block_size, stream, total] { do_read_stream(fd, block_size, stream, total); },
+			[stream] (exception_ptr error) { stream->reject(error); });
+	} else {
+		stream->reject(errno_error("read"));
+	}
+}
+
+}
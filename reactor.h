@@ -0,0 +1,102 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+#include <unordered_map>
+#include <functional>
+#include <exception>
+#include <thread>
+#include <mutex>
+#include <sys/socket.h>
+#include "event_loop.h"
+#include "promise.h"
+#include "promise_stream.h"
+
+namespace kaiu {
+
+
+/*
+ * I/O reactor built on epoll, for non-blocking file descriptors (sockets,
+ * pipes, etc).
+ *
+ * One thread waits on epoll for all registered descriptors.  Operations are
+ * attempted in a pool of the event loop; when one would block, the descriptor
+ * is registered with epoll and the operation is retried in the pool once the
+ * descriptor becomes ready.  So thousands of concurrent connections need one
+ * reactor thread, rather than one blocked pool thread each.
+ *
+ * Promises are resolved/rejected, and stream data is written, in the pool.
+ *
+ * At most one read-type operation (read/accept/read_stream) and one write-type
+ * operation (write/connect) may be pending per descriptor at any time.
+ *
+ * The event loop must outlive the reactor, and the reactor must not be
+ * destroyed while operations are being attempted in the pool (e.g. destroy it
+ * after ParallelEventLoop::join).  Operations still waiting for their
+ * descriptor are rejected when the reactor is destroyed, or if waiting on
+ * epoll fails (as are any operations which would wait after that).
+ */
+class Reactor {
+public:
+	Reactor(const Reactor&) = delete;
+	Reactor& operator =(const Reactor&) = delete;
+	explicit Reactor(ParallelEventLoop& loop, const EventLoopPool pool = EventLoopPool::reactor);
+	/* Rejects any pending operations (in the pool) */
+	~Reactor();
+	/* Read up to max bytes, resolves to an empty buffer at end of file */
+	Promise<std::vector<char>> read(const int fd, const size_t max);
+	/* Write all of data, resolves to the number of bytes written */
+	Promise<size_t> write(const int fd, std::vector<char> data);
+	/* Accept a connection, resolves to the new (non-blocking) descriptor */
+	Promise<int> accept(const int fd);
+	/* Connect a non-blocking socket */
+	Promise<std::nullptr_t> connect(const int fd, const sockaddr *addr, const socklen_t addr_len);
+	/*
+	 * Stream blocks of up to block_size bytes until end of file or until the
+	 * consumer stops the stream.  Resolves to the total number of bytes read.
+	 */
+	PromiseStream<size_t, std::vector<char>> read_stream(const int fd, const size_t block_size);
+	/* Reject any pending operations on fd, then close it */
+	void close(const int fd);
+	/*
+	 * Low-level: call ready (in the pool) once fd is readable/writable, or
+	 * abort if the descriptor is closed via the reactor first.
+	 */
+	using Ready = std::function<void()>;
+	using Abort = std::function<void(std::exception_ptr)>;
+	void when_readable(const int fd, Ready ready, Abort abort);
+	void when_writable(const int fd, Ready ready, Abort abort);
+	/* Put a descriptor into non-blocking mode */
+	static void set_nonblocking(const int fd);
+private:
+	struct Waiter {
+		Ready ready{nullptr};
+		Abort abort{nullptr};
+	};
+	struct Watch {
+		Waiter reader;
+		Waiter writer;
+		bool added{false};
+	};
+	ParallelEventLoop& loop;
+	const EventLoopPool pool;
+	int epoll_fd{-1};
+	/* Wakes the reactor thread for shutdown */
+	int wake_fd{-1};
+	std::mutex watch_mutex;
+	std::unordered_map<int, Watch> watches;
+	/* Set if the reactor thread failed, later operations are aborted with it */
+	std::exception_ptr failed;
+	std::thread thread;
+	void do_reactor_loop();
+	/* Abort everything waiting and stop accepting waiters */
+	void fail(std::exception_ptr error);
+	void when_ready(const int fd, const bool write, Ready ready, Abort abort);
+	/* Call with watch_mutex held */
+	void arm(const int fd, Watch& watch);
+	void do_read(const int fd, const size_t max, Promise<std::vector<char>> promise);
+	void do_write(const int fd, std::shared_ptr<std::vector<char>> data, const size_t offset, Promise<size_t> promise);
+	void do_accept(const int fd, Promise<int> promise);
+	void do_read_stream(const int fd, const size_t block_size, PromiseStream<size_t, std::vector<char>> stream, const size_t total);
+};
+
+}
@@ -1,6 +1,9 @@
 #pragma once
 #include <mutex>
 #include <memory>
+#include <vector>
+#include <functional>
+#include <exception>
 
 namespace kaiu {
 
@@ -22,7 +25,11 @@ protected:
 		/* Move constructor */
 		self_managing_helper(self_managing_helper&& from) = default;
 		self_managing_helper& operator =(self_managing_helper&& from) = default;
-		~self_managing_helper()
+		/*
+		 * Throws the first exception thrown by the functions deferred by
+		 * after_unlock, once they have all run (unless already unwinding)
+		 */
+		~self_managing_helper() noexcept(false)
 		{
 			if (lock) {
 				lock.unlock();
@@ -32,6 +39,23 @@ protected:
 			if (immortality) {
 				immortality->reset();
 			}
+			std::exception_ptr error;
+			for (auto& func : deferred) {
+				try {
+					func();
+				} catch (...) {
+					if (!error) {
+						error = std::current_exception();
+					}
+				}
+			}
+#if __cplusplus >= 201703L
+			if (error && std::uncaught_exceptions() == 0) {
+#else
+			if (error && !std::uncaught_exception()) {
+#endif
+				std::rethrow_exception(error);
+			}
 		}
 	private:
 		friend class self_managing;
@@ -46,6 +70,8 @@ protected:
 		 */
 		struct noop_deleter { void operator () (void const * const) const { } };
 		std::unique_ptr<std::shared_ptr<self_managing>, noop_deleter> immortality;
+		/* Run after the lock is released, see after_unlock */
+		std::vector<std::function<void()>> deferred;
 		/*
 		 * Instructs this helper to reset this shared_ptr when the lock helper
 		 * destroyed (lock may be released prior to then by unlock() method.
@@ -103,6 +129,15 @@ protected:
 	{
 		lock.clear_ptr_at_end_of_lock_scope(self_reference);
 	}
+	/*
+	 * Run a function at the end of the lock scope, after the lock has been
+	 * released, e.g. to complete a promise whose callbacks may take the lock
+	 * again.  The function must not rely on this object still existing.
+	 */
+	void after_unlock(ensure_locked lock, std::function<void()> func)
+	{
+		lock.deferred.emplace_back(std::move(func));
+	}
 private:
 	mutable std::mutex mx;
 	std::shared_ptr<self_managing> self_reference;
@@ -0,0 +1,210 @@
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <cstdint>
+#include <cstdlib>
+#include "slab_pool.h"
+
+namespace kaiu {
+
+using namespace std;
+
+constexpr size_t SlabPool::granularity;
+constexpr size_t SlabPool::max_size;
+constexpr size_t SlabPool::slab_size;
+
+namespace {
+
+constexpr size_t classes = SlabPool::max_size / SlabPool::granularity;
+
+constexpr size_t size_class(const size_t size)
+{
+	return size ? (size - 1) / SlabPool::granularity : 0;
+}
+
+struct Block {
+	Block *next;
+};
+
+struct Cache;
+
+/*
+ * Header at the start of each slab.  Slabs are aligned to their size, so a
+ * block finds its slab (and the cache which owns it) by masking its address.
+ */
+struct alignas(64) Slab {
+	Cache *owner;
+};
+
+struct Cache {
+	void *allocate(const size_t cls);
+	void free_local(void *p, const size_t cls);
+	void free_remote(void *p, const size_t cls);
+	/* Only touched by the thread which holds the cache */
+	Block *local[classes]{};
+	char *bump[classes]{};
+	char *bump_end[classes]{};
+	/* Keeps the remote lists off the holder's cache lines */
+	char padding[64];
+	/* Pushed to by other threads, taken in one swap by the holder */
+	atomic<Block *> remote[classes];
+	/* Link in the list of caches not held by any thread */
+	Cache *next_idle{nullptr};
+	Cache();
+};
+
+mutex registry_lock;
+Cache *idle_caches{nullptr};
+atomic<size_t> slab_count{0};
+
+Cache::Cache()
+{
+	for (auto& head : remote) {
+		head.store(nullptr, memory_order_relaxed);
+	}
+}
+
+void *Cache::allocate(const size_t cls)
+{
+	Block *block = local[cls];
+	if (!block) {
+		block = remote[cls].exchange(nullptr, memory_order_acquire);
+	}
+	if (block) {
+		local[cls] = block->next;
+		return block;
+	}
+	const size_t size = (cls + 1) * SlabPool::granularity;
+	if (bump[cls] + size > bump_end[cls]) {
+		void *memory;
+		if (posix_memalign(&memory, SlabPool::slab_size, SlabPool::slab_size) != 0) {
+			throw bad_alloc();
+		}
+		slab_count.fetch_add(1, memory_order_relaxed);
+		Slab *slab = new (memory) Slab;
+		slab->owner = this;
+		bump[cls] = static_cast<char *>(memory) + sizeof(Slab);
+		bump_end[cls] = static_cast<char *>(memory) + SlabPool::slab_size;
+	}
+	void *p = bump[cls];
+	bump[cls] += size;
+	return p;
+}
+
+void Cache::free_local(void *p, const size_t cls)
+{
+	Block *block = static_cast<Block *>(p);
+	block->next = local[cls];
+	local[cls] = block;
+}
+
+void Cache::free_remote(void *p, const size_t cls)
+{
+	Block *block = static_cast<Block *>(p);
+	Block *head = remote[cls].load(memory_order_relaxed);
+	do {
+		block->next = head;
+	} while (!remote[cls].compare_exchange_weak(head, block, memory_order_release, memory_order_relaxed));
+}
+
+/* Call with registry_lock held */
+Cache *take_idle_cache()
+{
+	Cache *cache = idle_caches;
+	if (cache) {
+		idle_caches = cache->next_idle;
+		cache->next_idle = nullptr;
+		return cache;
+	}
+	return new Cache();
+}
+
+/* Call with registry_lock held */
+void return_idle_cache(Cache *cache)
+{
+	cache->next_idle = idle_caches;
+	idle_caches = cache;
+}
+
+/*
+ * The cache held by this thread.  Null before the first allocation and after
+ * the thread has begun exiting, when the holder has been destroyed.
+ */
+thread_local Cache *current{nullptr};
+thread_local bool exiting{false};
+
+struct CacheHolder {
+	CacheHolder()
+	{
+		lock_guard<mutex> lock(registry_lock);
+		current = take_idle_cache();
+	}
+	~CacheHolder()
+	{
+		lock_guard<mutex> lock(registry_lock);
+		return_idle_cache(current);
+		current = nullptr;
+		exiting = true;
+	}
+};
+
+Cache *thread_cache()
+{
+	if (!current && !exiting) {
+		static thread_local CacheHolder holder;
+	}
+	return current;
+}
+
+Cache *slab_owner(void *p)
+{
+	const auto address = reinterpret_cast<uintptr_t>(p) & ~uintptr_t(SlabPool::slab_size - 1);
+	return reinterpret_cast<Slab *>(address)->owner;
+}
+
+}
+
+void *SlabPool::allocate(const size_t size)
+{
+	if (size > max_size) {
+		return ::operator new(size);
+	}
+	const size_t cls = size_class(size);
+	if (Cache *cache = thread_cache()) {
+		return cache->allocate(cls);
+	}
+	/* Thread is exiting: borrow an idle cache for this allocation */
+	lock_guard<mutex> lock(registry_lock);
+	Cache *cache = take_idle_cache();
+	void *p;
+	try {
+		p = cache->allocate(cls);
+	} catch (...) {
+		return_idle_cache(cache);
+		throw;
+	}
+	return_idle_cache(cache);
+	return p;
+}
+
+void SlabPool::deallocate(void *p, const size_t size) noexcept
+{
+	if (size > max_size) {
+		::operator delete(p);
+		return;
+	}
+	const size_t cls = size_class(size);
+	Cache *owner = slab_owner(p);
+	if (owner == current) {
+		owner->free_local(p, cls);
+	} else {
+		owner->free_remote(p, cls);
+	}
+}
+
+size_t SlabPool::slabs()
+{
+	return slab_count.load(memory_order_relaxed);
+}
+
+}
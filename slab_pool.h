@@ -0,0 +1,66 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+
+namespace kaiu {
+
+/*
+ * Per-thread slab allocator for small, short-lived objects (promise and
+ * promise stream states).
+ *
+ * Sizes are rounded up to a multiple of granularity, each size class has its
+ * own slabs.  Each thread owns a cache of slabs: allocation and freeing by the
+ * owning thread touch only that thread's free lists, so take no lock and no
+ * atomic read-modify-write.  A block freed by another thread is pushed onto
+ * the owner's lock-free remote free list, which the owner takes in one swap
+ * when its local list runs dry.
+ *
+ * Slabs are never returned to the system.  When a thread exits, its cache
+ * (with its slabs and free lists) is handed to the next thread that starts
+ * allocating, so memory is bounded by the peak in use rather than by the
+ * number of threads ever started.
+ *
+ * Sizes over max_size are passed to operator new.
+ */
+class SlabPool {
+public:
+	static constexpr std::size_t granularity = 16;
+	static constexpr std::size_t max_size = 512;
+	static constexpr std::size_t slab_size = 64 << 10;
+	static void *allocate(const std::size_t size);
+	static void deallocate(void *p, const std::size_t size) noexcept;
+	/* Number of slabs allocated so far, by all threads */
+	static std::size_t slabs();
+};
+
+/*
+ * Standard allocator over SlabPool, for use with std::allocate_shared.
+ *
+ * Stateless, so all instances compare equal.  Over-aligned types and arrays
+ * too large for the pool fall back to std::allocator.
+ */
+template <typename T>
+class SlabAllocator {
+public:
+	using value_type = T;
+	SlabAllocator() noexcept = default;
+	template <typename U>
+	SlabAllocator(const SlabAllocator<U>&) noexcept { }
+	T *allocate(const std::size_t n);
+	void deallocate(T *p, const std::size_t n) noexcept;
+private:
+	static bool pooled(const std::size_t n)
+		{ return alignof(T) <= SlabPool::granularity && n <= SlabPool::max_size / sizeof(T); }
+};
+
+template <typename T, typename U>
+bool operator ==(const SlabAllocator<T>&, const SlabAllocator<U>&) { return true; }
+
+template <typename T, typename U>
+bool operator !=(const SlabAllocator<T>&, const SlabAllocator<U>&) { return false; }
+
+}
+
+#ifndef slab_pool_tcc
+#include "slab_pool.tcc"
+#endif
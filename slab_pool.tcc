@@ -0,0 +1,25 @@
+#define slab_pool_tcc
+#include "slab_pool.h"
+
+namespace kaiu {
+
+template <typename T>
+T *SlabAllocator<T>::allocate(const std::size_t n)
+{
+	if (!pooled(n)) {
+		return std::allocator<T>().allocate(n);
+	}
+	return static_cast<T *>(SlabPool::allocate(n * sizeof(T)));
+}
+
+template <typename T>
+void SlabAllocator<T>::deallocate(T *p, const std::size_t n) noexcept
+{
+	if (!pooled(n)) {
+		std::allocator<T>().deallocate(p, n);
+		return;
+	}
+	SlabPool::deallocate(p, n * sizeof(T));
+}
+
+}
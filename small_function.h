@@ -0,0 +1,75 @@
+#pragma once
+#include <cstddef>
+#include <functional>
+#include <type_traits>
+#include <utility>
+
+namespace kaiu {
+
+
+/*
+ * Move-only polymorphic function wrapper with small-buffer optimisation.
+ *
+ * Callables which fit in Capacity bytes (and which can be moved without
+ * throwing) are stored inline, so wrapping them costs no heap allocation.
+ * Larger callables are moved into a single heap block.
+ *
+ * Unlike std::function, the callable does not need to be copyable, so lambdas
+ * which capture move-only values (e.g. by init-capture) can be stored without
+ * a shared_functor wrapper.
+ */
+template <typename Signature, std::size_t Capacity = 6 * sizeof(void *)>
+class SmallFunction;
+
+template <typename Result, typename... Args, std::size_t Capacity>
+class SmallFunction<Result(Args...), Capacity> {
+	template <typename Func>
+	using is_inlineable = std::integral_constant<bool,
+		sizeof(Func) <= Capacity &&
+		alignof(Func) <= alignof(std::max_align_t) &&
+		std::is_nothrow_move_constructible<Func>::value>;
+	template <typename Func>
+	using enable_if_callable = typename std::enable_if<
+		!std::is_same<typename std::decay<Func>::type, SmallFunction>::value &&
+		!std::is_same<typename std::decay<Func>::type, std::nullptr_t>::value
+	>::type;
+public:
+	static constexpr std::size_t capacity = Capacity;
+	SmallFunction() noexcept = default;
+	SmallFunction(std::nullptr_t) noexcept { }
+	template <typename Func, typename = enable_if_callable<Func>>
+	SmallFunction(Func&& func);
+	/* Move-only */
+	SmallFunction(const SmallFunction&) = delete;
+	SmallFunction& operator =(const SmallFunction&) = delete;
+	SmallFunction(SmallFunction&& from) noexcept;
+	SmallFunction& operator =(SmallFunction&& from) noexcept;
+	SmallFunction& operator =(std::nullptr_t) noexcept;
+	~SmallFunction();
+	/* Invoke the stored callable, throws std::bad_function_call if empty */
+	Result operator ()(Args... args);
+	explicit operator bool() const noexcept { return ops != nullptr; }
+	/* True if the callable is stored inline (i.e. was not heap-allocated) */
+	bool is_inline() const noexcept { return ops != nullptr && ops->is_inline; }
+private:
+	struct Ops {
+		Result (*invoke)(void *, Args&&...);
+		/* Move-construct into uninitialised storage and destroy source */
+		void (*relocate)(void *from, void *to) noexcept;
+		void (*destroy)(void *) noexcept;
+		bool is_inline;
+	};
+	template <typename Func>
+	struct InlineOps;
+	template <typename Func>
+	struct HeapOps;
+	typename std::aligned_storage<Capacity, alignof(std::max_align_t)>::type storage;
+	const Ops *ops{nullptr};
+	void reset() noexcept;
+};
+
+}
+
+#ifndef small_function_tcc
+#include "small_function.tcc"
+#endif
@@ -0,0 +1,141 @@
+#define small_function_tcc
+#include <new>
+#include "small_function.h"
+
+namespace kaiu {
+
+
+/* Callable stored in the object's own buffer */
+template <typename Result, typename... Args, std::size_t Capacity>
+template <typename Func>
+struct SmallFunction<Result(Args...), Capacity>::InlineOps {
+	template <typename From>
+	static void construct(void *storage, From&& func)
+	{
+		new (storage) Func(std::forward<From>(func));
+	}
+	static Result invoke(void *storage, Args&&... args)
+	{
+		return (*static_cast<Func *>(storage))(std::forward<Args>(args)...);
+	}
+	static void relocate(void *from, void *to) noexcept
+	{
+		Func& func = *static_cast<Func *>(from);
+		new (to) Func(std::move(func));
+		func.~Func();
+	}
+	static void destroy(void *storage) noexcept
+	{
+		static_cast<Func *>(storage)->~Func();
+	}
+	static constexpr Ops ops{ invoke, relocate, destroy, true };
+};
+
+template <typename Result, typename... Args, std::size_t Capacity>
+template <typename Func>
+constexpr typename SmallFunction<Result(Args...), Capacity>::Ops
+	SmallFunction<Result(Args...), Capacity>::InlineOps<Func>::ops;
+
+/* Callable stored on the heap, the buffer holds a pointer to it */
+template <typename Result, typename... Args, std::size_t Capacity>
+template <typename Func>
+struct SmallFunction<Result(Args...), Capacity>::HeapOps {
+	template <typename From>
+	static void construct(void *storage, From&& func)
+	{
+		new (storage) Func *(new Func(std::forward<From>(func)));
+	}
+	static Func *& ptr(void *storage)
+	{
+		return *static_cast<Func **>(storage);
+	}
+	static Result invoke(void *storage, Args&&... args)
+	{
+		return (*ptr(storage))(std::forward<Args>(args)...);
+	}
+	static void relocate(void *from, void *to) noexcept
+	{
+		new (to) Func *(ptr(from));
+	}
+	static void destroy(void *storage) noexcept
+	{
+		delete ptr(storage);
+	}
+	static constexpr Ops ops{ invoke, relocate, destroy, false };
+};
+
+template <typename Result, typename... Args, std::size_t Capacity>
+template <typename Func>
+constexpr typename SmallFunction<Result(Args...), Capacity>::Ops
+	SmallFunction<Result(Args...), Capacity>::HeapOps<Func>::ops;
+
+template <typename Result, typename... Args, std::size_t Capacity>
+template <typename Func, typename>
+SmallFunction<Result(Args...), Capacity>::SmallFunction(Func&& func)
+{
+	using F = typename std::decay<Func>::type;
+	using Store = typename std::conditional<is_inlineable<F>::value,
+		InlineOps<F>, HeapOps<F>>::type;
+	static_assert(sizeof(F *) <= Capacity, "SmallFunction capacity is too small to hold a pointer");
+	Store::construct(&storage, std::forward<Func>(func));
+	ops = &Store::ops;
+}
+
+template <typename Result, typename... Args, std::size_t Capacity>
+SmallFunction<Result(Args...), Capacity>::SmallFunction(SmallFunction&& from) noexcept
+{
+	if (from.ops) {
+		from.ops->relocate(&from.storage, &storage);
+		ops = from.ops;
+		from.ops = nullptr;
+	}
+}
+
+template <typename Result, typename... Args, std::size_t Capacity>
+auto SmallFunction<Result(Args...), Capacity>::operator =(SmallFunction&& from) noexcept
+	-> SmallFunction&
+{
+	if (this != &from) {
+		reset();
+		if (from.ops) {
+			from.ops->relocate(&from.storage, &storage);
+			ops = from.ops;
+			from.ops = nullptr;
+		}
+	}
+	return *this;
+}
+
+template <typename Result, typename... Args, std::size_t Capacity>
+auto SmallFunction<Result(Args...), Capacity>::operator =(std::nullptr_t) noexcept
+	-> SmallFunction&
+{
+	reset();
+	return *this;
+}
+
+template <typename Result, typename... Args, std::size_t Capacity>
+SmallFunction<Result(Args...), Capacity>::~SmallFunction()
+{
+	reset();
+}
+
+template <typename Result, typename... Args, std::size_t Capacity>
+void SmallFunction<Result(Args...), Capacity>::reset() noexcept
+{
+	if (ops) {
+		ops->destroy(&storage);
+		ops = nullptr;
+	}
+}
+
+template <typename Result, typename... Args, std::size_t Capacity>
+Result SmallFunction<Result(Args...), Capacity>::operator ()(Args... args)
+{
+	if (!ops) {
+		throw std::bad_function_call();
+	}
+	return ops->invoke(&storage, std::forward<Args>(args)...);
+}
+
+}
@@ -4,6 +4,7 @@
 #include "event_loop.h"
 #include "promise.h"
 #include "functional.h"
+#include "cancellation.h"
 
 namespace kaiu {
 
@@ -53,6 +54,13 @@ namespace promise {
  *   ...
  *   auto ping_logger = logger << "info" << "ping!";
  *   ping_logger();
+ *
+ * A task may be given a cancellation token.  Once the token is cancelled,
+ * calls which have not yet started running in the action pool never run:
+ * their arguments are released at once and their promises are rejected with
+ * cancelled_error in the reaction pool (the action pool if that is "same" too,
+ * or the cancelling thread if both are "same").  A call which is already
+ * running completes as usual, but the action may check the token itself.
  */
 
 template <typename Result, typename... Args>
@@ -67,7 +75,8 @@ template <typename Result, typename... Args>
 UnboundTask<Result, Args...> task(
 	Factory<Result, Args...> factory,
 	const EventLoopPool action_pool,
-	const EventLoopPool reaction_pool = EventLoopPool::same);
+	const EventLoopPool reaction_pool = EventLoopPool::same,
+	const CancellationToken token = {});
 
 /* Parameter is a function, result is a task */
 
@@ -75,15 +84,17 @@ template <typename Result, typename... Args>
 UnboundTask<Result, Args...> dispatchable(
 	std::function<Result(Args...)> func,
 	const EventLoopPool action_pool,
-	const EventLoopPool reaction_pool = EventLoopPool::same)
-		{ return task(factory(func), action_pool, reaction_pool); }
+	const EventLoopPool reaction_pool = EventLoopPool::same,
+	const CancellationToken token = {})
+		{ return task(factory(func), action_pool, reaction_pool, token); }
 
 template <typename Result, typename... Args>
 UnboundTask<Result, Args...> dispatchable(
 	Result (&func)(Args...),
 	const EventLoopPool action_pool,
-	const EventLoopPool reaction_pool = EventLoopPool::same)
-		{ return task(factory(func), action_pool, reaction_pool); }
+	const EventLoopPool reaction_pool = EventLoopPool::same,
+	const CancellationToken token = {})
+		{ return task(factory(func), action_pool, reaction_pool, token); }
 
 /* Parameter is a function, it is task-wrapped and immediately executed */
 
@@ -107,6 +118,30 @@ Promise<Result> dispatch(
 		{ return task(factory(func), action_pool, reaction_pool)
 			(loop, std::forward<Args>(args)...); }
 
+/* As above, cancellable */
+
+template <typename Result, typename... Args>
+Promise<Result> dispatch(
+	std::function<Result(Args...)> func,
+	const EventLoopPool action_pool,
+	const EventLoopPool reaction_pool,
+	const CancellationToken token,
+	EventLoop& loop,
+	Args&&... args)
+		{ return task(factory(func), action_pool, reaction_pool, token)
+			(loop, std::forward<Args>(args)...); }
+
+template <typename Result, typename... Args>
+Promise<Result> dispatch(
+	Result (&func)(Args...),
+	const EventLoopPool action_pool,
+	const EventLoopPool reaction_pool,
+	const CancellationToken token,
+	EventLoop& loop,
+	Args&&... args)
+		{ return task(factory(func), action_pool, reaction_pool, token)
+			(loop, std::forward<Args>(args)...); }
+
 }
 
 namespace task_monad {
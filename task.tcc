@@ -1,18 +1,37 @@
 #define task_tcc
-#include "shared_functor.h"
+#include <atomic>
+#include <memory>
 #include "task.h"
 
 namespace kaiu {
 
 namespace promise {
 
+namespace detail {
+
+/* Holds a callable until it is taken, by whichever of run/cancel is first */
+template <typename Func>
+class TakeOnce {
+public:
+	explicit TakeOnce(Func func) : func(new Func(std::move(func))) { }
+	TakeOnce(const TakeOnce&) = delete;
+	TakeOnce& operator =(const TakeOnce&) = delete;
+	~TakeOnce() { delete func.load(); }
+	std::unique_ptr<Func> take() { return std::unique_ptr<Func>(func.exchange(nullptr)); }
+private:
+	std::atomic<Func *> func;
+};
+
+}
+
 template <typename Result, typename... Args>
 UnboundTask<Result, Args...> task(
 	Factory<Result, Args...> factory,
 	const EventLoopPool action_pool,
-	const EventLoopPool reaction_pool)
+	const EventLoopPool reaction_pool,
+	const CancellationToken token)
 {
-	auto newFactory = [factory, action_pool, reaction_pool]
+	auto newFactory = [factory, action_pool, reaction_pool, token]
 		(EventLoop& loop, Args... args) {
 		Promise<Result> promise;
 		auto action = [factory, promise, reaction_pool, args...]
@@ -21,18 +40,51 @@ UnboundTask<Result, Args...> task(
 				auto proxy = [promise, result = std::move(result)] (EventLoop&) mutable {
 					promise->resolve(std::move(result));
 				};
-				loop.push(reaction_pool, detail::make_shared_functor(proxy));
+				loop.push(reaction_pool, std::move(proxy));
 			};
 			auto reject = [promise, reaction_pool, &loop] (std::exception_ptr error) {
 				auto proxy = [promise, error] (EventLoop&) {
 					promise->reject(error);
 				};
-				loop.push(reaction_pool, proxy);
+				loop.push(reaction_pool, std::move(proxy));
 			};
 			factory(args...)
 				->then(resolve, reject);
 		};
-		loop.push(action_pool, action);
+		if (!token.can_cancel()) {
+			loop.push(action_pool, std::move(action));
+			return promise;
+		}
+		if (token.is_cancelled()) {
+			promise->reject(CancellationToken::error());
+			return promise;
+		}
+		/*
+		 * Running and cancelling both take the action from the slot, so only
+		 * one of them gets it, and cancelling releases the action's captures
+		 * at once rather than when its queued event gets a turn.
+		 */
+		auto slot = std::make_shared<detail::TakeOnce<decltype(action)>>(std::move(action));
+		const auto cancel_pool = reaction_pool != EventLoopPool::same ? reaction_pool : action_pool;
+		const auto id = token.on_cancel([slot, promise, cancel_pool, &loop] {
+			if (!slot->take()) {
+				return;
+			}
+			auto proxy = [promise] (EventLoop&) {
+				promise->reject(CancellationToken::error());
+			};
+			if (cancel_pool != EventLoopPool::same) {
+				loop.push(cancel_pool, std::move(proxy));
+			} else {
+				proxy(loop);
+			}
+		});
+		loop.push(action_pool, [slot, token, id] (EventLoop& loop) {
+			if (auto action = slot->take()) {
+				token.remove(id);
+				(*action)(loop);
+			}
+		});
 		return promise;
 	};
 	return curry_wrap<Promise<Result>, sizeof...(Args) + 1, Factory<Result, EventLoop&, Args...>>(newFactory);
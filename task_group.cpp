@@ -0,0 +1,211 @@
+#include <cstdint>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <algorithm>
+#include "task_group.h"
+
+namespace kaiu {
+
+using namespace std;
+
+struct TaskGroup::State {
+	explicit State(EventLoop& loop) : loop(loop) { }
+	EventLoop& loop;
+	struct Task {
+		EventLoopPool pool;
+		uint64_t id;
+		EventLoop::Event event;
+	};
+	mutex lock;
+	/* Notified when a task is spawned and when the group becomes idle */
+	condition_variable changed;
+	deque<Task> tasks;
+	uint64_t next_id{0};
+	/* Tasks spawned which have not finished */
+	size_t pending{0};
+	/* First exception thrown by any of the group's tasks */
+	exception_ptr error{};
+	/* Number of times the group has become idle */
+	uint64_t rounds{0};
+	vector<Promise<nullptr_t>> joiners;
+	/*
+	 * Take a pending task for the given pool (any pool if "unknown"), oldest
+	 * first for the pool's events and newest first for waiting threads
+	 */
+	bool take(unique_lock<mutex>& lock, const EventLoopPool pool, const bool newest, EventLoop::Event& event);
+	/* Run a task taken from the queue, then finish it */
+	void run(EventLoop::Event event);
+	/* Drop a task which was spawned but could not be pushed */
+	void cancel(const uint64_t id);
+	void finish();
+};
+
+bool TaskGroup::State::take(unique_lock<mutex>& lock, const EventLoopPool pool, const bool newest, EventLoop::Event& event)
+{
+	const auto matches = [pool] (const Task& task) {
+		return pool == EventLoopPool::unknown || task.pool == pool;
+	};
+	deque<Task>::iterator it;
+	if (newest) {
+		const auto rit = find_if(tasks.rbegin(), tasks.rend(), matches);
+		if (rit == tasks.rend()) {
+			return false;
+		}
+		it = prev(rit.base());
+	} else {
+		it = find_if(tasks.begin(), tasks.end(), matches);
+		if (it == tasks.end()) {
+			return false;
+		}
+	}
+	event = move(it->event);
+	tasks.erase(it);
+	return true;
+}
+
+void TaskGroup::State::run(EventLoop::Event event)
+{
+	try {
+		event(loop);
+	} catch (...) {
+		lock_guard<mutex> guard(lock);
+		if (!error) {
+			error = current_exception();
+		}
+	}
+	/* Release the task's captures before the group can become idle */
+	event = nullptr;
+	finish();
+}
+
+void TaskGroup::State::cancel(const uint64_t id)
+{
+	EventLoop::Event event;
+	{
+		lock_guard<mutex> guard(lock);
+		const auto it = find_if(tasks.begin(), tasks.end(),
+			[id] (const Task& task) { return task.id == id; });
+		if (it == tasks.end()) {
+			/* A waiting thread has taken it already */
+			return;
+		}
+		event = move(it->event);
+		tasks.erase(it);
+	}
+	event = nullptr;
+	finish();
+}
+
+void TaskGroup::State::finish()
+{
+	vector<Promise<nullptr_t>> settled;
+	exception_ptr settled_error;
+	{
+		lock_guard<mutex> guard(lock);
+		if (--pending > 0) {
+			return;
+		}
+		rounds++;
+		settled_error = error;
+		swap(settled, joiners);
+	}
+	changed.notify_all();
+	/* Outside the lock, as their callbacks may spawn into the group */
+	for (auto& joiner : settled) {
+		if (settled_error) {
+			joiner->reject(settled_error);
+		} else {
+			joiner->resolve(nullptr);
+		}
+	}
+}
+
+TaskGroup::TaskGroup(EventLoop& loop, const EventLoopPool pool) :
+	state(make_shared<State>(loop)), pool(pool)
+{
+}
+
+void TaskGroup::spawn_event(EventLoopPool pool, EventLoop::Event&& event) const
+{
+	if (pool == EventLoopPool::same) {
+		pool = ParallelEventLoop::current_pool();
+		if (pool == EventLoopPool::unknown) {
+			pool = this->pool;
+		}
+	}
+	uint64_t id;
+	{
+		lock_guard<mutex> guard(state->lock);
+		id = state->next_id++;
+		state->tasks.push_back(State::Task{ pool, id, move(event) });
+		state->pending++;
+	}
+	state->changed.notify_all();
+	/* Runs the oldest task for the pool, unless waiting threads took it */
+	auto runner = [state = state, pool] (EventLoop&) {
+		EventLoop::Event event;
+		{
+			unique_lock<mutex> lock(state->lock);
+			if (!state->take(lock, pool, false, event)) {
+				return;
+			}
+		}
+		state->run(move(event));
+	};
+	try {
+		state->loop.push(pool, move(runner));
+	} catch (...) {
+		state->cancel(id);
+		throw;
+	}
+}
+
+Promise<nullptr_t> TaskGroup::join() const
+{
+	Promise<nullptr_t> joiner;
+	exception_ptr error;
+	{
+		lock_guard<mutex> guard(state->lock);
+		if (state->pending > 0) {
+			state->joiners.push_back(joiner);
+			return joiner;
+		}
+		error = state->error;
+	}
+	if (error) {
+		joiner->reject(error);
+	} else {
+		joiner->resolve(nullptr);
+	}
+	return joiner;
+}
+
+void TaskGroup::wait() const
+{
+	const auto current = ParallelEventLoop::current_pool();
+	unique_lock<mutex> lock(state->lock);
+	const auto round = state->rounds;
+	while (state->pending > 0 && state->rounds == round) {
+		EventLoop::Event event;
+		if (state->take(lock, current, true, event)) {
+			lock.unlock();
+			state->run(move(event));
+			lock.lock();
+		} else {
+			state->changed.wait(lock);
+		}
+	}
+	if (state->error) {
+		rethrow_exception(state->error);
+	}
+}
+
+size_t TaskGroup::pending() const
+{
+	lock_guard<mutex> guard(state->lock);
+	return state->pending;
+}
+
+}
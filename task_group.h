@@ -0,0 +1,67 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include "event_loop.h"
+#include "promise.h"
+
+namespace kaiu {
+
+
+/*
+ * Group of tasks spawned into the pools of an event loop, which can be waited
+ * for without waiting for the whole loop (unlike ParallelEventLoop::join):
+ *
+ *   TaskGroup group(loop, EventLoopPool::calculation);
+ *   for (auto& part : parts) {
+ *       group.spawn([&part] (EventLoop&) { process(part); });
+ *   }
+ *   group.join()->then(...);      (or group.wait(), from any thread)
+ *
+ * Tasks are held by the group, and each spawn pushes an event which runs one
+ * of them.  A thread which waits for the group runs pending tasks of its own
+ * pool itself (or of any pool, if it isn't a pool thread), so a task may spawn
+ * a nested group and wait for it without deadlocking a small pool: the nested
+ * tasks run inline if no other worker takes them first.
+ *
+ * Copies share the same group.  Exceptions thrown by tasks do not stop the
+ * other tasks.  The first one is passed on by join/wait once they have all
+ * finished, and by any later join/wait, even if the tasks had finished before
+ * join was called.
+ */
+class TaskGroup {
+public:
+	/* Tasks run in the given pool unless spawned into another one */
+	explicit TaskGroup(EventLoop& loop, const EventLoopPool pool = EventLoopPool::calculation);
+	/*
+	 * Spawn a task (any callable taking EventLoop&).  "same" is the pool of
+	 * the calling thread, or the group's pool if it isn't a pool thread.
+	 */
+	template <typename Func>
+	void spawn(Func&& func) const
+		{ spawn_event(pool, EventLoop::Event(std::forward<Func>(func))); }
+	template <typename Func>
+	void spawn(const EventLoopPool pool, Func&& func) const
+		{ spawn_event(pool, EventLoop::Event(std::forward<Func>(func))); }
+	/*
+	 * Resolves once no tasks are pending or running (at once, if none), or
+	 * rejects with the first exception thrown by the group's tasks
+	 */
+	Promise<std::nullptr_t> join() const;
+	/*
+	 * Blocks until no tasks are pending or running, running pending tasks in
+	 * the calling thread meanwhile.  Rethrows the first exception thrown by
+	 * the group's tasks.  Unlike ParallelEventLoop::join, may be called by
+	 * workers.
+	 */
+	void wait() const;
+	/* Number of tasks spawned which have not finished */
+	std::size_t pending() const;
+private:
+	struct State;
+	std::shared_ptr<State> state;
+	EventLoopPool pool;
+	void spawn_event(EventLoopPool pool, EventLoop::Event&& event) const;
+};
+
+}
@@ -10,6 +10,11 @@ namespace kaiu {
 /*
  * PromiseStream which calls callbacks (data/resolve/reject) in specified
  * threads in a thread pool
+ *
+ * The consumer is called in the stream pool without the stream's lock, so a
+ * parallel consumer (stream_parallel) runs on several of the pool's threads at
+ * once.  The result is passed on in the reaction pool, or in the thread which
+ * completes the stream if that is "same".
  */
 
 template <typename Result, typename Datum>
@@ -20,7 +25,9 @@ public:
 		const EventLoopPool stream_pool,
 		const EventLoopPool react_pool = EventLoopPool::same);
 protected:
-	virtual void call_data_callback(Datum) override;
+	using ensure_locked = typename PromiseStreamState<Result, Datum>::ensure_locked;
+	using ConsumerCall = typename PromiseStreamState<Result, Datum>::ConsumerCall;
+	virtual Promise<StreamAction> call_consumer(ensure_locked, ConsumerCall call) override;
 	using completer_func = typename PromiseStreamState<Result, Datum>::completer_func;
 	virtual completer_func resolve_completer(Result) override;
 	virtual completer_func reject_completer(std::exception_ptr) override;
@@ -12,38 +12,58 @@ AsyncPromiseStreamState<Result, Datum>::AsyncPromiseStreamState(
 	EventLoop& loop,
 	const EventLoopPool stream_pool,
 	const EventLoopPool react_pool) :
-		loop(loop), stream_pool(stream_pool), react_pool(react_pool),
-		PromiseStreamState<Result, Datum>()
+		PromiseStreamState<Result, Datum>(),
+		loop(loop), stream_pool(stream_pool), react_pool(react_pool)
 {
 }
 
 template <typename Result, typename Datum>
-void AsyncPromiseStreamState<Result, Datum>::call_data_callback(Datum datum)
+auto AsyncPromiseStreamState<Result, Datum>::call_consumer(ensure_locked, ConsumerCall call)
+	-> Promise<StreamAction>
 {
-	auto functor = [this, datum = std::move(datum)] () mutable {
-		PromiseStreamState<Result, Datum>::call_data_callback(std::move(datum));
+	/*
+	 * The stream stays alive until the action is settled, as it cannot
+	 * complete while a consumer is running
+	 */
+	Promise<StreamAction> action;
+	auto functor = [action, call = std::move(call)] (EventLoop&) mutable {
+		call()->forward_to(action);
 	};
-	auto wrapper = detail::make_shared_functor(std::move(functor));
-	loop.push(stream_pool, wrapper);
+	loop.push(stream_pool, std::move(functor));
+	return action;
 }
 
 template <typename Result, typename Datum>
 auto AsyncPromiseStreamState<Result, Datum>::resolve_completer(Result result)
 	-> completer_func
 {
-	auto functor = PromiseStreamState<Result, Datum>::bind_resolve(std::move(result));
-	return [this, functor = std::move(functor)] {
-		loop.push(react_pool, functor);
+	auto functor = [this, result = std::move(result)] (ensure_locked) mutable {
+		auto promise = this->proxy_promise;
+		if (react_pool == EventLoopPool::same) {
+			promise->resolve(std::move(result));
+			return;
+		}
+		auto proxy = [promise, result = std::move(result)] (EventLoop&) mutable {
+			promise->resolve(std::move(result));
+		};
+		loop.push(react_pool, std::move(proxy));
 	};
+	return detail::make_shared_functor(std::move(functor));
 }
 
 template <typename Result, typename Datum>
 auto AsyncPromiseStreamState<Result, Datum>::reject_completer(std::exception_ptr error)
 	-> completer_func
 {
-	auto functor = PromiseStreamState<Result, Datum>::bind_reject(error);
-	return [this, functor = std::move(functor)] {
-		loop.push(react_pool, functor);
+	return [this, error] (ensure_locked) {
+		auto promise = this->proxy_promise;
+		if (react_pool == EventLoopPool::same) {
+			promise->reject(error);
+			return;
+		}
+		loop.push(react_pool, [promise, error] (EventLoop&) {
+			promise->reject(error);
+		});
 	};
 }
 
@@ -54,7 +74,7 @@ AsyncPromiseStream<Result, Datum>::AsyncPromiseStream(EventLoop& loop,
 	const EventLoopPool stream_pool,
 	const EventLoopPool react_pool) :
 		PromiseStream<Result, Datum>(
-			std::make_shared<AsyncPromiseStreamState<Result, Datum>>(loop, stream_pool, react_pool))
+			detail::make_state<AsyncPromiseStreamState<Result, Datum>>(loop, stream_pool, react_pool))
 {
 }
 
@@ -72,28 +92,26 @@ UnboundTaskStream<Result, Datum, Args...> task_stream(
 	auto newFactory = [factory, producer_pool, consumer_pool, reaction_pool]
 		(EventLoop& loop, Args&&... args)
 	{
-		PromiseStream<Result, Datum> stream;
-		/* Consumer */
-		auto consumer = [stream, consumer_pool, &loop]
-			(Datum datum) -> Promise<StreamAction>
+		/* Calls its consumer in the consumer pool */
+		PromiseStream<Result, Datum> stream =
+			AsyncPromiseStream<Result, Datum>(loop, consumer_pool);
+		/* Only written by the inner stream's consumer, one call at a time */
+		stream->set_single_producer();
+		/*
+		 * Consumer: writes straight into the stream's buffer, waiting for room
+		 * if the stream has a capacity, so the producer is throttled without
+		 * blocking a thread.  The datum is moved once, into its slot.
+		 */
+		auto consumer = [stream] (Datum&& datum) -> Promise<StreamAction>
 		{
-			Promise<StreamAction> consumer_action;
-			auto proxy = [stream, consumer_action, datum = std::move(datum)]
-				(EventLoop&) mutable -> void
-			{
-				try {
-					stream->write(std::move(datum));
-				} catch (...) {
-					consumer_action->reject(std::current_exception());
-					return;
-				}
-				consumer_action->resolve(stream->data_action());
-			};
-			loop.push(consumer_pool, detail::make_shared_functor(proxy));
-			return consumer_action;
+			try {
+				return stream->write_async(std::move(datum));
+			} catch (...) {
+				return promise::rejected<StreamAction>(std::current_exception());
+			}
 		};
 		/* Producer */
-		auto producer = [stream, producer_pool, &loop,
+		auto producer = [stream, &loop,
 			factory, args..., consumer, reaction_pool]
 			(EventLoop&) mutable -> void
 		{
@@ -104,7 +122,7 @@ UnboundTaskStream<Result, Datum, Args...> task_stream(
 				{
 					stream->resolve(std::move(result));
 				};
-				loop.push(reaction_pool, detail::make_shared_functor(proxy));
+				loop.push(reaction_pool, std::move(proxy));
 			};
 			auto reject = [stream, reaction_pool, &loop] (std::exception_ptr error) -> void
 			{
@@ -112,14 +130,14 @@ UnboundTaskStream<Result, Datum, Args...> task_stream(
 				{
 					stream->reject(error);
 				};
-				loop.push(reaction_pool, proxy);
+				loop.push(reaction_pool, std::move(proxy));
 			};
 			factory(std::forward<Args>(args)...)
 				->stream(consumer)
 				->then(resolve, reject);
 		};
 		/* Push production task */
-		loop.push(producer_pool, detail::make_shared_functor(producer));
+		loop.push(producer_pool, std::move(producer));
 		return stream;
 	};
 	return curry_wrap<PromiseStream<Result, Datum>, sizeof...(Args) + 1, StreamFactory<Result, Datum, EventLoop&, Args...>>(newFactory);
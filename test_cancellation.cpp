@@ -0,0 +1,178 @@
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <thread>
+#include "assertion.h"
+#include "event_loop.h"
+#include "promise.h"
+#include "promise_stream.h"
+#include "task.h"
+#include "cancellation.h"
+
+using namespace std;
+using namespace std::chrono_literals;
+using namespace kaiu;
+
+Assertions assert({
+	{ nullptr, "Tokens" },
+	{ "CB", "Callbacks run once on cancel, or at once if already cancelled" },
+	{ "REMOVE", "Removed callbacks are not run" },
+	{ "NONE", "Default token is never cancelled" },
+	{ nullptr, "Promises" },
+	{ "PCANCEL", "Cancelled promise rejects with cancelled_error" },
+	{ "PRESULT", "Result passes through if not cancelled" },
+	{ nullptr, "Tasks" },
+	{ "TQUEUED", "Queued task does not run, releases its arguments and rejects" },
+	{ "TBEFORE", "Task called with a cancelled token rejects without running" },
+	{ "TRUN", "Task with an uncancelled token runs as usual" },
+	{ nullptr, "Streams" },
+	{ "SSTOP", "Cancelling a stream's token is seen by the producer as a stop request" },
+});
+
+bool is_cancelled_error(exception_ptr error)
+{
+	try {
+		rethrow_exception(error);
+	} catch (const cancelled_error&) {
+		return true;
+	} catch (...) {
+		return false;
+	}
+}
+
+void token_test()
+{
+	auto token = CancellationToken::create();
+	int calls = 0;
+	token.on_cancel([&calls] { calls++; });
+	const auto removed = token.on_cancel([&calls] { calls += 100; });
+	const bool was_removed = token.remove(removed);
+	token.cancel();
+	token.cancel();
+	token.on_cancel([&calls] { calls++; });
+	assert.expect(calls == 2 && token.is_cancelled(), true, "CB");
+	assert.expect(was_removed, true, "REMOVE");
+	CancellationToken none;
+	assert.expect(!none.can_cancel() && !none.is_cancelled() && none.on_cancel([] { }) == 0, true, "NONE");
+}
+
+void promise_test()
+{
+	{
+		auto token = CancellationToken::create();
+		Promise<int> pending;
+		bool rejected = false;
+		promise::cancellable(pending, token)
+			->then(
+				[] (int) { },
+				[&rejected] (exception_ptr error) { rejected = is_cancelled_error(error); });
+		token.cancel();
+		pending->resolve(1);
+		assert.expect(rejected, true, "PCANCEL");
+	}
+	{
+		auto token = CancellationToken::create();
+		Promise<int> pending;
+		int result = 0;
+		promise::cancellable(pending, token)
+			->then([&result] (int x) { result = x; });
+		pending->resolve(42);
+		token.cancel();
+		assert.expect(result, 42, "PRESULT");
+	}
+}
+
+void task_test()
+{
+	ParallelEventLoop loop({
+		{ EventLoopPool::reactor, 1 },
+		{ EventLoopPool::calculation, 1 }
+	});
+	/* Block the calculation pool so the task stays queued */
+	mutex mx;
+	condition_variable cv;
+	bool release = false;
+	loop.push(EventLoopPool::calculation, [&] (EventLoop&) {
+		unique_lock<mutex> lock(mx);
+		cv.wait(lock, [&] { return release; });
+	});
+	auto token = CancellationToken::create();
+	atomic<bool> ran{false};
+	atomic<bool> rejected{false};
+	auto arg = make_shared<int>(1);
+	weak_ptr<int> weak_arg = arg;
+	const auto work = [&ran] (shared_ptr<int> x) {
+		ran = true;
+		return promise::resolved(*x);
+	};
+	const auto cancellable_task = promise::task(
+		promise::Factory<int, shared_ptr<int>>(work),
+		EventLoopPool::calculation, EventLoopPool::reactor, token);
+	cancellable_task(loop, arg)
+		->then(
+			[] (int) { },
+			[&rejected] (exception_ptr error) { rejected = is_cancelled_error(error); });
+	arg.reset();
+	token.cancel();
+	const bool released = weak_arg.expired();
+	/* Called after cancellation */
+	atomic<bool> rejected_before{false};
+	cancellable_task(loop, make_shared<int>(2))
+		->then(
+			[] (int) { },
+			[&rejected_before] (exception_ptr error) { rejected_before = is_cancelled_error(error); });
+	/* Not cancelled */
+	atomic<int> result{0};
+	const auto other = CancellationToken::create();
+	promise::task(
+		promise::Factory<int, shared_ptr<int>>([] (shared_ptr<int> x) { return promise::resolved(*x); }),
+		EventLoopPool::calculation, EventLoopPool::reactor, other)
+			(loop, make_shared<int>(3))
+			->then([&result] (int x) { result = x; });
+	{
+		lock_guard<mutex> lock(mx);
+		release = true;
+	}
+	cv.notify_all();
+	for (int i = 0; i < 500 && result == 0; i++) {
+		this_thread::sleep_for(2ms);
+	}
+	loop.join();
+	assert.expect(released && rejected && !ran, true, "TQUEUED");
+	assert.expect(rejected_before.load(), true, "TBEFORE");
+	assert.expect(result.load(), 3, "TRUN");
+}
+
+void stream_test()
+{
+	PromiseStream<int, int> stream;
+	auto token = CancellationToken::create();
+	stream->stop_on(token);
+	int received = 0;
+	int result = 0;
+	stream
+		->stream([&received] (int) { received++; })
+		->then([&result] (int x) { result = x; });
+	int produced = 0;
+	while (!stream->stop_requested() && produced < 100) {
+		stream->write(produced++);
+		if (produced == 10) {
+			token.cancel();
+		}
+	}
+	stream->resolve(produced);
+	assert.expect(produced == 10 && received == 10 && result == 10, true, "SSTOP");
+}
+
+int main(int argc, char *argv[])
+try {
+	token_test();
+	promise_test();
+	task_test();
+	stream_test();
+	return assert.print(argc, argv);
+} catch (...) {
+	assert.print_error();
+}
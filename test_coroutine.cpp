@@ -0,0 +1,189 @@
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <vector>
+#include <stdexcept>
+#include "assertion.h"
+#include "event_loop.h"
+#include "promise.h"
+#include "promise_stream.h"
+#if defined(__cpp_impl_coroutine)
+#include "coroutine.h"
+#endif
+
+using namespace std;
+using namespace std::chrono_literals;
+using namespace kaiu;
+
+Assertions assert({
+	{ nullptr, "Promises" },
+	{ "AWAIT", "co_await returns the result of completed and pending promises" },
+	{ "THROW", "co_await throws rejections, and exceptions reject the coroutine" },
+	{ "SYNC", "Awaiting completed promises does not grow the stack" },
+	{ "POOL", "resume_on continues the coroutine in the given pool" },
+	{ nullptr, "Streams" },
+	{ "STREAM", "StreamReader returns the data in order, then the result" },
+	{ "SSTOP", "Stopping a StreamReader stops the producer" },
+});
+
+#if defined(__cpp_impl_coroutine)
+
+Promise<int> add(Promise<int> a, Promise<int> b)
+{
+	const int x = co_await a;
+	co_return x + co_await b;
+}
+
+Promise<int> fail(Promise<int> a)
+{
+	try {
+		co_await a;
+	} catch (const runtime_error&) {
+		throw logic_error("Rethrown");
+	}
+	co_return 0;
+}
+
+Promise<long> sum_of_ready(const long count)
+{
+	long sum = 0;
+	for (long i = 0; i < count; i++) {
+		sum += co_await promise::resolved(1L);
+	}
+	co_return sum;
+}
+
+Promise<bool> in_pool(EventLoop& loop, Promise<int> a)
+{
+	co_await promise::resume_on(loop, EventLoopPool::calculation);
+	bool in_calculation = ParallelEventLoop::current_pool() == EventLoopPool::calculation;
+	co_await promise::resume_on(loop, EventLoopPool::reactor, a);
+	in_calculation = in_calculation && ParallelEventLoop::current_pool() == EventLoopPool::reactor;
+	co_return in_calculation;
+}
+
+Promise<vector<int>> read_all(PromiseStream<int, int> stream)
+{
+	StreamReader<int, int> reader(stream);
+	vector<int> data;
+	while (auto datum = co_await reader.next()) {
+		data.push_back(*datum);
+	}
+	data.push_back(reader.result());
+	co_return data;
+}
+
+Promise<int> read_two(PromiseStream<int, int> stream)
+{
+	StreamReader<int, int> reader(stream);
+	int sum = 0;
+	for (int i = 0; i < 2; i++) {
+		if (auto datum = co_await reader.next()) {
+			sum += *datum;
+		}
+	}
+	co_return sum;
+}
+
+void promise_test()
+{
+	{
+		Promise<int> later;
+		int result = 0;
+		add(promise::resolved(1), later)
+			->then([&result] (int x) { result = x; });
+		const bool waited = result == 0;
+		later->resolve(2);
+		assert.expect(waited && result == 3, true, "AWAIT");
+	}
+	{
+		Promise<int> later;
+		bool rejected = false;
+		fail(later)
+			->then(
+				[] (int) { },
+				[&rejected] (exception_ptr error) {
+					try {
+						rethrow_exception(error);
+					} catch (const logic_error&) {
+						rejected = true;
+					} catch (...) {
+					}
+				});
+		later->reject("Failed");
+		assert.expect(rejected, true, "THROW");
+	}
+	{
+		long result = 0;
+		sum_of_ready(1000000)
+			->then([&result] (long x) { result = x; });
+		assert.expect(result, 1000000L, "SYNC");
+	}
+}
+
+void pool_test()
+{
+	ParallelEventLoop loop({
+		{ EventLoopPool::reactor, 1 },
+		{ EventLoopPool::calculation, 1 }
+	});
+	Promise<int> later;
+	atomic<int> result{0};
+	in_pool(loop, later)
+		->then([&result] (bool x) { result = x ? 1 : -1; });
+	later->resolve(1);
+	for (int i = 0; i < 500 && result == 0; i++) {
+		this_thread::sleep_for(2ms);
+	}
+	loop.join();
+	assert.expect(result.load(), 1, "POOL");
+}
+
+void stream_test()
+{
+	{
+		PromiseStream<int, int> stream;
+		vector<int> result;
+		read_all(stream)
+			->then([&result] (vector<int> x) { result = move(x); });
+		for (int i = 1; i <= 5; i++) {
+			stream->write(i);
+		}
+		stream->resolve(6);
+		assert.expect(result == vector<int>{ 1, 2, 3, 4, 5, 6 }, true, "STREAM");
+	}
+	{
+		PromiseStream<int, int> stream;
+		int result = 0;
+		read_two(stream)
+			->then([&result] (int x) { result = x; });
+		int produced = 0;
+		while (!stream->stop_requested() && produced < 100) {
+			stream->write(++produced);
+		}
+		stream->resolve(produced);
+		assert.expect(produced == 2 && result == 3, true, "SSTOP");
+	}
+}
+
+int main(int argc, char *argv[])
+try {
+	promise_test();
+	pool_test();
+	stream_test();
+	return assert.print(argc, argv);
+} catch (...) {
+	assert.print_error();
+}
+
+#else
+
+int main(int argc, char *argv[])
+{
+	for (const auto code : { "AWAIT", "THROW", "SYNC", "POOL", "STREAM", "SSTOP" }) {
+		assert.skip(code, "Build with std=c++20");
+	}
+	return assert.print(argc, argv);
+}
+
+#endif
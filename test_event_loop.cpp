@@ -2,8 +2,14 @@
 #include <thread>
 #include <chrono>
 #include <string>
+#include <memory>
+#include <vector>
+#include <fstream>
+#include <system_error>
+#include <sched.h>
 #include "assertion.h"
 #include "event_loop.h"
+#include "concurrent_ring.h"
 
 using namespace kaiu;
 using namespace std;
@@ -14,6 +20,26 @@ Assertions assert({
 	{ "SORDER", "All events fire and they fire in order" },
 	{ nullptr, "Multi-threaded event loop" },
 	{ "MALL", "All events fired" },
+	{ nullptr, "Multi-threaded event loop (work-stealing pools)" },
+	{ "WALL", "All events fired" },
+	{ "WJOIN", "Join waits for nested fan-out to complete" },
+	{ nullptr, "Multi-threaded event loop (lock-free ring pools)" },
+	{ "RALL", "All events fired" },
+	{ "RJOIN", "Join waits for nested fan-out to complete" },
+	{ "ROVER", "Events spilled past ring capacity all fire, even while the ring is kept busy" },
+	{ nullptr, "Batched push and pop" },
+	{ "BSYNC", "Bulk push to synchronous loop fires all events in order" },
+	{ "BSHARED", "Bulk push and batched pop fire all events (shared pools)" },
+	{ "BSTEAL", "Bulk push and batched pop fire all events (work-stealing pools)" },
+	{ "BRING", "Bulk push and batched pop fire all events (lock-free ring pools)" },
+	{ "BJOIN", "Join waits for nested fan-out to complete with batched pop" },
+	{ nullptr, "Events" },
+	{ "EINLINE", "Typical task-sized closures are stored without heap allocation" },
+	{ "EMOVE", "Move-only closures can be pushed" },
+	{ nullptr, "Thread placement" },
+	{ "PIN", "Workers pinned to a CPU run on that CPU" },
+	{ "PNODE", "Workers bound to a NUMA node run and are reported" },
+	{ "PNODE_ERR", "Binding to a non-existent NUMA node throws" },
 	{ nullptr, "Correct handling of special/invalid pool values" },
 	{ "PSAME_ERR", "Push to EventLoopPool::same throws in non-pool thread" },
 	{ "PSAME", "Push to EventLoopPool::same behaves correctly in pool thread" }
@@ -49,12 +75,12 @@ void test_single()
 	assert.expect(order, "AB1B2C", "SORDER");
 }
 
-void test_multi()
+void test_multi(const EventLoopQueue queue, const string assertion)
 {
 	ParallelEventLoop loop({
-		{ EventLoopPool::reactor, 1 },
-		{ EventLoopPool::calculation, 2 },
-		{ EventLoopPool::io_local, 10 }
+		{ EventLoopPool::reactor, { 1, queue } },
+		{ EventLoopPool::calculation, { 2, queue } },
+		{ EventLoopPool::io_local, { 10, queue } }
 	});
 	EventFunc taskA, taskB1, taskB2, taskC, taskD, taskE;
 	const int d_rep = 30;
@@ -105,7 +131,195 @@ void test_multi()
 	};
 	loop.push(EventLoopPool::reactor, taskA);
 	loop.join();
-	assert.expect(order, "AB2B1C" + string(d_rep, 'D') + "E", "MALL");
+	assert.expect(order, "AB2B1C" + string(d_rep, 'D') + "E", assertion);
+}
+
+void test_fan_out(const EventLoopPoolConfig config, const string assertion)
+{
+	ParallelEventLoop loop({
+		{ EventLoopPool::calculation, config }
+	});
+	const int depth = 12;
+	atomic<int> count{0};
+	function<void(EventLoop&, int)> node = [&] (EventLoop& loop, int level) {
+		count++;
+		if (level == 0) {
+			return;
+		}
+		for (int i = 0; i < 2; i++) {
+			loop.push(EventLoopPool::same, [&node, level] (EventLoop& loop) {
+				node(loop, level - 1);
+			});
+		}
+	};
+	loop.push(EventLoopPool::calculation, [&] (EventLoop& loop) {
+		node(loop, depth);
+	});
+	loop.join();
+	assert.expect(count.load(), (2 << depth) - 1, assertion);
+}
+
+void test_ring_overflow()
+{
+	/* A spilled item is reached while every pop is followed by a push */
+	ConcurrentRing<int> ring(4, true);
+	for (int i = 0; i < 4; i++) {
+		ring.push(i);
+	}
+	ring.push(-1);
+	int taken = 0;
+	int item = 0;
+	while (taken < 100 && ring.pop(item) && item != -1) {
+		ring.push(taken++);
+	}
+	const bool reached = item == -1;
+	ParallelEventLoop loop({
+		{ EventLoopPool::calculation, { 2, EventLoopQueue::lock_free_ring, 16 } }
+	});
+	/* Events which push themselves again, so the ring never drains */
+	atomic<bool> busy{true};
+	function<void(EventLoop&)> spin = [&] (EventLoop& loop) {
+		if (busy) {
+			loop.push(EventLoopPool::same, spin);
+		}
+	};
+	for (int i = 0; i < 12; i++) {
+		loop.push(EventLoopPool::calculation, spin);
+	}
+	/* Most of these spill into the overflow */
+	const int spilled = 1000;
+	atomic<int> fired{0};
+	for (int i = 0; i < spilled; i++) {
+		loop.push(EventLoopPool::calculation, [&fired] (EventLoop&) { fired++; });
+	}
+	for (int i = 0; i < 1000 && fired < spilled; i++) {
+		this_thread::sleep_for(2ms);
+	}
+	const int fired_while_busy = fired;
+	busy = false;
+	loop.join();
+	assert.expect(reached && fired_while_busy == spilled && fired == spilled, true, "ROVER");
+}
+
+void test_bulk_sync()
+{
+	string order;
+	auto start = [&] (EventLoop& loop) {
+		vector<EventFunc> events;
+		for (char c = 'a'; c <= 'e'; c++) {
+			events.emplace_back([&order, c] (EventLoop&) { order += c; });
+		}
+		loop.push_bulk(EventLoopPool::reactor, events);
+	};
+	SynchronousEventLoop loop(start);
+	assert.expect(order, "abcde", "BSYNC");
+}
+
+void test_bulk(const EventLoopQueue queue, const string assertion)
+{
+	ParallelEventLoop loop({
+		{ EventLoopPool::calculation, { 4, queue, 64, 16 } }
+	});
+	const int count = 1000;
+	atomic<int> fired{0};
+	/* Bulk push from outside the pool, then from a worker */
+	vector<EventLoop::Event> events;
+	for (int i = 0; i < count; i++) {
+		events.emplace_back([&fired] (EventLoop&) { fired++; });
+	}
+	loop.push_bulk(EventLoopPool::calculation, move(events));
+	loop.push(EventLoopPool::calculation, [&fired] (EventLoop& loop) {
+		vector<EventFunc> events(count, [&fired] (EventLoop&) { fired++; });
+		loop.push_bulk(EventLoopPool::same, events);
+	});
+	loop.join();
+	assert.expect(fired.load(), 2 * count, assertion);
+}
+
+void test_events()
+{
+	/* Roughly what a task action captures: a factory, a promise, a pool */
+	function<int()> factory = [] { return 42; };
+	shared_ptr<int> promise = make_shared<int>(0);
+	EventLoopPool pool = EventLoopPool::reactor;
+	EventLoop::Event event = [factory, promise, pool] (EventLoop&) {
+		*promise = factory() + int(pool);
+	};
+	assert.expect(event.is_inline(), true, "EINLINE");
+	unique_ptr<string> value(new string("moved"));
+	string result;
+	auto start = [&] (EventLoop& loop) {
+		loop.push([&result, value = move(value)] (EventLoop&) {
+			result = *value;
+		});
+	};
+	SynchronousEventLoop loop(start);
+	assert.expect(result, "moved", "EMOVE");
+}
+
+void test_placement()
+{
+	{
+		/* Any CPU we are allowed to run on */
+		cpu_set_t allowed;
+		CPU_ZERO(&allowed);
+		int cpu = 0;
+		if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+			while (cpu < CPU_SETSIZE - 1 && !CPU_ISSET(cpu, &allowed)) {
+				cpu++;
+			}
+		}
+		ParallelEventLoop loop({
+			{ EventLoopPool::calculation, EventLoopPoolConfig(2).pin({ cpu }) }
+		});
+		atomic<bool> on_cpu{true};
+		for (int i = 0; i < 10; i++) {
+			loop.push(EventLoopPool::calculation, [&on_cpu, cpu] (EventLoop&) {
+				if (ParallelEventLoop::current_cpu() != cpu) {
+					on_cpu = false;
+				}
+			});
+		}
+		loop.join();
+		const auto cpus = loop.worker_cpus(EventLoopPool::calculation);
+		assert.expect(on_cpu && cpus == vector<int>{ cpu, cpu }, true, "PIN");
+	}
+	if (!ifstream("/sys/devices/system/node/node0/cpulist")) {
+		assert.skip("PNODE", "No NUMA node 0");
+	} else {
+		ParallelEventLoop loop({
+			{ EventLoopPool::calculation, EventLoopPoolConfig(2).bind_node(0) }
+		});
+		atomic<int> count{0};
+		loop.push(EventLoopPool::calculation, [&count] (EventLoop&) { count++; });
+		bool placed = true;
+		bool unsupported = false;
+		loop.join([&placed, &unsupported] (exception_ptr error) {
+			try {
+				rethrow_exception(error);
+			} catch (const system_error&) {
+				/* e.g. set_mempolicy in a container which forbids it */
+				unsupported = true;
+			} catch (...) {
+			}
+			placed = false;
+		});
+		const auto cpus = loop.worker_cpus(EventLoopPool::calculation);
+		if (unsupported) {
+			assert.skip("PNODE", "Placement not permitted");
+		} else {
+			assert.expect(placed && count == 1 && cpus.size() == 2 &&
+				cpus[0] >= 0 && cpus[1] >= 0, true, "PNODE");
+		}
+	}
+	try {
+		ParallelEventLoop loop({
+			{ EventLoopPool::calculation, EventLoopPoolConfig(1).bind_node(1 << 20) }
+		});
+		assert.fail("PNODE_ERR");
+	} catch (const invalid_argument&) {
+		assert.pass("PNODE_ERR");
+	}
 }
 
 void test_pools()
@@ -132,7 +346,19 @@ void test_pools()
 int main(int argc, char *argv[])
 try {
 	test_single();
-	test_multi();
+	test_multi(EventLoopQueue::shared, "MALL");
+	test_multi(EventLoopQueue::work_stealing, "WALL");
+	test_fan_out({ 4, EventLoopQueue::work_stealing }, "WJOIN");
+	test_multi(EventLoopQueue::lock_free_ring, "RALL");
+	test_fan_out({ 4, EventLoopQueue::lock_free_ring }, "RJOIN");
+	test_ring_overflow();
+	test_bulk_sync();
+	test_bulk(EventLoopQueue::shared, "BSHARED");
+	test_bulk(EventLoopQueue::work_stealing, "BSTEAL");
+	test_bulk(EventLoopQueue::lock_free_ring, "BRING");
+	test_fan_out({ 4, EventLoopQueue::shared, 1024, 32 }, "BJOIN");
+	test_events();
+	test_placement();
 	test_pools();
 	return assert.print(argc, argv);
 } catch (...) {
@@ -0,0 +1,206 @@
+#include <atomic>
+#include <string>
+#include <vector>
+#include <set>
+#include <memory>
+#include <fstream>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "assertion.h"
+#include "event_loop.h"
+#include "promise.h"
+#include "promise_stream.h"
+#include "buffer_pool.h"
+#include "fs.h"
+
+using namespace kaiu;
+using namespace std;
+
+Assertions assert({
+	{ nullptr, "Buffer pool" },
+	{ "REUSE", "Released buffers are reused" },
+	{ "LIMIT", "take_or_wait waits at the limit, until a buffer is released" },
+	{ nullptr, "Directories" },
+	{ "DIR", "read_dir streams every entry, in blocks" },
+	{ "DSTOP", "Stopping the stream stops reading the directory" },
+	{ "DSLOW", "read_dir reads only a few blocks ahead of a slow consumer" },
+	{ "DERR", "read_dir rejects for a missing directory" },
+	{ nullptr, "Files" },
+	{ "READ", "read_file streams the whole file in chunks" },
+	{ "BOUND", "read_file holds no more than max_buffers chunks" },
+	{ "COPY", "write_file writes a read_file stream to a new file" },
+	{ "FERR", "read_file rejects for a missing file" }
+});
+
+string make_temp_dir()
+{
+	char name[] = "/tmp/kaiu_test_fs_XXXXXX";
+	if (!mkdtemp(name)) {
+		throw runtime_error("mkdtemp failed");
+	}
+	return name;
+}
+
+string slurp(const string& path)
+{
+	ifstream in(path, ios::binary);
+	return string(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+}
+
+void test_buffer_pool()
+{
+	BufferPool pool(64, 2);
+	const char *first;
+	{
+		Buffer a = pool.take();
+		first = a.data();
+	}
+	Buffer b = pool.take();
+	assert.expect(b.data() == first && pool.allocated() == 1, true, "REUSE");
+	Buffer c = pool.take();
+	Buffer d;
+	bool notified = false;
+	const bool took = pool.take_or_wait(d, [&] { notified = true; });
+	const bool early = notified;
+	c.release();
+	const bool retook = pool.take_or_wait(d, [] { });
+	assert.expect(!took && !early && notified && retook && pool.allocated() == 2, true, "LIMIT");
+}
+
+void test_dir(ParallelEventLoop& loop, FileSystem& fs, const string& dir)
+{
+	const int files = 1000;
+	for (int i = 0; i < files; i++) {
+		ofstream(dir + "/" + to_string(i));
+	}
+	set<string> names;
+	size_t blocks = 0;
+	bool oversize = false;
+	size_t total = 0;
+	fs.read_dir(dir, 64)
+		->stream([&] (vector<string> block) {
+			blocks++;
+			oversize |= block.size() > 64;
+			names.insert(block.begin(), block.end());
+		})
+		->then([&] (size_t count) { total = count; });
+	loop.join();
+	assert.expect(names.size() == files && total == files && blocks == 16 && !oversize &&
+		names.count("0") && names.count("999"), true, "DIR");
+	/*
+	 * Synchronous loop, so the consumer is attached before the first block is
+	 * read and the producer sees the Stop before reading the second
+	 */
+	size_t seen = 0;
+	size_t stopped_total = 0;
+	unique_ptr<FileSystem> sync_fs;
+	SynchronousEventLoop([&] (EventLoop& loop) {
+		sync_fs.reset(new FileSystem(loop));
+		sync_fs->read_dir(dir, 10)
+			->stream([&] (vector<string> block) {
+				seen += block.size();
+				return StreamAction::Stop;
+			})
+			->then([&] (size_t count) { stopped_total = count; });
+	});
+	assert.expect(seen == 10 && stopped_total == 10, true, "DSTOP");
+	/* Consumer is busy with the first block until we let it go */
+	Promise<StreamAction> busy;
+	size_t slow_blocks = 0;
+	size_t slow_total = 0;
+	fs.read_dir(dir, 64)
+		->stream([&] (vector<string> block) {
+			slow_blocks++;
+			return busy;
+		})
+		->then([&] (size_t count) { slow_total = count; });
+	loop.join();
+	const size_t taken = slow_blocks;
+	busy->resolve(StreamAction::Stop);
+	loop.join();
+	assert.expect(taken == 1 && slow_total > 0 && slow_total <= 3 * 64, true, "DSLOW");
+	bool rejected = false;
+	fs.read_dir(dir + "/missing")
+		->stream([] (vector<string>) { })
+		->then(
+			[] (size_t) { },
+			[&] (exception_ptr) { rejected = true; });
+	loop.join();
+	assert.expect(rejected, true, "DERR");
+}
+
+void test_file(ParallelEventLoop& loop, FileSystem& fs, const string& dir)
+{
+	const string source = dir + "/source";
+	string content;
+	for (int i = 0; content.size() < 1000000; i++) {
+		content += to_string(i) + "\n";
+	}
+	ofstream(source, ios::binary) << content;
+	string read;
+	size_t chunks = 0;
+	size_t total = 0;
+	fs.read_file(source)
+		->stream([&] (Buffer chunk) {
+			chunks++;
+			read.append(chunk.begin(), chunk.end());
+		})
+		->then([&] (size_t count) { total = count; });
+	loop.join();
+	assert.expect(read == content && total == content.size() &&
+		chunks == (content.size() + 4095) / 4096, true, "READ");
+	/* Consumer holds on to every chunk: reader must stall at the limit */
+	vector<Buffer> held;
+	atomic<bool> finished{false};
+	fs.read_file(source)
+		->stream([&] (Buffer chunk) {
+			held.emplace_back(move(chunk));
+		})
+		->then([&] (size_t) { finished = true; });
+	loop.join();
+	const bool stalled = !finished && held.size() == 8 && fs.buffers().allocated() == 8;
+	/* Releasing them lets the reader finish */
+	while (!finished) {
+		vector<Buffer> release;
+		swap(release, held);
+		release.clear();
+		loop.join();
+	}
+	assert.expect(stalled && fs.buffers().allocated() == 8, true, "BOUND");
+	const string target = dir + "/target";
+	size_t written = 0;
+	fs.write_file(target, fs.read_file(source))
+		->then([&] (size_t count) { written = count; });
+	loop.join();
+	assert.expect(written == content.size() && slurp(target) == content, true, "COPY");
+	bool rejected = false;
+	fs.read_file(dir + "/missing")
+		->stream([] (Buffer) { })
+		->then(
+			[] (size_t) { },
+			[&] (exception_ptr) { rejected = true; });
+	loop.join();
+	assert.expect(rejected, true, "FERR");
+}
+
+int main(int argc, char *argv[])
+try {
+	test_buffer_pool();
+	const string dir = make_temp_dir();
+	{
+		ParallelEventLoop loop({
+			{ EventLoopPool::io_local, 2 }
+		});
+		FileSystem fs(loop, EventLoopPool::io_local, 4096, 8);
+		test_dir(loop, fs, dir);
+		test_file(loop, fs, dir);
+		loop.join();
+	}
+	if (system(("rm -rf " + dir).c_str()) != 0) {
+		/* Leave it for the system to clean up */
+	}
+	return assert.print(argc, argv);
+} catch (...) {
+	assert.print_error();
+}
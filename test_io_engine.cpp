@@ -0,0 +1,154 @@
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <thread>
+#include <functional>
+#include <cstdlib>
+#include <unistd.h>
+#include <fcntl.h>
+#include "assertion.h"
+#include "event_loop.h"
+#include "promise.h"
+#include "promise_stream.h"
+#include "buffer_pool.h"
+#include "io_engine.h"
+
+using namespace kaiu;
+using namespace std;
+using namespace std::chrono_literals;
+
+Assertions assert({
+	{ nullptr, "Backends" },
+	{ "BACKEND", "Requested backend is used, automatic picks a real one" },
+	{ nullptr, "io_uring" },
+	{ "URW", "Write then read back at an offset" },
+	{ "UMANY", "Many concurrent reads complete with the right data" },
+	{ "USTREAM", "read_stream delivers the whole file in order" },
+	{ "UERR", "Bad descriptor rejects with system_error" },
+	{ nullptr, "Thread pool" },
+	{ "TRW", "Write then read back at an offset" },
+	{ "TMANY", "Many concurrent reads complete with the right data" },
+	{ "TSTREAM", "read_stream delivers the whole file in order" },
+	{ "TERR", "Bad descriptor rejects with system_error" }
+});
+
+/* Operations in flight are not part of join, so wait for the result */
+void wait_for(ParallelEventLoop& loop, function<bool()> done)
+{
+	for (int i = 0; i < 2500 && !done(); i++) {
+		this_thread::sleep_for(2ms);
+	}
+	loop.join();
+}
+
+void test_engine(ParallelEventLoop& loop, IoEngine& engine, const string& prefix, const string& path)
+{
+	const int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+	/* Write, then read back */
+	const string message = "hello, ring";
+	atomic<bool> rw{false};
+	vector<char> readback(message.size());
+	engine.write(fd, message.data(), message.size(), 100)
+		->then([&] (size_t count) {
+			return engine.read(fd, readback.data(), readback.size(), 100);
+		})
+		->then([&] (size_t count) {
+			rw = count == message.size() && string(readback.begin(), readback.end()) == message;
+		});
+	wait_for(loop, [&] { return rw.load(); });
+	assert.expect(rw.load(), true, prefix + "RW");
+	/* Fill file with its own offsets, then read 1000 blocks concurrently */
+	const int blocks = 1000;
+	const size_t block = 256;
+	string content;
+	for (int i = 0; i < blocks; i++) {
+		string line = to_string(i);
+		line.resize(block, '.');
+		content += line;
+	}
+	if (pwrite(fd, content.data(), content.size(), 0) != ssize_t(content.size())) {
+		throw runtime_error("pwrite failed");
+	}
+	vector<vector<char>> buffers(blocks, vector<char>(block));
+	atomic<int> matched{0};
+	atomic<int> completed{0};
+	for (int i = 0; i < blocks; i++) {
+		engine.read(fd, buffers[i].data(), block, i * block)
+			->then([&, i] (size_t count) {
+				if (count == block && string(buffers[i].begin(), buffers[i].end()) == content.substr(i * block, block)) {
+					matched++;
+				}
+				completed++;
+			});
+	}
+	wait_for(loop, [&] { return completed == blocks; });
+	assert.expect(matched.load(), blocks, prefix + "MANY");
+	/* Stream it back in odd-sized chunks */
+	BufferPool chunks(1000, 4);
+	string streamed;
+	atomic<size_t> total{0};
+	atomic<bool> done{false};
+	engine.read_stream(fd, chunks)
+		->stream([&] (Buffer chunk) {
+			streamed.append(chunk.begin(), chunk.end());
+		})
+		->then([&] (size_t count) {
+			total = count;
+			done = true;
+		});
+	wait_for(loop, [&] { return done.load(); });
+	assert.expect(streamed == content && total == content.size() && chunks.allocated() <= 4, true, prefix + "STREAM");
+	close(fd);
+	/* Errors */
+	atomic<bool> rejected{false};
+	char byte;
+	engine.read(-1, &byte, 1)
+		->then(
+			[] (size_t) { },
+			[&] (exception_ptr error) {
+				try {
+					rethrow_exception(error);
+				} catch (const system_error& e) {
+					rejected = e.code().value() == EBADF;
+				}
+			});
+	wait_for(loop, [&] { return rejected.load(); });
+	assert.expect(rejected.load(), true, prefix + "ERR");
+}
+
+int main(int argc, char *argv[])
+try {
+	char dir[] = "/tmp/kaiu_test_io_XXXXXX";
+	if (!mkdtemp(dir)) {
+		throw runtime_error("mkdtemp failed");
+	}
+	const string path = string(dir) + "/file";
+	ParallelEventLoop loop({
+		{ EventLoopPool::io_local, 2 }
+	});
+	bool backends;
+	{
+		IoEngine automatic(loop);
+		IoEngine threads(loop, EventLoopPool::io_local, 64, IoEngine::Backend::threads);
+		backends = automatic.backend() != IoEngine::Backend::automatic &&
+			threads.backend() == IoEngine::Backend::threads;
+		if (automatic.backend() == IoEngine::Backend::uring) {
+			test_engine(loop, automatic, "U", path);
+		} else {
+			/* Not available here, so nothing to test */
+			assert.skip("URW");
+			assert.skip("UMANY");
+			assert.skip("USTREAM");
+			assert.skip("UERR");
+		}
+		test_engine(loop, threads, "T", path);
+		loop.join();
+	}
+	assert.expect(backends, true, "BACKEND");
+	unlink(path.c_str());
+	rmdir(dir);
+	return assert.print(argc, argv);
+} catch (...) {
+	assert.print_error();
+}
@@ -0,0 +1,159 @@
+#include <atomic>
+#include <vector>
+#include <string>
+#include <numeric>
+#include <stdexcept>
+#include "assertion.h"
+#include "event_loop.h"
+#include "promise.h"
+#include "parallel.h"
+#include "decimal.h"
+
+using namespace std;
+using namespace kaiu;
+
+Assertions assert({
+	{ nullptr, "Algorithms" },
+	{ "FOR", "parallel_for calls func once for each element" },
+	{ "TRANSFORM", "parallel_transform fills the output range and resolves to its end" },
+	{ "REDUCE", "parallel_reduce reduces all elements" },
+	{ "ORDER", "parallel_reduce combines chunks in order" },
+	{ "EMPTY", "Empty ranges resolve at once (reduce to identity)" },
+	{ "ERROR", "Exceptions thrown by func reject the promise" },
+	{ nullptr, "Pools" },
+	{ "POOL", "Work runs in the given pool" },
+	{ "WORKER", "Algorithms started by a worker of a one-thread pool complete" },
+	{ nullptr, "Decimal" },
+	{ "PMUL", "parallel_multiply matches operator *" },
+});
+
+const int items = 100000;
+
+void algorithm_test()
+{
+	ParallelEventLoop loop({
+		{ EventLoopPool::calculation, 2 }
+	});
+	vector<int> data(items);
+	iota(data.begin(), data.end(), 0);
+	/* parallel_for */
+	vector<atomic<int>> calls(items);
+	bool for_done = false;
+	promise::parallel_for(loop, EventLoopPool::calculation, data.cbegin(), data.cend(),
+		[&calls] (const int x) { calls[x]++; })
+		->then([&for_done] (nullptr_t) { for_done = true; });
+	/* parallel_transform */
+	vector<long> squares(items);
+	bool transform_end = false;
+	promise::parallel_transform(loop, EventLoopPool::calculation, data.cbegin(), data.cend(),
+		squares.begin(), [] (const int x) { return long(x) * x; })
+		->then([&transform_end, &squares] (vector<long>::iterator end) {
+			transform_end = end == squares.end();
+		});
+	/* parallel_reduce */
+	long sum = 0;
+	promise::parallel_reduce(loop, EventLoopPool::calculation, data.cbegin(), data.cend(),
+		0L,
+		[] (long acc, const int x) { return acc + x; },
+		[] (long a, long b) { return a + b; })
+		->then([&sum] (long x) { sum = x; });
+	/* Concatenation is not commutative */
+	string letters;
+	for (int i = 0; i < 1000; i++) {
+		letters.push_back('a' + i % 26);
+	}
+	string joined;
+	promise::parallel_reduce(loop, EventLoopPool::calculation, letters.cbegin(), letters.cend(),
+		string(),
+		[] (string acc, const char c) { acc.push_back(c); return acc; },
+		[] (string a, const string& b) { return a + b; })
+		->then([&joined] (string x) { joined = move(x); });
+	/* Empty ranges */
+	int empty_reduced = 0;
+	bool empty_done = false;
+	promise::parallel_reduce(loop, EventLoopPool::calculation, data.cbegin(), data.cbegin(),
+		42,
+		[] (int acc, const int) { return acc; },
+		[] (int a, int) { return a; })
+		->then([&empty_reduced] (int x) { empty_reduced = x; });
+	promise::parallel_for(loop, EventLoopPool::calculation, data.cbegin(), data.cbegin(),
+		[] (const int) { })
+		->then([&empty_done] (nullptr_t) { empty_done = true; });
+	/* Errors */
+	bool rejected = false;
+	promise::parallel_for(loop, EventLoopPool::calculation, data.cbegin(), data.cend(),
+		[] (const int x) {
+			if (x == items / 3) {
+				throw runtime_error("Failed");
+			}
+		})
+		->then(
+			[] (nullptr_t) { },
+			[&rejected] (exception_ptr) { rejected = true; });
+	/* Pool */
+	atomic<bool> wrong_pool{false};
+	promise::parallel_for(loop, EventLoopPool::calculation, data.cbegin(), data.cend(),
+		[&wrong_pool] (const int) {
+			if (ParallelEventLoop::current_pool() != EventLoopPool::calculation) {
+				wrong_pool = true;
+			}
+		});
+	loop.join();
+	bool once = true;
+	for (const auto& count : calls) {
+		once = once && count == 1;
+	}
+	bool squared = true;
+	for (int i = 0; i < items; i++) {
+		squared = squared && squares[i] == long(i) * i;
+	}
+	assert.expect(for_done && once, true, "FOR");
+	assert.expect(transform_end && squared, true, "TRANSFORM");
+	assert.expect(sum, long(items) * (items - 1) / 2, "REDUCE");
+	assert.expect(joined == letters, true, "ORDER");
+	assert.expect(empty_done && empty_reduced == 42, true, "EMPTY");
+	assert.expect(rejected, true, "ERROR");
+	assert.expect(wrong_pool.load(), false, "POOL");
+}
+
+void worker_test()
+{
+	ParallelEventLoop loop({
+		{ EventLoopPool::calculation, 1 }
+	});
+	vector<int> data(items, 1);
+	atomic<int> sum{0};
+	loop.push(EventLoopPool::calculation, [&data, &sum] (EventLoop& loop) {
+		promise::parallel_reduce(loop, EventLoopPool::calculation, data.cbegin(), data.cend(),
+			0,
+			[] (int acc, const int x) { return acc + x; },
+			[] (int a, int b) { return a + b; })
+			->then([&sum] (int x) { sum = x; });
+	});
+	loop.join();
+	assert.expect(sum.load(), items, "WORKER");
+}
+
+void decimal_test()
+{
+	ParallelEventLoop loop({
+		{ EventLoopPool::calculation, 2 }
+	});
+	const decimal a(string(3000, '7') + "123");
+	const decimal b(string(2000, '9') + "45678");
+	decimal product;
+	decimal::parallel_multiply(loop, a, b)
+		->then([&product] (decimal x) { product = x; });
+	loop.join();
+	assert.expect(product == a * b, true, "PMUL");
+}
+
+int main(int argc, char *argv[])
+try {
+	algorithm_test();
+	worker_test();
+	decimal_test();
+	return assert.print(argc, argv);
+} catch (...) {
+	assert.print_error();
+}
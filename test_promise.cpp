@@ -3,6 +3,9 @@
 #include <thread>
 #include <mutex>
 #include <condition_variable>
+#include <atomic>
+#include <vector>
+#include <map>
 #include "assertion.h"
 #include "promise.h"
 
@@ -32,10 +35,20 @@ Assertions assert({
 	{ nullptr, "Promise combinator (homogenous)" },
 	{ "VCR", "Resolves correctly" },
 	{ "VCJ", "Rejects correctly" },
+	{ "VCE", "Resolves with no promises" },
+	{ "VCT", "Resolves once, whichever threads resolve the promises" },
+	{ nullptr, "Race, any, some, all settled" },
+	{ "RACE", "Race takes the first to settle and cancels the losers" },
+	{ "ANY", "Any skips rejections, rejects with last error if all reject" },
+	{ "SOME", "Some takes the first n in order, rejects once impossible" },
+	{ "SETTLED", "All settled gives each result or error in order" },
 	{ nullptr, "Efficiency" },
 	{ "NC", "Copy-free promise chaining" },
 	{ "NCP", "Copy-free heterogenous combinator" },
 	{ "NCV", "Copy-free homogenous combinator" },
+	{ "NJ", "Rejection crosses links without handlers as the same error" },
+	{ "NREF", "Handle is one pointer, state is freed with its last handle" },
+	{ "NLAST", "Callback may release the last handle to its own promise" },
 	{ nullptr, "Compiler handles optional arguments correctly (statically checked)" },
 	{ "OATH", "Then: omit 'handler'" },
 	{ "OATF", "Then: omit 'finalizer'" },
@@ -256,8 +269,58 @@ void dynamic_combine_test()
 			[] (const auto error) {
 				assert.pass("VCJ");
 			});
+	seq.resize(0);
+	bool empty = false;
+	promise::combine(seq)
+		->then([&empty] (const auto result) { empty = result.empty(); });
+	assert.expect(empty, true, "VCE");
+	/* Promises resolved concurrently from several threads */
+	const size_t many = 20000;
+	const size_t threads = 4;
+	vector<Promise<size_t>> pending(many);
+	atomic<int> resolutions{0};
+	size_t sum = 0;
+	promise::combine(pending)
+		->then([&] (const auto result) {
+			resolutions++;
+			for (const auto x : result) {
+				sum += x;
+			}
+		});
+	vector<thread> resolvers;
+	for (size_t t = 0; t < threads; t++) {
+		resolvers.emplace_back([&pending, t] {
+			for (size_t i = t; i < many; i += threads) {
+				pending[i]->resolve(i);
+			}
+		});
+	}
+	for (auto& resolver : resolvers) {
+		resolver.join();
+	}
+	assert.expect(resolutions == 1 && sum == many * (many - 1) / 2, true, "VCT");
 }
 
+/* Counts live allocations, to check when promise states are freed */
+template <typename T>
+struct LiveAllocator {
+	using value_type = T;
+	LiveAllocator(int& live) : live(live) { }
+	template <typename U>
+	LiveAllocator(const LiveAllocator<U>& from) : live(from.live) { }
+	T *allocate(const size_t n)
+	{
+		live++;
+		return allocator<T>().allocate(n);
+	}
+	void deallocate(T *p, const size_t n)
+	{
+		live--;
+		allocator<T>().deallocate(p, n);
+	}
+	int& live;
+};
+
 void efficiency_test()
 {
 	{
@@ -298,6 +361,45 @@ void efficiency_test()
 					"NCV");
 			});
 	}
+	{
+		const auto error = make_exception_ptr(runtime_error("oops"));
+		promise::rejected<int>(error)
+			->then([] (int x) { return promise::resolved<int>(x); })
+			->then([] (int x) { return x; })
+			->finally([] { })
+			->then(
+				[] (int) {
+					assert.fail("NJ");
+				},
+				[error] (exception_ptr e) {
+					assert.expect(e == error, true, "NJ");
+				});
+	}
+	{
+		int live = 0;
+		bool shared;
+		{
+			Promise<int> a(allocator_arg, LiveAllocator<int>(live));
+			Promise<int> b = a;
+			Promise<int&&> c(b);
+			a = Promise<int>();
+			shared = live == 1 && b.operator ->() == c.operator ->();
+			b->resolve(1);
+		}
+		assert.expect(sizeof(Promise<int>) == sizeof(void *) && shared && live == 0, true, "NREF");
+	}
+	{
+		int live = 0;
+		int value = 0;
+		map<int, Promise<int>> pending;
+		pending.emplace(1, Promise<int>(allocator_arg, LiveAllocator<int>(live)));
+		pending.at(1)->then([&pending, &value] (int x) {
+			value = x;
+			pending.erase(1);
+		});
+		pending.at(1)->resolve(5);
+		assert.expect(value == 5 && pending.empty() && live == 0, true, "NLAST");
+	}
 }
 
 void static_checks()
@@ -510,11 +612,88 @@ void monad_chain_test()
 	}
 }
 
+string error_message(exception_ptr error)
+{
+	try {
+		rethrow_exception(error);
+	} catch (const exception& e) {
+		return e.what();
+	}
+}
+
+void race_test()
+{
+	{
+		vector<Promise<int>> promises(3);
+		auto losers = CancellationToken::create();
+		int result = 0;
+		promise::race(promises, losers)
+			->then([&result] (int x) { result = x; });
+		promises[1]->resolve(2);
+		const bool cancelled = losers.is_cancelled();
+		promises[0]->reject("late");
+		promises[2]->resolve(3);
+		assert.expect(result == 2 && cancelled, true, "RACE");
+	}
+	{
+		vector<Promise<int>> promises(3);
+		int result = 0;
+		promise::any(promises)
+			->then([&result] (int x) { result = x; });
+		promises[2]->reject("first");
+		promises[0]->resolve(1);
+		promises[1]->resolve(2);
+		string error;
+		promise::any(vector<Promise<int>>{ promise::rejected<int>("a"), promise::rejected<int>("b") })
+			->then(
+				[] (int) { },
+				[&error] (exception_ptr e) { error = error_message(e); });
+		assert.expect(result == 1 && error == "b", true, "ANY");
+	}
+	{
+		vector<Promise<int>> promises(4);
+		vector<int> result;
+		promise::some(2, promises)
+			->then([&result] (vector<int> x) { result = x; });
+		promises[3]->resolve(4);
+		promises[0]->reject("skip");
+		promises[1]->resolve(2);
+		promises[2]->resolve(3);
+		vector<Promise<int>> failing(3);
+		string error;
+		promise::some(2, failing)
+			->then(
+				[] (vector<int>) { },
+				[&error] (exception_ptr e) { error = error_message(e); });
+		failing[0]->reject("one");
+		const bool early = error.empty();
+		failing[1]->reject("two");
+		failing[2]->resolve(3);
+		assert.expect(result == vector<int>{ 4, 2 } && early && error == "two", true, "SOME");
+	}
+	{
+		vector<Promise<int>> promises(3);
+		bool pass = false;
+		promise::all_settled(promises)
+			->then([&pass] (vector<promise::Settled<int>> x) {
+				pass = x.size() == 3 &&
+					x[0].resolved() && x[0].value == 1 &&
+					!x[1].resolved() && error_message(x[1].error) == "no" &&
+					x[2].resolved() && x[2].value == 3;
+			});
+		promises[2]->resolve(3);
+		promises[1]->reject("no");
+		promises[0]->resolve(1);
+		assert.expect(pass, true, "SETTLED");
+	}
+}
+
 int main(int argc, char *argv[])
 try {
 	flow_test();
 	static_combine_test();
 	dynamic_combine_test();
+	race_test();
 	efficiency_test();
 	static_checks();
 	monad_basic_test();
@@ -1,4 +1,5 @@
 #include <algorithm>
+#include <numeric>
 #include <cstdlib>
 #include <exception>
 #include <stdexcept>
@@ -6,6 +7,7 @@
 #include <mutex>
 #include <condition_variable>
 #include <list>
+#include <vector>
 #include "assertion.h"
 #include "promise.h"
 #include "promise_stream.h"
@@ -31,8 +33,28 @@ Assertions assert({
 	{ "DISCARD", "Discarded data is discarded" },
 	{ "STOP", "Producer receives stop request" },
 	{ "REJECT", "Rejected stream stops streaming then promise rejects" },
+	{ "BACKLOG", "Consumer bound after a long backlog does not recurse per datum" },
+	{ nullptr, "Parallel consumer" },
+	{ "PLIMIT", "Up to max_in_flight consumers run at once, result waits for all" },
+	{ "PSTOP", "Stop from one consumer drops buffered data and stops producer" },
+	{ "PDISCARD", "Discard from one consumer is not undone by a slower Continue" },
+	{ "PORDER", "Ordered map writes results in order of data" },
+	{ "PUNORDER", "Unordered map writes results as they complete" },
+	{ "PHELD", "Ordered map holds no more than max_in_flight results" },
+	{ "PFAIL", "Ordered map rejects without waiting for results after a failure" },
+	{ nullptr, "Backpressure" },
+	{ "CAP", "try_write refuses data when the buffer is full" },
+	{ "WASYNC", "write_async waits for room, then resolves with the action" },
+	{ "WSTOP", "Stop releases waiting writers with Stop and drops their data" },
+	{ nullptr, "Batches" },
+	{ "BATCH", "Batched consumer receives buffered data in order, up to the batch size" },
+	{ "BBULK", "Bulk writes are delivered in batches" },
+	{ nullptr, "Single producer" },
+	{ "SPSC", "Data pass through the ring in order, including when it is full" },
+	{ "SPSTOP", "Producer sees a stop without the lock, later data are dropped" },
 	{ nullptr, "Efficiency" },
 	{ "NC", "Copy-free promise streams" },
+	{ "ZC", "Consumer gets a reference to the datum, which is moved once into its slot" },
 });
 
 void flow_test_continue()
@@ -227,12 +249,324 @@ void flow_test_reject()
 	basic_test_stream->write(vector<char>{ 'o', 'o', 'p', 's' });
 }
 
+void flow_test_backlog()
+{
+	PromiseStream<int, int> stream;
+	const int count = 1000000;
+	for (int i = 0; i < count; i++) {
+		stream->write(1);
+	}
+	int sum = 0;
+	stream
+		->stream([&sum] (int x) { sum += x; })
+		->then([] (int) { });
+	stream->resolve(0);
+	assert.expect(sum, count, "BACKLOG");
+}
+
 void flow_test()
 {
 	flow_test_continue();
 	flow_test_discard();
 	flow_test_stop();
 	flow_test_reject();
+	flow_test_backlog();
+}
+
+void parallel_test()
+{
+	/* Consumers return pending promises, completed by the test */
+	{
+		PromiseStream<int, int> stream;
+		vector<Promise<StreamAction>> running;
+		size_t finished = 0;
+		size_t most = 0;
+		int result = 0;
+		stream
+			->stream_parallel([&] (int) {
+				running.emplace_back();
+				most = max(most, running.size() - finished);
+				return running.back();
+			}, 3)
+			->then([&result] (int x) { result = x; });
+		for (int i = 0; i < 10; i++) {
+			stream->write(i);
+		}
+		stream->resolve(42);
+		while (finished < running.size()) {
+			if (result != 0) {
+				break;
+			}
+			running[finished++]->resolve(StreamAction::Continue);
+		}
+		assert.expect(most == 3 && finished == 10 && result == 42, true, "PLIMIT");
+	}
+	{
+		PromiseStream<int, int> stream;
+		vector<Promise<StreamAction>> running;
+		int result = 0;
+		stream
+			->stream_parallel([&] (int) {
+				running.emplace_back();
+				return running.back();
+			}, 2)
+			->then([&result] (int x) { result = x; });
+		for (int i = 0; i < 10; i++) {
+			stream->write(i);
+		}
+		running[1]->resolve(StreamAction::Stop);
+		const bool stopping = stream->stop_requested();
+		stream->write(10);
+		stream->resolve(1);
+		const bool waited = result == 0;
+		running[0]->resolve(StreamAction::Continue);
+		assert.expect(stopping && waited && running.size() == 2 && result == 1, true, "PSTOP");
+	}
+	{
+		PromiseStream<int, int> stream;
+		vector<Promise<StreamAction>> running;
+		int result = 0;
+		stream
+			->stream_parallel([&] (int) {
+				running.emplace_back();
+				return running.back();
+			}, 2)
+			->then([&result] (int x) { result = x; });
+		for (int i = 0; i < 10; i++) {
+			stream->write(i);
+		}
+		running[1]->resolve(StreamAction::Discard);
+		running[0]->resolve(StreamAction::Continue);
+		stream->write(10);
+		stream->resolve(1);
+		assert.expect(running.size() == 2 && result == 1, true, "PDISCARD");
+	}
+	/* Maps complete in reverse order */
+	for (const auto order : { StreamOrder::ordered, StreamOrder::unordered }) {
+		PromiseStream<int, int> stream;
+		vector<Promise<int>> running;
+		vector<int> out;
+		stream
+			->stream_parallel([&running] (int) {
+				running.emplace_back();
+				return running.back();
+			}, 4, order)
+			->stream([&out] (int x) { out.push_back(x); })
+			->then([] (int) { });
+		for (int i = 0; i < 4; i++) {
+			stream->write(i);
+		}
+		stream->resolve(0);
+		for (int i = 3; i >= 0; i--) {
+			running[i]->resolve(i * 10);
+		}
+		if (order == StreamOrder::ordered) {
+			assert.expect(out == vector<int>{ 0, 10, 20, 30 }, true, "PORDER");
+		} else {
+			assert.expect(out == vector<int>{ 30, 20, 10, 0 }, true, "PUNORDER");
+		}
+	}
+	/* The first result is late, the rest are ready at once */
+	{
+		PromiseStream<int, int> stream;
+		Promise<int> first;
+		size_t calls = 0;
+		vector<int> out;
+		stream
+			->stream_parallel([&] (int x) {
+				return calls++ == 0 ? first : promise::resolved(x);
+			}, 3, StreamOrder::ordered)
+			->stream([&out] (int x) { out.push_back(x); })
+			->then([] (int) { });
+		for (int i = 0; i < 10; i++) {
+			stream->write(i);
+		}
+		stream->resolve(0);
+		const size_t held = calls;
+		first->resolve(0);
+		assert.expect(held == 3 && calls == 10 && out.size() == 10 && out.front() == 0 &&
+			out.back() == 9, true, "PHELD");
+	}
+	{
+		PromiseStream<int, int> stream;
+		vector<Promise<int>> running;
+		bool rejected = false;
+		stream
+			->stream_parallel([&running] (int) {
+				running.emplace_back();
+				return running.back();
+			}, 3, StreamOrder::ordered)
+			->stream([] (int) { })
+			->then(
+				[] (int) { },
+				[&rejected] (exception_ptr) { rejected = true; });
+		for (int i = 0; i < 3; i++) {
+			stream->write(i);
+		}
+		stream->resolve(0);
+		running[2]->resolve(2);
+		running[1]->resolve(1);
+		running[0]->reject("Failed");
+		assert.expect(rejected, true, "PFAIL");
+	}
+}
+
+void backpressure_test()
+{
+	/* The consumer holds one datum until the test completes its promise */
+	{
+		PromiseStream<int, int> stream;
+		stream->set_capacity(2);
+		vector<Promise<StreamAction>> running;
+		vector<int> consumed;
+		stream
+			->stream([&] (int x) {
+				consumed.push_back(x);
+				running.emplace_back();
+				return running.back();
+			})
+			->then([] (int) { });
+		/* One taken by the consumer, two buffered */
+		const bool first = stream->try_write(1) && stream->try_write(2) && stream->try_write(3);
+		const bool full = !stream->try_write(4);
+		running[0]->resolve(StreamAction::Continue);
+		const bool room = stream->try_write(4);
+		for (size_t i = 1; i < 4; i++) {
+			running[i]->resolve(StreamAction::Continue);
+		}
+		stream->resolve(0);
+		assert.expect(first && full && room && consumed == vector<int>{ 1, 2, 3, 4 }, true, "CAP");
+	}
+	{
+		PromiseStream<int, int> stream;
+		stream->set_capacity(1);
+		vector<Promise<StreamAction>> running;
+		stream
+			->stream([&] (int) {
+				running.emplace_back();
+				return running.back();
+			})
+			->then([] (int) { });
+		stream->write_async(1);
+		stream->write_async(2);
+		bool written = false;
+		StreamAction action = StreamAction::Stop;
+		stream->write_async(3)
+			->then([&] (StreamAction a) { written = true; action = a; });
+		const bool waited = !written;
+		running[0]->resolve(StreamAction::Continue);
+		const bool resolved = written && action == StreamAction::Continue;
+		running[1]->resolve(StreamAction::Continue);
+		running[2]->resolve(StreamAction::Continue);
+		stream->resolve(0);
+		assert.expect(waited && resolved && running.size() == 3, true, "WASYNC");
+	}
+	{
+		PromiseStream<int, int> stream;
+		stream->set_capacity(1);
+		vector<Promise<StreamAction>> running;
+		stream
+			->stream([&] (int) {
+				running.emplace_back();
+				return running.back();
+			})
+			->then([] (int) { });
+		stream->write_async(1);
+		stream->write_async(2);
+		StreamAction action = StreamAction::Continue;
+		stream->write_async(3)
+			->then([&action] (StreamAction a) { action = a; });
+		stream->request_stop();
+		running[0]->resolve(StreamAction::Continue);
+		stream->resolve(0);
+		assert.expect(action == StreamAction::Stop && running.size() == 1, true, "WSTOP");
+	}
+}
+
+void batch_test()
+{
+	{
+		PromiseStream<int, int> stream;
+		for (int i = 1; i <= 5; i++) {
+			stream->write(i);
+		}
+		stream->resolve(42);
+		vector<vector<int>> batches;
+		int result = 0;
+		stream
+			->stream_batch([&batches] (vector<int> batch) { batches.push_back(move(batch)); }, 3)
+			->then([&result] (int x) { result = x; });
+		assert.expect(batches == vector<vector<int>>{ { 1, 2, 3 }, { 4, 5 } } && result == 42, true, "BATCH");
+	}
+	{
+		PromiseStream<int, int> stream;
+		vector<size_t> sizes;
+		int sum = 0;
+		stream
+			->stream_batch([&] (vector<int> batch) {
+				sizes.push_back(batch.size());
+				sum = accumulate(batch.begin(), batch.end(), sum);
+				return StreamAction::Continue;
+			}, 4)
+			->then([] (int) { });
+		vector<int> data(10);
+		iota(data.begin(), data.end(), 1);
+		stream->write_bulk(move(data));
+		stream->resolve(0);
+		assert.expect(sizes == vector<size_t>{ 4, 4, 2 } && sum == 55, true, "BBULK");
+	}
+}
+
+void single_producer_test()
+{
+	/* The consumer holds one datum until the test completes its promise */
+	{
+		PromiseStream<int, int> stream;
+		stream->set_single_producer(4);
+		Promise<StreamAction> running;
+		vector<int> consumed;
+		int result = 0;
+		stream
+			->stream([&] (int x) {
+				consumed.push_back(x);
+				if (x == 0) {
+					return running;
+				}
+				return promise::resolved(StreamAction::Continue);
+			})
+			->then([&result] (int x) { result = x; });
+		/* Ring holds 4 while the consumer is busy, the rest go to the buffer */
+		for (int i = 0; i < 10; i++) {
+			stream->write(i);
+		}
+		const bool waiting = consumed.size() == 1;
+		stream->write(10);
+		stream->resolve(1);
+		const bool pending = result == 0;
+		running->resolve(StreamAction::Continue);
+		vector<int> expect(11);
+		iota(expect.begin(), expect.end(), 0);
+		assert.expect(waiting && pending && consumed == expect && result == 1, true, "SPSC");
+	}
+	{
+		PromiseStream<int, int> stream;
+		stream->set_single_producer();
+		int consumed = 0;
+		int result = 0;
+		stream
+			->stream([&consumed] (int x) {
+				consumed++;
+				return x == 3 ? StreamAction::Stop : StreamAction::Continue;
+			})
+			->then([&result] (int x) { result = x; });
+		int produced = 0;
+		while (!stream->stop_requested() && produced < 100) {
+			stream->write(produced++);
+		}
+		stream->write(produced);
+		stream->resolve(produced);
+		assert.expect(produced == 4 && consumed == 4 && result == 4, true, "SPSTOP");
+	}
 }
 
 void efficiency_test()
@@ -257,11 +591,39 @@ void efficiency_test()
 	test_stream->write(make_stone(2));
 	test_stream->write(make_stone(3));
 	test_stream->resolve(make_stone(6));
+	/* Counts moves and copies of one datum */
+	struct Counted {
+		Counted(int& moves) : moves(moves) { }
+		Counted(const Counted& other) : moves(other.moves) { moves += 100; }
+		Counted(Counted&& other) noexcept : moves(other.moves) { moves++; }
+		int& moves;
+	};
+	int moves = 0;
+	const Counted *seen = nullptr;
+	bool buffered = false;
+	PromiseStream<int, Counted> ref_stream;
+	ref_stream
+		->stream([&] (const Counted& datum) { seen = &datum; })
+		->then([] (int) { });
+	ref_stream->write(Counted(moves));
+	ref_stream->resolve(0);
+	/* Written before the consumer is attached, so it waits in the buffer */
+	PromiseStream<int, Counted> buffered_stream;
+	buffered_stream->write(Counted(moves));
+	buffered_stream
+		->stream([&] (Counted&&) { buffered = true; })
+		->then([] (int) { });
+	buffered_stream->resolve(0);
+	assert.expect(seen != nullptr && buffered && moves == 2, true, "ZC");
 }
 
 int main(int argc, char *argv[])
 try {
 	flow_test();
+	parallel_test();
+	backpressure_test();
+	batch_test();
+	single_producer_test();
 	efficiency_test();
 	return assert.print(argc, argv);
 } catch (...) {
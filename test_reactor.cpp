@@ -0,0 +1,332 @@
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <thread>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "assertion.h"
+#include "event_loop.h"
+#include "promise.h"
+#include "promise_stream.h"
+#include "reactor.h"
+
+using namespace kaiu;
+using namespace std;
+using namespace std::chrono_literals;
+
+Assertions assert({
+	{ nullptr, "Reads and writes" },
+	{ "RW", "Data written to a socket pair is read back" },
+	{ "RWAIT", "Read waits for data to arrive" },
+	{ "RBIG", "Large write completes across several writable events" },
+	{ "REOF", "Read resolves to empty buffer at end of file" },
+	{ nullptr, "Connections" },
+	{ "ACCEPT", "Accept and connect over loopback" },
+	{ "MANY", "Many concurrent connections on a small pool" },
+	{ nullptr, "Streams" },
+	{ "STREAM", "read_stream delivers all data in order then resolves" },
+	{ nullptr, "Errors" },
+	{ "CLOSE", "Closing a descriptor rejects its pending read" },
+	{ "REUSE", "Descriptor number reused after closing without the reactor can be waited on" },
+	{ "DESTROY", "Destroying the reactor rejects pending reads in the pool" }
+});
+
+void make_pair_nonblocking(int fds[2])
+{
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+		throw runtime_error("socketpair failed");
+	}
+	Reactor::set_nonblocking(fds[0]);
+	Reactor::set_nonblocking(fds[1]);
+}
+
+void test_read_write(ParallelEventLoop& loop, Reactor& reactor)
+{
+	int fds[2];
+	make_pair_nonblocking(fds);
+	atomic<bool> rw{false};
+	reactor.write(fds[0], vector<char>{ 'h', 'i' })
+		->then([&] (size_t count) {
+			return reactor.read(fds[1], 16);
+		})
+		->then([&] (vector<char> data) {
+			rw = string(data.begin(), data.end()) == "hi";
+		});
+	loop.join();
+	assert.expect(rw.load(), true, "RW");
+	/* Read pending before the write */
+	atomic<bool> waited{false};
+	reactor.read(fds[1], 16)
+		->then([&] (vector<char> data) {
+			waited = string(data.begin(), data.end()) == "later";
+		});
+	this_thread::sleep_for(20ms);
+	reactor.write(fds[0], vector<char>{ 'l', 'a', 't', 'e', 'r' })
+		->then([] (size_t) { });
+	/* Reads are not part of join, so wait for the result */
+	for (int i = 0; i < 500 && !waited; i++) {
+		this_thread::sleep_for(2ms);
+	}
+	loop.join();
+	assert.expect(waited.load(), true, "RWAIT");
+	/* Bigger than the socket buffer, so the write has to wait */
+	const size_t big = 4 << 20;
+	atomic<size_t> written{0};
+	atomic<size_t> received{0};
+	reactor.write(fds[0], vector<char>(big, 'x'))
+		->then([&] (size_t count) { written = count; });
+	reactor.read_stream(fds[1], 65536)
+		->stream([&] (vector<char> data) {
+			received += data.size();
+			return received >= big ? StreamAction::Stop : StreamAction::Continue;
+		})
+		->then([] (size_t) { });
+	for (int i = 0; i < 2000 && (written < big || received < big); i++) {
+		this_thread::sleep_for(2ms);
+	}
+	loop.join();
+	assert.expect(written == big && received == big, true, "RBIG");
+	/* End of file */
+	atomic<bool> eof{false};
+	::shutdown(fds[0], SHUT_WR);
+	reactor.read(fds[1], 16)
+		->then([&] (vector<char> data) { eof = data.empty(); });
+	for (int i = 0; i < 500 && !eof; i++) {
+		this_thread::sleep_for(2ms);
+	}
+	loop.join();
+	assert.expect(eof.load(), true, "REOF");
+	reactor.close(fds[0]);
+	reactor.close(fds[1]);
+}
+
+int listen_loopback(sockaddr_in& addr)
+{
+	const int server = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	addr = sockaddr_in{};
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = 0;
+	socklen_t len = sizeof(addr);
+	if (::bind(server, reinterpret_cast<sockaddr *>(&addr), len) < 0 ||
+			listen(server, 1024) < 0 ||
+			getsockname(server, reinterpret_cast<sockaddr *>(&addr), &len) < 0) {
+		throw runtime_error("Failed to listen on loopback");
+	}
+	return server;
+}
+
+void test_connections(ParallelEventLoop& loop, Reactor& reactor)
+{
+	sockaddr_in addr;
+	const int server = listen_loopback(addr);
+	/* One connection, server sends a greeting */
+	atomic<bool> greeted{false};
+	reactor.accept(server)
+		->then([&] (int client) {
+			return reactor.write(client, vector<char>{ 'o', 'k' })
+				->then([&reactor, client] (size_t count) {
+					reactor.close(client);
+					return count;
+				});
+		})
+		->then([] (size_t) { });
+	const int sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	reactor.connect(sock, reinterpret_cast<sockaddr *>(&addr), sizeof(addr))
+		->then([&] (nullptr_t) {
+			return reactor.read(sock, 16);
+		})
+		->then([&] (vector<char> data) {
+			greeted = string(data.begin(), data.end()) == "ok";
+		});
+	for (int i = 0; i < 1000 && !greeted; i++) {
+		this_thread::sleep_for(2ms);
+	}
+	loop.join();
+	reactor.close(sock);
+	assert.expect(greeted.load(), true, "ACCEPT");
+	/* Many echo connections, served by a two-thread pool */
+	const int connections = 200;
+	atomic<int> accepted{0};
+	atomic<int> echoed{0};
+	function<void()> accept_next = [&] {
+		reactor.accept(server)
+			->then([&] (int client) {
+				if (++accepted < connections) {
+					accept_next();
+				}
+				return reactor.read(client, 16)
+					->then([&reactor, client] (vector<char> data) {
+						return reactor.write(client, move(data));
+					})
+					->then([&reactor, client] (size_t count) {
+						reactor.close(client);
+						return count;
+					});
+			})
+			->then([] (size_t) { });
+	};
+	accept_next();
+	vector<int> socks;
+	for (int i = 0; i < connections; i++) {
+		const int sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+		socks.push_back(sock);
+		const string message = to_string(i);
+		reactor.connect(sock, reinterpret_cast<sockaddr *>(&addr), sizeof(addr))
+			->then([&reactor, sock, message] (nullptr_t) {
+				return reactor.write(sock, vector<char>(message.begin(), message.end()));
+			})
+			->then([&reactor, sock] (size_t) {
+				return reactor.read(sock, 16);
+			})
+			->then([&echoed, message] (vector<char> data) {
+				if (string(data.begin(), data.end()) == message) {
+					echoed++;
+				}
+			});
+	}
+	for (int i = 0; i < 2500 && echoed < connections; i++) {
+		this_thread::sleep_for(2ms);
+	}
+	loop.join();
+	for (const auto sock : socks) {
+		reactor.close(sock);
+	}
+	reactor.close(server);
+	assert.expect(echoed.load(), connections, "MANY");
+}
+
+void test_stream(ParallelEventLoop& loop, Reactor& reactor)
+{
+	int fds[2];
+	make_pair_nonblocking(fds);
+	string received;
+	atomic<bool> done{false};
+	atomic<size_t> total{0};
+	reactor.read_stream(fds[1], 3)
+		->stream([&] (vector<char> data) {
+			received.append(data.begin(), data.end());
+		})
+		->then([&] (size_t count) {
+			total = count;
+			done = true;
+		});
+	string sent;
+	for (int i = 0; i < 100; i++) {
+		const string chunk = to_string(i) + ",";
+		sent += chunk;
+		reactor.write(fds[0], vector<char>(chunk.begin(), chunk.end()))
+			->then([] (size_t) { });
+		loop.join();
+	}
+	::shutdown(fds[0], SHUT_WR);
+	for (int i = 0; i < 1000 && !done; i++) {
+		this_thread::sleep_for(2ms);
+	}
+	loop.join();
+	assert.expect(done && received == sent && total == sent.size(), true, "STREAM");
+	reactor.close(fds[0]);
+	reactor.close(fds[1]);
+}
+
+void test_close(ParallelEventLoop& loop, Reactor& reactor)
+{
+	int fds[2];
+	make_pair_nonblocking(fds);
+	atomic<bool> rejected{false};
+	reactor.read(fds[1], 16)
+		->then(
+			[&] (vector<char>) { },
+			[&] (exception_ptr) { rejected = true; });
+	this_thread::sleep_for(20ms);
+	loop.join();
+	reactor.close(fds[1]);
+	loop.join();
+	reactor.close(fds[0]);
+	assert.expect(rejected.load(), true, "CLOSE");
+}
+
+void test_reuse(ParallelEventLoop& loop, Reactor& reactor)
+{
+	int fds[2];
+	make_pair_nonblocking(fds);
+	/* Register the descriptor with epoll, then close it behind the reactor's back */
+	atomic<bool> first{false};
+	reactor.read(fds[1], 16)
+		->then([&] (vector<char>) { first = true; });
+	this_thread::sleep_for(20ms);
+	reactor.write(fds[0], vector<char>{ 'a' })
+		->then([] (size_t) { });
+	for (int i = 0; i < 500 && !first; i++) {
+		this_thread::sleep_for(2ms);
+	}
+	loop.join();
+	const int old = fds[1];
+	::close(fds[0]);
+	::close(fds[1]);
+	/* The lowest free numbers are handed out again */
+	make_pair_nonblocking(fds);
+	const int reused = fds[0] == old ? 0 : 1;
+	atomic<bool> waited{false};
+	reactor.read(fds[reused], 16)
+		->then(
+			[&] (vector<char> data) { waited = data.size() == 1; },
+			[&] (exception_ptr) { });
+	this_thread::sleep_for(20ms);
+	reactor.write(fds[1 - reused], vector<char>{ 'b' })
+		->then([] (size_t) { });
+	for (int i = 0; i < 500 && !waited; i++) {
+		this_thread::sleep_for(2ms);
+	}
+	loop.join();
+	assert.expect(first && fds[reused] == old && waited, true, "REUSE");
+	reactor.close(fds[0]);
+	reactor.close(fds[1]);
+}
+
+void test_destroy(ParallelEventLoop& loop)
+{
+	int fds[2];
+	make_pair_nonblocking(fds);
+	atomic<bool> rejected{false};
+	atomic<bool> in_pool{false};
+	{
+		Reactor reactor(loop);
+		reactor.read(fds[1], 16)
+			->then(
+				[&] (vector<char>) { },
+				[&] (exception_ptr) {
+					in_pool = ParallelEventLoop::current_pool() == EventLoopPool::reactor;
+					rejected = true;
+				});
+		this_thread::sleep_for(20ms);
+		loop.join();
+	}
+	loop.join();
+	::close(fds[0]);
+	::close(fds[1]);
+	assert.expect(rejected && in_pool, true, "DESTROY");
+}
+
+int main(int argc, char *argv[])
+try {
+	ParallelEventLoop loop({
+		{ EventLoopPool::reactor, 2 }
+	});
+	{
+		Reactor reactor(loop);
+		test_read_write(loop, reactor);
+		test_connections(loop, reactor);
+		test_stream(loop, reactor);
+		test_close(loop, reactor);
+		test_reuse(loop, reactor);
+		loop.join();
+	}
+	test_destroy(loop);
+	return assert.print(argc, argv);
+} catch (...) {
+	assert.print_error();
+}
@@ -0,0 +1,140 @@
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <set>
+#include <cstdint>
+#include "assertion.h"
+#include "slab_pool.h"
+#include "promise.h"
+#include "promise_stream.h"
+
+using namespace kaiu;
+using namespace std;
+
+Assertions assert({
+	{ nullptr, "Slab pool" },
+	{ "REUSE", "Freed block is reused by the next allocation of its size class" },
+	{ "ALIGN", "Blocks are aligned to the granularity and do not overlap" },
+	{ "LARGE", "Sizes over the maximum are passed to the heap" },
+	{ "REMOTE", "Blocks freed by another thread return to the owner's cache" },
+	{ "EXIT", "Cache of an exited thread is adopted by the next thread" },
+	{ nullptr, "Promises" },
+	{ "PALLOC", "Promise and stream states use a given allocator" },
+	{ "PTHREAD", "States completed and released on another thread" },
+});
+
+/* Counts allocations, for checking that a given allocator is used */
+template <typename T>
+struct CountingAllocator : SlabAllocator<T> {
+	using value_type = T;
+	template <typename U>
+	struct rebind { using other = CountingAllocator<U>; };
+	CountingAllocator(int& count) : count(count) { }
+	template <typename U>
+	CountingAllocator(const CountingAllocator<U>& from) : count(from.count) { }
+	T *allocate(const size_t n)
+	{
+		count++;
+		return SlabAllocator<T>::allocate(n);
+	}
+	int& count;
+};
+
+void pool_test()
+{
+	/* Reuse */
+	void *a = SlabPool::allocate(40);
+	SlabPool::deallocate(a, 40);
+	void *b = SlabPool::allocate(48);
+	assert.expect(a, b, "REUSE");
+	SlabPool::deallocate(b, 48);
+	/* Alignment and overlap */
+	vector<void *> blocks;
+	set<uintptr_t> starts;
+	bool aligned = true;
+	for (int i = 0; i < 10000; i++) {
+		void *p = SlabPool::allocate(100);
+		aligned = aligned && reinterpret_cast<uintptr_t>(p) % SlabPool::granularity == 0;
+		blocks.push_back(p);
+		starts.insert(reinterpret_cast<uintptr_t>(p));
+	}
+	bool apart = starts.size() == blocks.size();
+	for (auto it = starts.begin(); apart && next(it) != starts.end(); ++it) {
+		apart = *next(it) - *it >= 100;
+	}
+	for (auto p : blocks) {
+		SlabPool::deallocate(p, 100);
+	}
+	assert.expect(aligned && apart, true, "ALIGN");
+	/* Large */
+	const auto slabs = SlabPool::slabs();
+	void *large = SlabPool::allocate(SlabPool::max_size + 1);
+	SlabPool::deallocate(large, SlabPool::max_size + 1);
+	assert.expect(SlabPool::slabs(), slabs, "LARGE");
+	/* Remote free: a block freed by another thread comes back to this one */
+	void *remote = SlabPool::allocate(200);
+	thread([remote] { SlabPool::deallocate(remote, 200); }).join();
+	void *again = SlabPool::allocate(200);
+	assert.expect(again, remote, "REMOTE");
+	SlabPool::deallocate(again, 200);
+	/* Thread exit: a new thread reuses the exited thread's slabs */
+	void *first;
+	thread([&first] {
+		first = SlabPool::allocate(300);
+		SlabPool::deallocate(first, 300);
+	}).join();
+	const auto slabs_before = SlabPool::slabs();
+	void *second;
+	thread([&second] {
+		second = SlabPool::allocate(300);
+		SlabPool::deallocate(second, 300);
+	}).join();
+	assert.expect(second == first && SlabPool::slabs() == slabs_before, true, "EXIT");
+}
+
+void promise_test()
+{
+	/* Allocator argument */
+	int count = 0;
+	int result = 0;
+	{
+		Promise<int> promise(allocator_arg, CountingAllocator<int>(count));
+		promise->then([&result] (int x) { result = x; });
+		promise->resolve(42);
+		PromiseStream<int, int> stream(allocator_arg, CountingAllocator<int>(count));
+	}
+	assert.expect(count == 2 && result == 42, true, "PALLOC");
+	/* States created on one thread, completed and released on others */
+	const int threads = 4;
+	const int per_thread = 10000;
+	vector<vector<Promise<int>>> batches(threads);
+	atomic<long> sum{0};
+	for (auto& batch : batches) {
+		for (int i = 0; i < per_thread; i++) {
+			batch.emplace_back();
+			batch.back()->then([&sum] (int x) { sum += x; });
+		}
+	}
+	vector<thread> workers;
+	for (auto& batch : batches) {
+		workers.emplace_back([&batch] {
+			for (auto& promise : batch) {
+				promise->resolve(1);
+			}
+			batch.clear();
+		});
+	}
+	for (auto& worker : workers) {
+		worker.join();
+	}
+	assert.expect(sum.load(), threads * per_thread, "PTHREAD");
+}
+
+int main(int argc, char *argv[])
+try {
+	pool_test();
+	promise_test();
+	return assert.print(argc, argv);
+} catch (...) {
+	assert.print_error();
+}
@@ -142,20 +142,17 @@ string format_result(const time_point<system_clock>& start, const int& i, const
 	return to_string(i) + "! = " + note;
 }
 
-decimal series_product(const vector<decimal>& series)
+Promise<decimal> series_product(const vector<decimal>& series)
 {
 	if (series.size() == 0) {
 		throw invalid_argument("Product of empty series");
 	}
-	decimal reductor{series[0]};
-	bool first = true;
-	for (const auto& value : series) {
-		if (first) {
-			first = false;
-			continue;
-		}
-		reductor = decimal::parallel_multiply(reductor, value);
-		//reductor *= value;
+	auto reductor = promise::resolved(series[0]);
+	for (auto it = next(series.cbegin()); it != series.cend(); ++it) {
+		reductor = reductor
+			->then([value = *it] (decimal reduced) {
+				return decimal::parallel_multiply(loop, reduced, value);
+			});
 	}
 	return reductor;
 }
@@ -184,7 +181,8 @@ const auto calcPartialFactorial = promise::dispatchable(partial_factorial_tuple,
 const auto formatResult = promise::dispatchable(format_result,
 	EventLoopPool::interaction, EventLoopPool::reactor) << ref(loop);
 
-const auto seriesProduct = promise::dispatchable(series_product,
+const auto seriesProduct = promise::task(
+	promise::Factory<decimal, const vector<decimal>&>(series_product),
 	EventLoopPool::calculation, EventLoopPool::reactor) << ref(loop);
 
 void calculateMultipleFactorials()
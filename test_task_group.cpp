@@ -0,0 +1,150 @@
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <stdexcept>
+#include "assertion.h"
+#include "event_loop.h"
+#include "promise.h"
+#include "task_group.h"
+
+using namespace std;
+using namespace std::chrono_literals;
+using namespace kaiu;
+
+Assertions assert({
+	{ nullptr, "Joining" },
+	{ "JOIN", "join resolves once all tasks have run" },
+	{ "JEMPTY", "join of an empty group resolves at once" },
+	{ "WAIT", "wait returns once all tasks have run" },
+	{ "ERROR", "First exception rejects join and is rethrown by wait, other tasks still run" },
+	{ "ELATE", "Exceptions are passed on by join after the tasks have finished" },
+	{ nullptr, "Help-first" },
+	{ "NESTED", "Nested groups waited for by workers of a one-thread pool do not deadlock" },
+	{ "SYNC", "wait inside a synchronous event loop runs the tasks inline" },
+});
+
+const int tasks = 1000;
+
+void join_test()
+{
+	ParallelEventLoop loop({
+		{ EventLoopPool::reactor, 1 },
+		{ EventLoopPool::calculation, 2 }
+	});
+	TaskGroup group(loop);
+	atomic<int> ran{0};
+	atomic<int> seen{-1};
+	for (int i = 0; i < tasks; i++) {
+		group.spawn([&ran] (EventLoop&) { ran++; });
+	}
+	group.join()
+		->then([&ran, &seen] (nullptr_t) { seen = ran.load(); });
+	for (int i = 0; i < 500 && seen < 0; i++) {
+		this_thread::sleep_for(2ms);
+	}
+	bool empty_resolved = false;
+	TaskGroup(loop).join()
+		->then([&empty_resolved] (nullptr_t) { empty_resolved = true; });
+	TaskGroup waited(loop);
+	atomic<int> waited_ran{0};
+	for (int i = 0; i < tasks; i++) {
+		waited.spawn([&waited_ran] (EventLoop&) { waited_ran++; });
+	}
+	waited.wait();
+	const int after_wait = waited_ran;
+	loop.join();
+	assert.expect(seen.load(), tasks, "JOIN");
+	assert.expect(empty_resolved, true, "JEMPTY");
+	assert.expect(after_wait == tasks && waited.pending() == 0, true, "WAIT");
+}
+
+void error_test()
+{
+	ParallelEventLoop loop({
+		{ EventLoopPool::calculation, 2 }
+	});
+	TaskGroup group(loop);
+	atomic<int> ran{0};
+	for (int i = 0; i < 100; i++) {
+		group.spawn([&ran, i] (EventLoop&) {
+			ran++;
+			if (i % 10 == 0) {
+				throw runtime_error("Failed");
+			}
+		});
+	}
+	atomic<bool> rejected{false};
+	group.join()
+		->then(
+			[] (nullptr_t) { },
+			[&rejected] (exception_ptr) { rejected = true; });
+	bool thrown = false;
+	try {
+		group.wait();
+	} catch (const runtime_error&) {
+		thrown = true;
+	}
+	TaskGroup finished(loop);
+	finished.spawn([] (EventLoop&) { throw runtime_error("Failed"); });
+	loop.join();
+	bool rejected_late = false;
+	finished.join()
+		->then(
+			[] (nullptr_t) { },
+			[&rejected_late] (exception_ptr) { rejected_late = true; });
+	assert.expect(thrown && rejected && ran == 100, true, "ERROR");
+	assert.expect(rejected_late, true, "ELATE");
+}
+
+/* Fork/join recursion, each level waits for its own group */
+void fib(EventLoop& loop, const int n, long& result)
+{
+	if (n < 2) {
+		result = n;
+		return;
+	}
+	long a;
+	long b;
+	TaskGroup group(loop);
+	group.spawn([&loop, n, &a] (EventLoop&) { fib(loop, n - 1, a); });
+	group.spawn([&loop, n, &b] (EventLoop&) { fib(loop, n - 2, b); });
+	group.wait();
+	result = a + b;
+}
+
+void nested_test()
+{
+	{
+		ParallelEventLoop loop({
+			{ EventLoopPool::calculation, 1 }
+		});
+		atomic<long> result{0};
+		loop.push(EventLoopPool::calculation, [&result] (EventLoop& loop) {
+			long x;
+			fib(loop, 16, x);
+			result = x;
+		});
+		for (int i = 0; i < 1000 && result == 0; i++) {
+			this_thread::sleep_for(2ms);
+		}
+		loop.join();
+		assert.expect(result.load(), 987L, "NESTED");
+	}
+	{
+		long result = 0;
+		SynchronousEventLoop loop([&result] (EventLoop& loop) {
+			fib(loop, 12, result);
+		});
+		assert.expect(result, 144L, "SYNC");
+	}
+}
+
+int main(int argc, char *argv[])
+try {
+	join_test();
+	error_test();
+	nested_test();
+	return assert.print(argc, argv);
+} catch (...) {
+	assert.print_error();
+}
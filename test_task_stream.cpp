@@ -5,6 +5,7 @@
 #include <iostream>
 #include <queue>
 #include <atomic>
+#include <vector>
 #include "assertion.h"
 #include "promise.h"
 #include "promise_stream.h"
@@ -20,6 +21,11 @@ Assertions assert({
 	{ nullptr, "Concurrency" },
 	{ "SYNCHRO", "Structured deadlock test" },
 	{ "RSYNCHRO", "Random deadlock test" },
+	{ nullptr, "Parallel consumer" },
+	{ "APAR", "Consumer runs on several pool threads, up to max_in_flight" },
+	{ "AORDER", "Ordered map results are in order of data, result in reaction pool" },
+	{ nullptr, "Single producer" },
+	{ "ASPSC", "Data written without the lock reach a consumer thread in order" },
 	{ nullptr, "Monads" },
 	{ "MONAD", "Stateless" },
 	{ "MONADS", "Stateful" }
@@ -140,6 +146,8 @@ private:
 	int returned = 0;
 };
 
+constexpr char Order::state_chars[4];
+
 void synchronization_order_test(const string name, Order& order, int idx)
 {
 	int locks;
@@ -367,6 +375,71 @@ void concurrency_test()
 	assert.skip("RSYNCHRO", "Takes a really long time");
 }
 
+void parallel_test()
+{
+	ParallelEventLoop loop({
+		{ EventLoopPool::reactor, 1 },
+		{ EventLoopPool::calculation, 6 }
+	});
+	AsyncPromiseStream<int, int> stream(loop, EventLoopPool::calculation, EventLoopPool::reactor);
+	atomic<int> running{0};
+	atomic<int> most{0};
+	vector<int> out;
+	EventLoopPool completed_in = EventLoopPool::invalid;
+	Trigger done;
+	stream
+		->stream_parallel([&] (int x) {
+			const int now = ++running;
+			int prev = most;
+			while (now > prev && !most.compare_exchange_weak(prev, now)) { }
+			this_thread::sleep_for(10ms);
+			running--;
+			return x * x;
+		}, 4, StreamOrder::ordered)
+		->stream([&out] (int x) { out.push_back(x); })
+		->then([&] (int) {
+			completed_in = ParallelEventLoop::current_pool();
+			done.fire();
+		});
+	for (int i = 0; i < 16; i++) {
+		stream->write(i);
+	}
+	stream->resolve(0);
+	const bool finished = done.wait_for(5s);
+	loop.join();
+	vector<int> expect;
+	for (int i = 0; i < 16; i++) {
+		expect.push_back(i * i);
+	}
+	assert.expect(finished && most > 1 && most <= 4, true, "APAR");
+	assert.expect(out == expect && completed_in == EventLoopPool::reactor, true, "AORDER");
+}
+
+void single_producer_test()
+{
+	ParallelEventLoop loop({
+		{ EventLoopPool::calculation, 1 }
+	});
+	AsyncPromiseStream<int, int> stream(loop, EventLoopPool::calculation);
+	stream->set_single_producer(64);
+	const int count = 100000;
+	int next = 0;
+	bool ordered = true;
+	Trigger done;
+	stream
+		->stream([&] (int x) {
+			ordered = ordered && x == next++;
+		})
+		->then([&] (int) { done.fire(); });
+	for (int i = 0; i < count; i++) {
+		stream->write(i);
+	}
+	stream->resolve(0);
+	const bool finished = done.wait_for(20s);
+	loop.join();
+	assert.expect(finished && ordered && next == count, true, "ASPSC");
+}
+
 void operator_test()
 {
 	using namespace kaiu::promise::monads;
@@ -431,6 +504,8 @@ void operator_test()
 int main(int argc, char *argv[])
 try {
 	concurrency_test();
+	parallel_test();
+	single_producer_test();
 	operator_test();
 	return assert.print(argc, argv);
 } catch (...) {
@@ -0,0 +1,167 @@
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <mutex>
+#include "assertion.h"
+#include "timer_wheel.h"
+#include "event_loop.h"
+#include "promise.h"
+#include "timer.h"
+
+using namespace kaiu;
+using namespace std;
+using namespace std::chrono;
+using namespace std::chrono_literals;
+
+Assertions assert({
+	{ nullptr, "Timer wheel" },
+	{ "WORDER", "Items fire in order of due time, across cascades" },
+	{ "WEARLY", "Items never fire early" },
+	{ "WCANCEL", "Cancelled items do not fire, stale ids are rejected" },
+	{ nullptr, "Delayed events" },
+	{ "SAFTER", "Synchronous loop runs delayed events in order" },
+	{ "PAFTER", "Parallel loop runs delayed events, join waits for them" },
+	{ "PCANCEL", "Cancelled delayed events do not run" },
+	{ nullptr, "Promises" },
+	{ "DELAY", "delay resolves after the given duration" },
+	{ "TPASS", "timeout passes on result of promise which completes in time" },
+	{ "TFAIL", "timeout rejects with timeout_error when time runs out" }
+});
+
+void test_wheel()
+{
+	using Clock = TimerWheel<int>::Clock;
+	const auto start = Clock::now();
+	TimerWheel<int> wheel(1ms, start);
+	/* Due times (ms) spanning level 0, level 1 and level 2 */
+	const vector<int> delays{ 70000, 3, 255, 256, 300, 1000, 65535, 65536, 100 };
+	for (const auto delay : delays) {
+		wheel.insert(start + milliseconds(delay), int(delay));
+	}
+	vector<int> fired;
+	bool early = false;
+	for (int t = 0; t <= 70000; t++) {
+		const size_t before = fired.size();
+		wheel.advance(start + milliseconds(t), fired);
+		for (size_t i = before; i < fired.size(); i++) {
+			if (fired[i] > t) {
+				early = true;
+			}
+		}
+	}
+	assert.expect(fired, vector<int>{ 3, 100, 255, 256, 300, 1000, 65535, 65536, 70000 }, "WORDER");
+	assert.expect(early || !wheel.empty(), false, "WEARLY");
+	/* Cancel */
+	const auto a = wheel.insert(start + 70010ms, 1);
+	const auto b = wheel.insert(start + 70020ms, 2);
+	const bool cancelled = wheel.cancel(a);
+	const bool recancelled = wheel.cancel(a);
+	fired.clear();
+	wheel.advance(start + 71000ms, fired);
+	/* Slot of a is reused by c, a's id must not cancel c */
+	const auto c = wheel.insert(start + 72000ms, 3);
+	const bool stale = wheel.cancel(a);
+	assert.expect(cancelled && !recancelled && !stale && c != a &&
+		!wheel.cancel(b) && fired == vector<int>{ 2 } && wheel.size() == 1,
+		true, "WCANCEL");
+}
+
+void test_sync()
+{
+	string order;
+	const auto start = EventLoop::Clock::now();
+	bool early = false;
+	SynchronousEventLoop loop([&] (EventLoop& loop) {
+		loop.push_after(EventLoopPool::reactor, 30ms, [&] (EventLoop&) {
+			early |= EventLoop::Clock::now() - start < 30ms;
+			order += "C";
+		});
+		loop.push_after(EventLoopPool::reactor, 10ms, [&] (EventLoop& loop) {
+			early |= EventLoop::Clock::now() - start < 10ms;
+			order += "B";
+		});
+		loop.push([&] (EventLoop&) { order += "A"; });
+	});
+	assert.expect(order + (early ? " early" : ""), "ABC", "SAFTER");
+}
+
+void test_parallel()
+{
+	ParallelEventLoop loop({
+		{ EventLoopPool::reactor, 1 },
+		{ EventLoopPool::calculation, 2 }
+	});
+	atomic<int> count{0};
+	const auto start = EventLoop::Clock::now();
+	for (int i = 1; i <= 5; i++) {
+		loop.push_after(EventLoopPool::calculation, milliseconds(10 * i), [&count] (EventLoop&) {
+			count++;
+		});
+	}
+	/* Delayed from within a pool, to the same pool */
+	loop.push(EventLoopPool::reactor, [&count] (EventLoop& loop) {
+		loop.push_after(EventLoopPool::same, 20ms, [&count] (EventLoop&) {
+			if (ParallelEventLoop::current_pool() == EventLoopPool::reactor) {
+				count++;
+			}
+		});
+	});
+	loop.join();
+	assert.expect(count == 6 && EventLoop::Clock::now() - start >= 50ms, true, "PAFTER");
+	atomic<bool> ran{false};
+	auto timer = loop.push_after(EventLoopPool::reactor, 10s, [&ran] (EventLoop&) {
+		ran = true;
+	});
+	const bool cancelled = timer.cancel();
+	/* Would take ten seconds if the cancelled event were still pending */
+	loop.join();
+	assert.expect(cancelled && !ran && !timer.cancel() &&
+		EventLoop::Clock::now() - start < 5s, true, "PCANCEL");
+}
+
+void test_promises()
+{
+	ParallelEventLoop loop({
+		{ EventLoopPool::reactor, 1 }
+	});
+	const auto start = EventLoop::Clock::now();
+	atomic<bool> delayed{false};
+	promise::delay(loop, 20ms)
+		->then([&] (nullptr_t) {
+			delayed = EventLoop::Clock::now() - start >= 20ms;
+		});
+	atomic<int> passed{0};
+	promise::timeout(loop, promise::delay(loop, 10ms)->then([] (nullptr_t) { return 42; }), 10s)
+		->then([&] (int value) { passed = value; });
+	atomic<bool> timed_out{false};
+	Promise<int> never;
+	promise::timeout(loop, never, 30ms)
+		->then(
+			[&] (int) { },
+			[&] (exception_ptr error) {
+				try {
+					rethrow_exception(error);
+				} catch (const timeout_error&) {
+					timed_out = true;
+				} catch (...) {
+				}
+			});
+	loop.join();
+	/* Late result is discarded */
+	never->resolve(0);
+	assert.expect(delayed.load(), true, "DELAY");
+	assert.expect(passed.load() == 42 && EventLoop::Clock::now() - start < 5s, true, "TPASS");
+	assert.expect(timed_out.load(), true, "TFAIL");
+}
+
+int main(int argc, char *argv[])
+try {
+	test_wheel();
+	test_sync();
+	test_parallel();
+	test_promises();
+	return assert.print(argc, argv);
+} catch (...) {
+	assert.print_error();
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include <chrono>
+#include <stdexcept>
+#include "event_loop.h"
+#include "promise.h"
+
+namespace kaiu {
+
+
+/* Rejection reason of promises which did not complete in time */
+class timeout_error : public std::runtime_error {
+public:
+	using std::runtime_error::runtime_error;
+};
+
+namespace promise {
+
+/*
+ * Returns a promise which resolves (in the given pool) after the given delay
+ *
+ *   delay(loop, 100ms)
+ *     ->then([] (auto) { retry(); });
+ */
+template <typename Rep, typename Period>
+Promise<std::nullptr_t> delay(
+	EventLoop& loop,
+	const std::chrono::duration<Rep, Period> duration,
+	const EventLoopPool pool = EventLoopPool::reactor);
+
+/*
+ * Returns a promise which takes the result of the given promise if it
+ * completes within the given time, otherwise which rejects with timeout_error
+ * (in the given pool).
+ *
+ * The original promise is not cancelled when the time runs out, its result is
+ * just discarded.  If it completes in time, the pending timer is cancelled.
+ */
+template <typename Result, typename Rep, typename Period>
+Promise<Result> timeout(
+	EventLoop& loop,
+	Promise<Result> promise,
+	const std::chrono::duration<Rep, Period> duration,
+	const EventLoopPool pool = EventLoopPool::reactor);
+
+}
+
+}
+
+#ifndef timer_tcc
+#include "timer.tcc"
+#endif
@@ -0,0 +1,56 @@
+#define timer_tcc
+#include <atomic>
+#include <memory>
+#include "timer.h"
+
+namespace kaiu {
+
+namespace promise {
+
+template <typename Rep, typename Period>
+Promise<std::nullptr_t> delay(
+	EventLoop& loop,
+	const std::chrono::duration<Rep, Period> duration,
+	const EventLoopPool pool)
+{
+	Promise<std::nullptr_t> promise;
+	loop.push_after(pool, duration, [promise] (EventLoop&) {
+		promise->resolve(nullptr);
+	});
+	return promise;
+}
+
+template <typename Result, typename Rep, typename Period>
+Promise<Result> timeout(
+	EventLoop& loop,
+	Promise<Result> promise,
+	const std::chrono::duration<Rep, Period> duration,
+	const EventLoopPool pool)
+{
+	Promise<Result> result;
+	/* Whichever of the promise and the timer completes first wins */
+	auto settled = std::make_shared<std::atomic<bool>>(false);
+	auto timer = loop.push_after(pool, duration, [result, settled] (EventLoop&) {
+		if (!settled->exchange(true)) {
+			result->reject(std::make_exception_ptr(timeout_error("Promise timed out")));
+		}
+	});
+	promise->then(
+		[result, settled, timer] (Result value) {
+			if (!settled->exchange(true)) {
+				timer.cancel();
+				result->resolve(std::move(value));
+			}
+		},
+		[result, settled, timer] (std::exception_ptr error) {
+			if (!settled->exchange(true)) {
+				timer.cancel();
+				result->reject(error);
+			}
+		});
+	return result;
+}
+
+}
+
+}
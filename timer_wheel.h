@@ -0,0 +1,83 @@
+#pragma once
+#include <cstdint>
+#include <chrono>
+#include <vector>
+
+namespace kaiu {
+
+
+/*
+ * Hierarchical timer wheel (not thread-safe, the owner provides locking).
+ *
+ * Time is divided into ticks of a fixed resolution.  There are four levels of
+ * 256 slots each: level 0 holds items due within the current 256 ticks, level
+ * 1 those due within the current 65536 ticks, and so on.  Items further ahead
+ * than the top level are kept in an overflow slot.  When the current tick
+ * crosses a slot boundary of a higher level, the items in that slot are
+ * re-inserted ("cascaded") into the lower levels.
+ *
+ * Insert and cancel are O(1).  Items live in a slab of nodes linked by index,
+ * and are identified by (index, generation) so that stale ids are harmless.
+ *
+ * Items never fire early: due times are rounded up to the next tick.
+ */
+template <typename T>
+class TimerWheel {
+public:
+	using Clock = std::chrono::steady_clock;
+	using Id = std::uint64_t;
+	TimerWheel(const TimerWheel&) = delete;
+	TimerWheel& operator =(const TimerWheel&) = delete;
+	explicit TimerWheel(const Clock::duration resolution = std::chrono::milliseconds(1),
+		const Clock::time_point start = Clock::now());
+	/* Add an item, returns an id for cancel */
+	Id insert(const Clock::time_point due, T&& item);
+	/* Remove an item, returns false if the item already fired or was cancelled */
+	bool cancel(const Id id);
+	/* Move items which are due at or before now onto the end of out */
+	size_t advance(const Clock::time_point now, std::vector<T>& out);
+	/*
+	 * Time at which advance should next be called.  This may be before the
+	 * next item is due (when a cascade is needed), and is time_point::max() if
+	 * the wheel is empty.
+	 */
+	Clock::time_point next_wakeup() const;
+	bool empty() const { return count == 0; }
+	size_t size() const { return count; }
+private:
+	static constexpr int levels = 4;
+	static constexpr int slot_bits = 8;
+	static constexpr int slots = 1 << slot_bits;
+	static constexpr std::uint32_t nil = ~std::uint32_t(0);
+	struct Node {
+		T item;
+		std::uint64_t due;
+		std::uint32_t generation{0};
+		std::uint32_t prev{nil};
+		std::uint32_t next{nil};
+		/* List the node is in (level * slots + slot), nil if free */
+		std::uint32_t list{nil};
+	};
+	const Clock::duration resolution;
+	const Clock::time_point start;
+	std::uint64_t now_tick{0};
+	size_t count{0};
+	std::vector<Node> nodes;
+	std::uint32_t free_head{nil};
+	/* One list per slot per level, plus the overflow list */
+	std::vector<std::uint32_t> heads;
+	std::uint64_t tick_floor(const Clock::time_point time) const;
+	std::uint64_t tick_ceil(const Clock::time_point time) const;
+	Clock::time_point time_of(const std::uint64_t tick) const;
+	std::uint32_t list_for(const std::uint64_t due) const;
+	void link(const std::uint32_t index);
+	void unlink(const std::uint32_t index);
+	void release(const std::uint32_t index);
+	void cascade(const std::uint32_t list);
+};
+
+}
+
+#ifndef timer_wheel_tcc
+#include "timer_wheel.tcc"
+#endif
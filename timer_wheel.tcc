@@ -0,0 +1,199 @@
+#define timer_wheel_tcc
+#include <algorithm>
+#include "timer_wheel.h"
+
+namespace kaiu {
+
+
+template <typename T>
+constexpr std::uint32_t TimerWheel<T>::nil;
+
+template <typename T>
+TimerWheel<T>::TimerWheel(const Clock::duration resolution, const Clock::time_point start) :
+	resolution(resolution), start(start), heads(levels * slots + 1, nil)
+{
+}
+
+template <typename T>
+std::uint64_t TimerWheel<T>::tick_floor(const Clock::time_point time) const
+{
+	if (time <= start) {
+		return 0;
+	}
+	return (time - start) / resolution;
+}
+
+template <typename T>
+std::uint64_t TimerWheel<T>::tick_ceil(const Clock::time_point time) const
+{
+	if (time <= start) {
+		return 0;
+	}
+	const auto elapsed = time - start;
+	const std::uint64_t tick = elapsed / resolution;
+	return elapsed % resolution == Clock::duration::zero() ? tick : tick + 1;
+}
+
+template <typename T>
+auto TimerWheel<T>::time_of(const std::uint64_t tick) const -> Clock::time_point
+{
+	return start + resolution * tick;
+}
+
+template <typename T>
+std::uint32_t TimerWheel<T>::list_for(const std::uint64_t due) const
+{
+	/*
+	 * Lowest level at which due and now_tick agree on all higher-level bits,
+	 * so the slot is always ahead of the current position in that level.
+	 */
+	for (int level = 0; level < levels; level++) {
+		const int shift = slot_bits * (level + 1);
+		if ((due >> shift) == (now_tick >> shift)) {
+			const auto slot = (due >> (slot_bits * level)) & (slots - 1);
+			return level * slots + slot;
+		}
+	}
+	return levels * slots;
+}
+
+template <typename T>
+void TimerWheel<T>::link(const std::uint32_t index)
+{
+	Node& node = nodes[index];
+	node.list = list_for(node.due);
+	node.prev = nil;
+	node.next = heads[node.list];
+	if (node.next != nil) {
+		nodes[node.next].prev = index;
+	}
+	heads[node.list] = index;
+}
+
+template <typename T>
+void TimerWheel<T>::unlink(const std::uint32_t index)
+{
+	Node& node = nodes[index];
+	if (node.prev != nil) {
+		nodes[node.prev].next = node.next;
+	} else {
+		heads[node.list] = node.next;
+	}
+	if (node.next != nil) {
+		nodes[node.next].prev = node.prev;
+	}
+	node.list = nil;
+}
+
+template <typename T>
+void TimerWheel<T>::release(const std::uint32_t index)
+{
+	Node& node = nodes[index];
+	node.item = T();
+	node.generation++;
+	node.next = free_head;
+	free_head = index;
+	count--;
+}
+
+template <typename T>
+auto TimerWheel<T>::insert(const Clock::time_point due, T&& item) -> Id
+{
+	std::uint32_t index;
+	if (free_head != nil) {
+		index = free_head;
+		free_head = nodes[index].next;
+	} else {
+		index = nodes.size();
+		nodes.emplace_back();
+	}
+	Node& node = nodes[index];
+	node.item = std::move(item);
+	/* Items due now or in the past fire on the next tick */
+	node.due = std::max(tick_ceil(due), now_tick + 1);
+	link(index);
+	count++;
+	return (Id(node.generation) << 32) | index;
+}
+
+template <typename T>
+bool TimerWheel<T>::cancel(const Id id)
+{
+	const std::uint32_t index = id & nil;
+	const std::uint32_t generation = id >> 32;
+	if (index >= nodes.size()) {
+		return false;
+	}
+	Node& node = nodes[index];
+	if (node.generation != generation || node.list == nil) {
+		return false;
+	}
+	unlink(index);
+	release(index);
+	return true;
+}
+
+template <typename T>
+void TimerWheel<T>::cascade(const std::uint32_t list)
+{
+	std::uint32_t index = heads[list];
+	heads[list] = nil;
+	while (index != nil) {
+		const std::uint32_t next = nodes[index].next;
+		link(index);
+		index = next;
+	}
+}
+
+template <typename T>
+size_t TimerWheel<T>::advance(const Clock::time_point now, std::vector<T>& out)
+{
+	const auto target = tick_floor(now);
+	size_t fired = 0;
+	while (now_tick < target) {
+		if (count == 0) {
+			/* Nothing to cascade or fire, skip straight to target */
+			now_tick = target;
+			break;
+		}
+		now_tick++;
+		/* Cascade from the highest level whose slot boundary we crossed */
+		if ((now_tick & ((std::uint64_t(1) << (slot_bits * levels)) - 1)) == 0) {
+			cascade(levels * slots);
+		}
+		for (int level = levels - 1; level > 0; level--) {
+			const int shift = slot_bits * level;
+			if ((now_tick & ((std::uint64_t(1) << shift) - 1)) == 0) {
+				cascade(level * slots + ((now_tick >> shift) & (slots - 1)));
+			}
+		}
+		/* Fire everything in the current level-0 slot */
+		const std::uint32_t list = now_tick & (slots - 1);
+		while (heads[list] != nil) {
+			const std::uint32_t index = heads[list];
+			unlink(index);
+			out.emplace_back(std::move(nodes[index].item));
+			release(index);
+			fired++;
+		}
+	}
+	return fired;
+}
+
+template <typename T>
+auto TimerWheel<T>::next_wakeup() const -> Clock::time_point
+{
+	if (count == 0) {
+		return Clock::time_point::max();
+	}
+	/* Scan level 0 up to the next level-1 boundary, where a cascade is due */
+	const std::uint64_t boundary = (now_tick | (slots - 1)) + 1;
+	for (std::uint64_t tick = now_tick + 1; tick < boundary; tick++) {
+		if (heads[tick & (slots - 1)] != nil) {
+			return time_of(tick);
+		}
+	}
+	return time_of(boundary);
+}
+
+}
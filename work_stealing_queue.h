@@ -0,0 +1,92 @@
+#pragma once
+#include <deque>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+namespace kaiu {
+
+
+/*
+ * A set of deques, one per worker plus one shared "injection" deque.
+ *
+ * Workers push to and pop from the back of their own deque (LIFO, for cache
+ * locality).  Items pushed from outside of the worker set go into the
+ * injection deque.  A worker whose deque is empty takes from the front of the
+ * injection deque, then steals from the front of the other workers' deques.
+ *
+ * Each deque has its own mutex, which in the common case is only ever taken by
+ * its owner.  The condition variable is only signalled when some worker is
+ * actually sleeping.
+ */
+template <typename T>
+class WorkStealingQueue {
+public:
+	WorkStealingQueue(const WorkStealingQueue&) = delete;
+	WorkStealingQueue& operator=(const WorkStealingQueue&) = delete;
+	WorkStealingQueue() = delete;
+	explicit WorkStealingQueue(const size_t workers, bool nowaiting = false);
+	/*
+	 * Append item to the given worker's deque, or to the injection deque if
+	 * worker is not a valid worker index (e.g. -1)
+	 */
+	void push(const int worker, T&& item);
+	/* Append items [first, last) to one deque, with one lock and wakeup */
+	template <typename It>
+	void push_bulk(const int worker, It first, It last);
+	/*
+	 * Remove an item, preferring the given worker's own deque, then the
+	 * injection deque, then stealing from other workers.
+	 *
+	 * If no items are available then either:
+	 *   wait until there are if we're not in no-waiting mode
+	 *   return false without waiting if we are in no-waiting mode
+	 *
+	 * WaitGuard has the same semantics as for ConcurrentQueue<T>::pop, and is
+	 * always destroyed before the item that ended the wait is taken.
+	 */
+	template <typename WaitGuard, typename... GuardParam>
+	bool pop(const int worker, T& out, GuardParam&&... guard_param);
+	/*
+	 * As pop, but moves up to max items from one deque onto the end of out.
+	 * At most half of another worker's deque is stolen at once.
+	 */
+	template <typename WaitGuard, typename... GuardParam>
+	size_t pop_batch(const int worker, std::vector<T>& out, const size_t max, GuardParam&&... guard_param);
+	/* Set/unset no-waiting mode */
+	void set_nowaiting(bool value = true);
+	bool is_nowaiting() const;
+	/* Test if all deques are empty */
+	bool isEmpty(bool is_locked = false) const;
+	/* Total number of items ever pushed (for ParallelEventLoop::join) */
+	size_t push_count() const;
+private:
+	struct Lane {
+		mutable std::mutex lane_mutex;
+		std::deque<T> items;
+		/* Only written under lane_mutex, read without it by push_count */
+		std::atomic<size_t> pushes{0};
+	};
+	/* One lane per worker, followed by the injection lane */
+	std::vector<std::unique_ptr<Lane>> lanes;
+	const size_t workers;
+	std::atomic<bool> nowaiting{false};
+	/* Sleeping workers */
+	std::mutex sleep_mutex;
+	std::condition_variable wake;
+	std::atomic<size_t> sleepers{0};
+	/* Try to take up to max items without waiting */
+	size_t try_take(const int worker, std::vector<T>& out, const size_t max);
+	size_t lane_index(const int worker) const;
+	void wake_sleepers(const size_t count);
+	/* Test if any lane has items (takes each lane's lock in turn) */
+	bool has_items() const;
+};
+
+}
+
+#ifndef work_stealing_queue_tcc
+#include "work_stealing_queue.tcc"
+#endif
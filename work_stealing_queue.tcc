@@ -0,0 +1,196 @@
+#define work_stealing_queue_tcc
+#include "work_stealing_queue.h"
+
+namespace kaiu {
+
+
+template <typename T>
+WorkStealingQueue<T>::WorkStealingQueue(const size_t workers, bool nowaiting) :
+	workers(workers), nowaiting(nowaiting)
+{
+	lanes.reserve(workers + 1);
+	for (size_t i = 0; i <= workers; i++) {
+		lanes.emplace_back(new Lane());
+	}
+}
+
+template <typename T>
+size_t WorkStealingQueue<T>::lane_index(const int worker) const
+{
+	return worker >= 0 && size_t(worker) < workers ? worker : workers;
+}
+
+template <typename T>
+void WorkStealingQueue<T>::push(const int worker, T&& item)
+{
+	Lane& lane = *lanes[lane_index(worker)];
+	{
+		std::lock_guard<std::mutex> lock(lane.lane_mutex);
+		lane.items.push_back(std::move(item));
+		lane.pushes.store(lane.pushes.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	}
+	wake_sleepers(1);
+}
+
+template <typename T>
+template <typename It>
+void WorkStealingQueue<T>::push_bulk(const int worker, It first, It last)
+{
+	Lane& lane = *lanes[lane_index(worker)];
+	size_t count = 0;
+	{
+		std::lock_guard<std::mutex> lock(lane.lane_mutex);
+		for (; first != last; ++first, ++count) {
+			lane.items.push_back(std::move(*first));
+		}
+		lane.pushes.store(lane.pushes.load(std::memory_order_relaxed) + count, std::memory_order_relaxed);
+	}
+	wake_sleepers(count);
+}
+
+template <typename T>
+void WorkStealingQueue<T>::wake_sleepers(const size_t count)
+{
+	/*
+	 * A sleeper increments the sleeper count before it checks the lanes, so
+	 * either it sees our item or we see it and wake it.
+	 */
+	if (count == 0 || sleepers.load() == 0) {
+		return;
+	}
+	std::lock_guard<std::mutex> lock(sleep_mutex);
+	if (count == 1) {
+		wake.notify_one();
+	} else {
+		wake.notify_all();
+	}
+}
+
+template <typename T>
+size_t WorkStealingQueue<T>::try_take(const int worker, std::vector<T>& out, const size_t max)
+{
+	const size_t own = lane_index(worker);
+	size_t count = 0;
+	/* Own deque: newest first */
+	if (own < workers) {
+		Lane& lane = *lanes[own];
+		std::lock_guard<std::mutex> lock(lane.lane_mutex);
+		for (; count < max && !lane.items.empty(); count++) {
+			out.emplace_back(std::move(lane.items.back()));
+			lane.items.pop_back();
+		}
+		if (count) {
+			return count;
+		}
+	}
+	/* Injection deque, then steal from other workers: oldest first */
+	for (size_t i = 0; i <= workers; i++) {
+		const size_t index = (own + 1 + i) % (workers + 1);
+		if (index == own && own < workers) {
+			continue;
+		}
+		Lane& lane = *lanes[index];
+		std::lock_guard<std::mutex> lock(lane.lane_mutex);
+		/* Leave at least half of a worker's deque to its owner */
+		const size_t available = index == workers ?
+			lane.items.size() : (lane.items.size() + 1) / 2;
+		for (; count < max && count < available; count++) {
+			out.emplace_back(std::move(lane.items.front()));
+			lane.items.pop_front();
+		}
+		if (count) {
+			return count;
+		}
+	}
+	return 0;
+}
+
+template <typename T>
+template <typename WaitGuard, typename... GuardParam>
+bool WorkStealingQueue<T>::pop(const int worker, T& out, GuardParam&&... guard_param)
+{
+	std::vector<T> batch;
+	if (!pop_batch<WaitGuard>(worker, batch, 1, std::forward<GuardParam>(guard_param)...)) {
+		return false;
+	}
+	out = std::move(batch.front());
+	return true;
+}
+
+template <typename T>
+template <typename WaitGuard, typename... GuardParam>
+size_t WorkStealingQueue<T>::pop_batch(const int worker, std::vector<T>& out, const size_t max, GuardParam&&... guard_param)
+{
+	size_t count;
+	while (!(count = try_take(worker, out, max))) {
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-variable"
+		/*
+		 * Externally supplied wait callback guard, destroyed before we try to
+		 * take the item which woke us, so that ParallelEventLoop::join never
+		 * sees an item in flight between a deque and an idle worker.
+		 */
+		WaitGuard guard(std::forward<GuardParam>(guard_param)...);
+#pragma GCC diagnostic pop
+		std::unique_lock<std::mutex> lock(sleep_mutex);
+		++sleepers;
+		wake.wait(lock, [this] { return is_nowaiting() || has_items(); });
+		--sleepers;
+		if (is_nowaiting() && !has_items()) {
+			return 0;
+		}
+	}
+	return count;
+}
+
+template <typename T>
+bool WorkStealingQueue<T>::has_items() const
+{
+	for (const auto& lane : lanes) {
+		std::lock_guard<std::mutex> lock(lane->lane_mutex);
+		if (!lane->items.empty()) {
+			return true;
+		}
+	}
+	return false;
+}
+
+template <typename T>
+void WorkStealingQueue<T>::set_nowaiting(bool value)
+{
+	nowaiting = value;
+	std::lock_guard<std::mutex> lock(sleep_mutex);
+	wake.notify_all();
+}
+
+template <typename T>
+bool WorkStealingQueue<T>::is_nowaiting() const
+{
+	return nowaiting;
+}
+
+template <typename T>
+bool WorkStealingQueue<T>::isEmpty(bool is_locked) const
+{
+	if (!is_locked) {
+		return !has_items();
+	}
+	for (const auto& lane : lanes) {
+		if (!lane->items.empty()) {
+			return false;
+		}
+	}
+	return true;
+}
+
+template <typename T>
+size_t WorkStealingQueue<T>::push_count() const
+{
+	size_t count = 0;
+	for (const auto& lane : lanes) {
+		count += lane->pushes.load();
+	}
+	return count;
+}
+
+}